@@ -0,0 +1,467 @@
+/*
+    analyze_trace.cpp - summarize commands and replies in serial captures
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include "bewield.h"
+#include "decode.h"
+#include "trace.h"
+
+#include "argparse.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+
+/* Records whose delimiters are located in one pass, before any are parsed. */
+constexpr std::size_t SCAN_BATCH { 4096 };
+
+/* Longest frame kept; longer runs are line noise. */
+constexpr std::size_t FRAME_MAX { 128 };
+
+static_assert(offsetof(TraceRecord, bytes) == 12 && sizeof(TraceRecord) == 32,
+              "delimiter scanning assumes the version 2 record layout");
+
+
+/* Sets `masks[i]` to the delimiters (PREFIX, SUFFIX or CR) among the bytes
+ * of `records[i]`, bit n for byte n, for `count` records.
+ */
+using Scanner = void (*)(const TraceRecord *records, std::size_t count, uint32_t *masks);
+
+/* Returns the bits of a whole-record byte mask which fall on the bytes of
+ * `record`.
+ */
+static inline uint32_t payload_bits(const TraceRecord &record, uint32_t mask) {
+    auto length { std::min<std::size_t>(record.length, TRACE_CHUNK) };
+    return (mask >> offsetof(TraceRecord, bytes)) & ((1u << length) - 1);
+}
+
+static void scan_scalar(const TraceRecord *records, std::size_t count, uint32_t *masks) {
+    for ( std::size_t i { 0 }; i < count; ++i ) {
+        uint32_t mask { 0 };
+        for ( std::size_t b { 0 }; b < TRACE_CHUNK; ++b ) {
+            auto c { records[i].bytes[b] };
+            if ( c == PREFIX.front() || c == SUFFIX.back() || c == CR ) {
+                mask |= 1u << b;
+            }
+        }
+        masks[i] = mask & ((1u << std::min<std::size_t>(records[i].length, TRACE_CHUNK)) - 1);
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/* Each 32 byte record is two SSE2 registers. */
+__attribute__((target("sse2")))
+static void scan_sse2(const TraceRecord *records, std::size_t count, uint32_t *masks) {
+    auto prefix { _mm_set1_epi8(PREFIX.front()) };
+    auto suffix { _mm_set1_epi8(SUFFIX.back()) };
+    auto cr { _mm_set1_epi8(CR) };
+    for ( std::size_t i { 0 }; i < count; ++i ) {
+        auto base { reinterpret_cast<const __m128i *>(&records[i]) };
+        auto low { _mm_loadu_si128(base) };
+        auto high { _mm_loadu_si128(base + 1) };
+        auto low_hits { _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(low, prefix),
+                                                  _mm_cmpeq_epi8(low, suffix)),
+                                     _mm_cmpeq_epi8(low, cr)) };
+        auto high_hits { _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(high, prefix),
+                                                   _mm_cmpeq_epi8(high, suffix)),
+                                      _mm_cmpeq_epi8(high, cr)) };
+        uint32_t mask { static_cast<uint32_t>(_mm_movemask_epi8(low_hits))
+                        | static_cast<uint32_t>(_mm_movemask_epi8(high_hits)) << 16 };
+        masks[i] = payload_bits(records[i], mask);
+    }
+}
+
+/* Each 32 byte record is one AVX2 register. */
+__attribute__((target("avx2")))
+static void scan_avx2(const TraceRecord *records, std::size_t count, uint32_t *masks) {
+    auto prefix { _mm256_set1_epi8(PREFIX.front()) };
+    auto suffix { _mm256_set1_epi8(SUFFIX.back()) };
+    auto cr { _mm256_set1_epi8(CR) };
+    for ( std::size_t i { 0 }; i < count; ++i ) {
+        auto bytes { _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&records[i])) };
+        auto hits { _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(bytes, prefix),
+                                                     _mm256_cmpeq_epi8(bytes, suffix)),
+                                    _mm256_cmpeq_epi8(bytes, cr)) };
+        masks[i] = payload_bits(records[i], static_cast<uint32_t>(_mm256_movemask_epi8(hits)));
+    }
+}
+
+#endif
+
+/* Returns the Scanner called `name` ("avx2", "sse2" or "scalar"), or if
+ * `name` is empty the fastest one this processor runs, naming it in `name`.
+ *
+ * Throws `std::runtime_error` for an unknown or unsupported scanner.
+ */
+static Scanner pick_scanner(std::string &name) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if ( (name.empty() || name == "avx2") && __builtin_cpu_supports("avx2") ) {
+        name = "avx2";
+        return scan_avx2;
+    }
+    if ( (name.empty() || name == "sse2") && __builtin_cpu_supports("sse2") ) {
+        name = "sse2";
+        return scan_sse2;
+    }
+#endif
+    if ( name.empty() || name == "scalar" ) {
+        name = "scalar";
+        return scan_scalar;
+    }
+    throw std::runtime_error("Scanner '" + name + "' is not available.");
+}
+
+
+/* Counts of outcomes and reply latencies, for a port or a command. */
+struct Summary {
+    uint64_t commands { 0 };
+    uint64_t ok { 0 };
+    uint64_t blocked { 0 };
+    uint64_t unsupported { 0 };
+    uint64_t illegal { 0 };
+    uint64_t unanswered { 0 };
+    // lines holding no intact frame
+    uint64_t damaged { 0 };
+    // answers arriving while no command was outstanding
+    uint64_t stray { 0 };
+    // microseconds from sending a command to the end of its answer
+    std::vector<uint32_t> latencies;
+};
+
+/* Parsing state of one direction of one port. */
+struct Stream {
+    // bytes from the latest PREFIX, while a frame may be in progress
+    char frame[ FRAME_MAX ];
+    std::size_t size { 0 };
+    bool framing { false };
+};
+
+/* Parsing state of one port within a capture. */
+struct PortState {
+    Summary *summary { nullptr };
+    Stream sent;
+    Stream received;
+    // the command awaiting its answer, its message and when it was sent
+    Summary *pending { nullptr };
+    std::string pending_message;
+    uint64_t pending_time { 0 };
+};
+
+
+/* Summaries across every capture analyzed. */
+class Analysis {
+
+    private:
+
+        /* Command summaries keyed by protocol message. */
+        std::map<std::string, Summary *, std::less<>> m_messages;
+
+        std::map<std::string, Summary> m_ports;
+        std::map<std::string, Summary> m_commands;
+
+        /* Records analyzed so far. */
+        uint64_t m_records { 0 };
+
+        void answer(PortState &port, std::string_view body, uint64_t time);
+        void framed(PortState &port, bool sent, std::string_view frame, uint64_t time);
+        void unanswered(PortState &port);
+
+    public:
+
+        Analysis();
+
+        void add(const TraceReader &capture, Scanner scan);
+        void print(std::ostream &out, double outlier_ms);
+        uint64_t records() const;
+
+};
+
+
+Analysis::Analysis() {
+    for ( const auto &[cmd, message] : commands ) {
+        m_messages.emplace(message, &m_commands[cmd]);
+    }
+}
+
+/* Adds the outcome of the command pending on `port`, answered by `body` at
+ * `time`.
+ */
+void Analysis::answer(PortState &port, std::string_view body, uint64_t time) {
+    // Only a refusal needs telling apart from other answers.
+    auto refusal { lookup(REFUSAL_WORDS, body, Refusal::None) };
+    auto latency { static_cast<uint32_t>((time - port.pending_time) / 1000) };
+    for ( auto summary : { port.summary, port.pending } ) {
+        switch ( refusal ) {
+            case Refusal::None:
+                ++summary->ok;
+                break;
+            case Refusal::Blocked:
+                ++summary->blocked;
+                break;
+            case Refusal::Unsupported:
+                ++summary->unsupported;
+                break;
+            case Refusal::Illegal:
+                ++summary->illegal;
+                break;
+        }
+        summary->latencies.push_back(latency);
+    }
+    port.pending = nullptr;
+}
+
+/* Adds an intact `frame` sent to, or received from, `port` at `time`. */
+void Analysis::framed(PortState &port, bool sent, std::string_view frame, uint64_t time) {
+    auto body { frame.substr(1, frame.size() - 2) };
+    if ( sent ) {
+        // A command sent before the last was answered was given up on.
+        unanswered(port);
+        auto known { m_messages.find(body) };
+        if ( known == m_messages.end() ) {
+            // Not one of ours, e.g. sent by another tool; summarize as sent.
+            known = m_messages.emplace(body, &m_commands[std::string(body)]).first;
+        }
+        port.pending = known->second;
+        port.pending_message = body;
+        port.pending_time = time;
+        ++port.summary->commands;
+        ++port.pending->commands;
+    } else if ( port.pending == nullptr ) {
+        ++port.summary->stray;
+    } else if ( body != port.pending_message ) {
+        answer(port, body, time);
+    }
+}
+
+/* Counts the command pending on `port`, if any, as never answered. */
+void Analysis::unanswered(PortState &port) {
+    if ( port.pending != nullptr ) {
+        ++port.summary->unanswered;
+        ++port.pending->unanswered;
+        port.pending = nullptr;
+    }
+}
+
+/* Adds every exchange in `capture`, locating delimiters with `scan`. */
+void Analysis::add(const TraceReader &capture, Scanner scan) {
+    // The last PortState gathers traffic on unnamed ports.
+    std::vector<PortState> ports(capture.header().ports + 1);
+    for ( uint16_t i { 0 }; i < ports.size(); ++i ) {
+        ports[i].summary = &m_ports[capture.port(i)];
+    }
+
+    std::vector<uint32_t> masks(SCAN_BATCH);
+    auto records { capture.records() };
+    for ( std::size_t batch { 0 }; batch < capture.size(); batch += SCAN_BATCH ) {
+        auto count { std::min(SCAN_BATCH, capture.size() - batch) };
+        scan(records + batch, count, masks.data());
+
+        for ( std::size_t i { 0 }; i < count; ++i ) {
+            const auto &record { records[batch + i] };
+            auto &port { ports[std::min<std::size_t>(record.port, ports.size() - 1)] };
+            bool sent { record.direction == TraceDirection::Write };
+            auto &stream { sent ? port.sent : port.received };
+            auto length { std::min<std::size_t>(record.length, TRACE_CHUNK) };
+
+            // Between delimiters, whole runs of bytes are kept or skipped.
+            std::size_t from { 0 };
+            for ( auto mask { masks[i] }; ; mask &= mask - 1 ) {
+                std::size_t at { mask ? static_cast<std::size_t>(__builtin_ctz(mask)) : length };
+                if ( stream.framing ) {
+                    if ( stream.size + (at - from) > FRAME_MAX - 1 ) {
+                        stream.framing = false;
+                    } else {
+                        std::memcpy(stream.frame + stream.size, record.bytes + from, at - from);
+                        stream.size += at - from;
+                    }
+                }
+                if ( mask == 0 ) {
+                    break;
+                }
+
+                auto c { record.bytes[at] };
+                if ( c == PREFIX.front() ) {
+                    stream.frame[0] = c;
+                    stream.size = 1;
+                    stream.framing = true;
+                } else if ( c == SUFFIX.back() ) {
+                    if ( stream.framing ) {
+                        stream.frame[stream.size++] = c;
+                    }
+                } else {
+                    // CR ends a line, which must end in an intact frame.
+                    std::string_view candidate { stream.frame, stream.size };
+                    bool intact { stream.framing && candidate.size() > 2
+                                  && candidate.back() == SUFFIX.back()
+                                  && std::all_of(candidate.begin(), candidate.end(),
+                                                 [](char b) { return b >= ' ' && b <= '~'; }) };
+                    if ( intact ) {
+                        framed(port, sent, candidate, record.time);
+                    } else if ( stream.framing ) {
+                        ++port.summary->damaged;
+                    }
+                    stream.framing = false;
+                }
+                from = at + 1;
+            }
+        }
+    }
+
+    for ( auto &port : ports ) {
+        unanswered(port);
+    }
+    m_records += capture.size();
+}
+
+uint64_t Analysis::records() const {
+    return m_records;
+}
+
+/* Writes a summary of `summary` as TSV columns, counting latencies over
+ * `outlier_ms` as outliers.
+ */
+static void print_summary(std::ostream &out, Summary &summary, double outlier_ms) {
+    auto &latencies { summary.latencies };
+    std::sort(latencies.begin(), latencies.end());
+    auto at { [&](double share) {
+        return latencies.empty() ? 0.0
+               : latencies[static_cast<std::size_t>(share * (latencies.size() - 1))] / 1000.0;
+    } };
+    auto outliers { latencies.end() - std::upper_bound(latencies.begin(), latencies.end(),
+                                                       static_cast<uint32_t>(outlier_ms * 1000)) };
+
+    char times[ 80 ];
+    std::snprintf(times, sizeof(times), "%.1f\t%.1f\t%.1f", at(0.5), at(0.99), at(1.0));
+    out << summary.commands << '\t' << summary.ok << '\t' << summary.blocked
+        << '\t' << summary.unsupported << '\t' << summary.illegal
+        << '\t' << summary.unanswered << '\t' << times << '\t' << outliers;
+}
+
+/* Writes the per port and per command summaries as TSV tables. */
+void Analysis::print(std::ostream &out, double outlier_ms) {
+    const char *columns { "commands\tok\tblocked\tunsupported\tillegal\tunanswered"
+                          "\tp50_ms\tp99_ms\tmax_ms\toutliers" };
+
+    out << "port\t" << columns << "\tdamaged\tstray\n";
+    for ( auto &[name, summary] : m_ports ) {
+        out << name << '\t';
+        print_summary(out, summary, outlier_ms);
+        out << '\t' << summary.damaged << '\t' << summary.stray << '\n';
+    }
+
+    out << "\ncommand\t" << columns << '\n';
+    for ( auto &[name, summary] : m_commands ) {
+        if ( summary.commands == 0 ) {
+            continue;
+        }
+        out << name << '\t';
+        print_summary(out, summary, outlier_ms);
+        out << '\n';
+    }
+    out.flush();
+}
+
+
+/* Returns an ArgumentParser object created from command line arguments. */
+argparse::ArgumentParser read_args(const std::vector<std::string> arguments) {
+    argparse::ArgumentParser program { "analyze_trace" };
+
+    program.add_argument("captures")
+        .help("capture or trace files written by bewield")
+        .remaining();
+
+    program.add_argument("--outlier-ms")
+        .help("count replies slower than this as outliers")
+        .default_value(2000.0)
+        .scan<'g', double>();
+
+    program.add_argument("--scanner")
+        .help("delimiter scanner: avx2, sse2 or scalar [default: fastest available]")
+        .default_value(std::string {});
+
+    program.add_argument("--verbose")
+        .help("report scanning throughput on stderr")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.parse_args(arguments);
+
+    return program;
+}
+
+
+int main(int argc, const char* argv[]) {
+    argparse::ArgumentParser program;
+    std::vector<std::string> captures;
+    try {
+        std::vector<std::string> args;
+        std::copy(argv, argv + argc, std::back_inserter(args));
+
+        program = read_args(args);
+        captures = program.get<std::vector<std::string>>("captures");
+    } catch ( const std::exception &e ) {
+        std::cout << "Name one or more capture files." << std::endl;
+        return EINVAL;
+    }
+
+    Analysis analysis;
+    std::string scanner_name { program.get("--scanner") };
+    auto start { std::chrono::steady_clock::now() };
+    try {
+        auto scanner { pick_scanner(scanner_name) };
+        for ( const auto &path : captures ) {
+            TraceReader capture { path };
+            analysis.add(capture, scanner);
+        }
+    } catch ( const std::runtime_error &e ) {
+        std::cout << e.what() << std::endl;
+        return EINVAL;
+    }
+    std::chrono::duration<double> elapsed { std::chrono::steady_clock::now() - start };
+
+    analysis.print(std::cout, program.get<double>("--outlier-ms"));
+
+    if ( program.get<bool>("--verbose") ) {
+        auto bytes { analysis.records() * sizeof(TraceRecord) };
+        std::cerr << "scanned " << analysis.records() << " records ("
+                  << bytes / 1e6 << " MB) in " << elapsed.count() << " s with "
+                  << scanner_name << ", " << bytes / 1e9 / elapsed.count() << " GB/s"
+                  << std::endl;
+    }
+
+    return EXIT_SUCCESS;
+}
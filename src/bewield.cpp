@@ -19,68 +19,470 @@
 */
 
 #include "bewield.h"
+#include "board.h"
+#include "capability.h"
+#include "daemon.h"
+#include "decode.h"
+#include "exchange.h"
+#include "fanout.h"
+#include "history.h"
+#include "inventory.h"
 #include "lineal.h"
+#include "poller.h"
+#include "portlock.h"
+#include "portman.h"
+#include "portpool.h"
+#include "report.h"
+#include "scheduler.h"
+#include "trace.h"
 
 #include "argparse.hpp"
 
 #include <algorithm>
+#include <chrono>
+#include <csignal>
 #include <cstdlib>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <map>
 #include <memory>
+#include <sstream>
 #include <string>
-#include <termios.h>
 #include <vector>
 
 
-/* Returns a projector message.  These are always feedback for the latest sent
- * serial remote command.
+/* Set by signal handler to end long-running modes. */
+volatile std::sig_atomic_t stopping { 0 };
+
+
+/* Publishes projector status for `ports` to the status board at `path` until
+ * interrupted, and records its changes in the history directory `history`,
+ * if given.
+ */
+int publish_board(const std::string &path, const std::vector<std::string> &ports,
+                  const std::string &history, int interval_ms) {
+    std::signal(SIGINT, [](int) { stopping = 1; });
+    std::signal(SIGTERM, [](int) { stopping = 1; });
+
+    try {
+        Board board { path, ports };
+        std::unique_ptr<HistoryWriter> writer;
+        if ( ! history.empty() ) {
+            writer = std::make_unique<HistoryWriter>(history, ports);
+        }
+        PortManager manager;
+        Poller poller { board, manager, interval_ms, writer.get() };
+        poller.run(stopping);
+    } catch ( const std::runtime_error &e ) {
+        std::cout << e.what() << std::endl;
+        return EINVAL;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+
+/* Serves `ports` until interrupted: runs commands from the schedule file at
+ * `path`, if any, answers HTTP clients on `http` and binary clients on
+ * `control`, if given, relays frames from clients of each of `gateways` to
+ * the port in the same place, and pushes changes of state to clients of
+ * `events`, if given, who may name ports through `inventory`.  Results of
+ * commands run for any of these are reported as they complete, and changes
+ * of state are recorded in the history directory `history`, if given.
+ */
+int serve(const std::string &path, const std::vector<std::string> &ports,
+          const Inventory &inventory, const std::string &http, const std::string &control,
+          const std::vector<std::string> &gateways, const std::string &events,
+          const std::string &history, Report &report, int concurrency, int retries,
+          int interval_ms) {
+    std::signal(SIGINT, [](int) { stopping = 1; });
+    std::signal(SIGTERM, [](int) { stopping = 1; });
+
+    try {
+        if ( ! gateways.empty() && gateways.size() != ports.size() ) {
+            throw std::runtime_error("Give one --gateway address for each port.");
+        }
+        std::vector<Action> actions;
+        if ( ! path.empty() ) {
+            std::ifstream schedule { path };
+            if ( ! schedule ) {
+                throw std::runtime_error("Cannot read schedule file '" + path + "'.");
+            }
+            actions = read_schedule(schedule, ports);
+        }
+        Daemon daemon { ports, std::move(actions), inventory, report, concurrency, retries,
+                        interval_ms };
+        if ( ! history.empty() ) {
+            daemon.archive(history);
+        }
+        if ( ! http.empty() ) {
+            daemon.listen(http);
+        }
+        if ( ! control.empty() ) {
+            daemon.control(control);
+        }
+        if ( ! events.empty() ) {
+            daemon.push(events);
+        }
+        for ( std::size_t i { 0 }; i < gateways.size(); ++i ) {
+            daemon.relay(gateways[i], ports[i]);
+        }
+        daemon.run(stopping);
+    } catch ( const std::runtime_error &e ) {
+        std::cout << e.what() << std::endl;
+        return EINVAL;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+
+/* Prints a snapshot of every record on the status board at `path`. */
+int show_board(const std::string &path) {
+    try {
+        Board board { path };
+        for ( std::size_t i { 0 }; i < board.ports(); ++i ) {
+            BoardState state;
+            std::cout << board.port(i) << ": ";
+            if ( ! board.read(i, state) ) {
+                std::cout << "busy" << std::endl;
+                continue;
+            }
+            auto name { [](uint8_t value) {
+                auto word { spelling(VALUE_WORDS, static_cast<Value>(value)) };
+                return word.empty() ? std::string_view { "-" } : word;
+            } };
+            std::cout << ((state.flags & BOARD_ONLINE) ? "online" : "offline")
+                      << " power=" << name(state.power)
+                      << " source=" << name(state.source)
+                      << " volume=" << state.volume
+                      << " blank=" << name(state.blank) << std::endl;
+        }
+    } catch ( const std::runtime_error &e ) {
+        std::cout << e.what() << std::endl;
+        return EINVAL;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+
+/* Returns the tasks listed in a batch, one per line as either "command",
+ * which runs on every port in `ports`, or "port command".
  *
- * Throws `std::runtime_error` for various errors and warnings reported by the
- * projector.
+ * Blank lines and lines starting with '#' are skipped.
+ */
+std::vector<Task> read_batch(std::istream &in, const std::vector<std::string> &ports) {
+    std::vector<Task> tasks;
+    std::string line;
+    while ( std::getline(in, line) ) {
+        std::istringstream words { line };
+        std::string first, second;
+        if ( ! (words >> first) || first.front() == '#' ) {
+            continue;
+        }
+        if ( words >> second ) {
+            tasks.push_back(Task { first, second });
+        } else {
+            for ( const auto &port : ports ) {
+                tasks.push_back(Task { port, first });
+            }
+        }
+    }
+    return tasks;
+}
+
+
+/* Prints the commands, with the support cached for each of `ports` whose
+ * projector model is known.
  */
-const std::string recv(Lineal &device) {
-    std::string response;
-    bool response_complete { false };
+void list_commands(const Capabilities *cache, const std::vector<std::string> &ports) {
+    std::vector<std::pair<std::string, std::string>> columns;
+    if ( cache != nullptr ) {
+        for ( const auto &port : ports ) {
+            if ( auto model { cache->model(port) }; ! model.empty() ) {
+                columns.emplace_back(port, model);
+            }
+        }
+    }
 
-    char buffer[ 32 ];
+    std::size_t width { 0 };
+    for ( const auto &[cmd, _unused] : commands ) {
+        width = std::max(width, cmd.size());
+    }
 
-    while ( ! response_complete ) {
-        auto ret { device.readBytes(buffer, sizeof(buffer)) };
-        if ( ret < 0 ) {
-            throw std::runtime_error("Fatal error while reading from projector.");
+    std::cout << "bewield commands:" << std::endl;
+    if ( ! columns.empty() ) {
+        std::cout << "  " << std::left << std::setw(width) << "";
+        for ( const auto &[port, model] : columns ) {
+            std::cout << "  " << port << " (" << model << ")";
+        }
+        std::cout << std::endl;
+    }
+    for ( const auto &[cmd, _unused] : commands ) {
+        std::cout << "  " << std::left << std::setw(columns.empty() ? 0 : width) << cmd;
+        for ( const auto &[port, model] : columns ) {
+            // Pad to the width of the heading, but not past the last column.
+            auto heading { &model == &columns.back().second
+                           ? 0 : port.size() + model.size() + 3 };
+            std::string mark;
+            switch ( cache->support(model, cmd) ) {
+                case Support::Supported:
+                    mark = "yes";
+                    break;
+                case Support::Unsupported:
+                    mark = "no";
+                    break;
+                case Support::Unknown:
+                    mark = "?";
+                    break;
+            }
+            std::cout << "  " << std::setw(heading) << mark;
         }
-        response.append(buffer, ret);
-        response_complete = std::count(response.begin(), response.end(), SUFFIX.back()) == 2;
+        std::cout << std::endl;
+    }
+}
+
+
+/* Runs `tasks` on many ports at once, reporting every result as soon as it
+ * is known, then totals for each ","-separated term of the target
+ * `expression`.
+ *
+ * Commands the capability `cache` knows a port's model does not support fail
+ * at once, as in run_tasks(), but no projector is probed.  Commands not
+ * answered by `deadline` are dropped.
+ *
+ * Returns the exit status for the first failed task, or EXIT_SUCCESS.
+ */
+int fan_out(const std::vector<Task> &tasks, Report &report, const Inventory &inventory,
+            const std::string &expression, int concurrency, int stagger_ms,
+            int retries, Deadline deadline, Capabilities *cache) {
+    auto &progress { report.format() == Format::Text ? std::cout : std::cerr };
+
+    int status { EXIT_SUCCESS };
+    // Error classes counted for each term of the expression.
+    auto terms { target_terms(expression) };
+    std::vector<std::vector<std::string>> term_ports;
+    std::vector<std::map<std::string, int>> totals(terms.size());
+    for ( const auto &term : terms ) {
+        term_ports.push_back(inventory.select(term));
     }
 
-    auto start { response.rfind(PREFIX, std::string::npos) + 1 };
-    auto end { response.rfind(SUFFIX, std::string::npos) };
-    auto r { response.substr(start, end-start) };
+    auto record { [&](const Result &result) {
+        report.write(result);
+        std::cout.flush();
 
-    if ( r == "Block item" ) {
-        throw std::runtime_error("Command not currently available, try again.");
-    } else if ( r == "Unsupported item" ) {
-        throw std::runtime_error("Command not supported.");
-    } else if ( r == "Illegal format" ) {
-        throw std::runtime_error("Incorrect command format.");
+        std::string kind { error_class(result.error) };
+        for ( std::size_t i { 0 }; i < terms.size(); ++i ) {
+            const auto &ports { term_ports[i] };
+            if ( std::find(ports.begin(), ports.end(), result.port) != ports.end() ) {
+                ++totals[i][kind];
+            }
+        }
+        if ( result.error && status == EXIT_SUCCESS ) {
+            bool unopened { kind == "io" && result.attempts == 0 };
+            bool misspelled { kind == "unknown_command"
+                              || (kind == "illegal" && is_volume_set(result.cmd)
+                                  && ! volume_level(result.cmd)) };
+            status = (misspelled || unopened) ? EINVAL
+                     : kind == "expired" ? ETIME : EAGAIN;
+        }
+    } };
+
+    report.header();
+    std::vector<Task> sent;
+    for ( const auto &task : tasks ) {
+        auto model { cache != nullptr ? cache->model(task.port) : "" };
+        if ( ! model.empty() && cache->support(model, task.cmd) == Support::Unsupported ) {
+            Result result { task.port, task.cmd };
+            result.error = std::make_exception_ptr(ProjectorError(
+                Refusal::Unsupported, "Command not supported by " + model + "."));
+            record(result);
+        } else {
+            sent.push_back(task);
+        }
     }
 
-    return r;
+    try {
+        PortManager manager;
+        FanOut fan { manager, concurrency, stagger_ms, retries, deadline };
+        fan.run(sent, [&](const Result &result) {
+            if ( cache != nullptr ) {
+                cache->learn(cache->model(result.port), result);
+            }
+            record(result);
+        });
+    } catch ( const std::system_error &e ) {
+        std::cout << e.what() << std::endl;
+        return EINVAL;
+    }
+
+    if ( cache != nullptr ) {
+        try {
+            cache->save();
+        } catch ( const std::system_error &e ) {
+            // What was learned is learned again next time.
+        }
+    }
+
+    for ( std::size_t i { 0 }; i < terms.size(); ++i ) {
+        progress << terms[i] << ":";
+        const char *separator { " " };
+        for ( const auto &[kind, count] : totals[i] ) {
+            progress << separator << count << ' ' << kind;
+            separator = ", ";
+        }
+        progress << std::endl;
+    }
+
+    return status;
 }
 
 
-/* Sends a message to the projector and returns the quantity of sent bytes. */
-std::size_t send(Lineal &device, const std::string cmd) {
-    // Build a message from necessary parts.
-    const std::string msg { CR + PREFIX + commands.at(cmd) + SUFFIX + CR };
+/* Runs `tasks` one port at a time, in order of each port's first task, and
+ * reports every result as soon as it is known.
+ *
+ * With a capability `cache`, commands the model last seen on a port is known
+ * not to support fail at once without being sent.  A projector whose model
+ * is not yet known is identified, and a model's queries probed once, only
+ * after its own commands have run, and only if it answered them, so these
+ * never delay the commands nor wait on a silent projector.  `probe`
+ * identifies and probes every projector again first, regardless.  Commands
+ * not answered by `deadline` are dropped.
+ *
+ * Returns the exit status for the first failed task, or EXIT_SUCCESS.
+ */
+int run_tasks(const std::vector<Task> &tasks, Report &report, int retries, Deadline deadline,
+              Capabilities *cache, bool probe, bool verbose) {
+    // Progress messages must not mix with machine readable records.
+    auto &progress { report.format() == Format::Text ? std::cout : std::cerr };
+
+    std::vector<std::string> ports;
+    for ( const auto &task : tasks ) {
+        if ( std::find(ports.begin(), ports.end(), task.port) == ports.end() ) {
+            ports.push_back(task.port);
+        }
+    }
+
+    int status { EXIT_SUCCESS };
+    report.header();
+    PortPool pool;
+    for ( const auto &port : ports ) {
+        if ( verbose ) {
+            progress << "opening " << port << std::endl;
+        }
+
+        PortPool::Lease serial;
+        std::exception_ptr open_error;
+        try {
+            serial = pool.checkout(port);
+            if ( verbose ) {
+                progress << port << " ready" << std::endl;
+            }
+        } catch ( const std::system_error &e ) {
+            open_error = std::current_exception();
+        }
+
+        std::string model;
+        if ( serial && cache != nullptr ) {
+            model = cache->model(port);
+            if ( probe ) {
+                model = cache->identify(*serial, retries);
+                if ( ! model.empty() ) {
+                    cache->forget(model);
+                    if ( verbose ) {
+                        progress << "probing " << model << " on " << port << std::endl;
+                    }
+                    cache->probe(*serial, model, retries);
+                }
+            }
+        }
+
+        // Results the projector answered, to learn from once its model is known.
+        std::vector<Result> answered;
+        for ( const auto &task : tasks ) {
+            if ( task.port != port ) {
+                continue;
+            }
+
+            Result result { port, task.cmd };
+            if ( serial && cache != nullptr
+                    && cache->support(model, task.cmd) == Support::Unsupported ) {
+                result.error = std::make_exception_ptr(ProjectorError(
+                    Refusal::Unsupported, "Command not supported by " + model + "."));
+            } else if ( serial ) {
+                result = transact(*serial, task.cmd, retries, deadline);
+                if ( cache != nullptr ) {
+                    cache->learn(model, result);
+                    if ( task.cmd == "query_model" && ! result.error ) {
+                        model = cache->model(port);
+                    }
+                    std::string kind { error_class(result.error) };
+                    if ( kind == "ok" || kind == "blocked" || kind == "unsupported" ) {
+                        answered.push_back(result);
+                    }
+                }
+            } else {
+                result.error = open_error;
+            }
+            report.write(result);
+            std::cout.flush();
+
+            if ( result.error && status == EXIT_SUCCESS ) {
+                std::string kind { error_class(result.error) };
+                bool unopened { ! serial && kind != "busy" };
+                bool misspelled { kind == "unknown_command"
+                                  || (kind == "illegal" && is_volume_set(task.cmd)
+                                      && ! volume_level(task.cmd)) };
+                status = (misspelled || unopened) ? EINVAL
+                         : kind == "expired" ? ETIME : EAGAIN;
+            }
+        }
+
+        if ( serial && cache != nullptr && ! answered.empty() ) {
+            if ( model.empty() ) {
+                model = cache->identify(*serial, retries);
+                for ( const auto &result : answered ) {
+                    cache->learn(model, result);
+                }
+            }
+            if ( ! model.empty() && ! cache->probed(model) ) {
+                if ( verbose ) {
+                    progress << "probing " << model << " on " << port << std::endl;
+                }
+                cache->probe(*serial, model, retries);
+            }
+        }
+
+        if ( serial && verbose ) {
+            using std::chrono::milliseconds, std::chrono::duration_cast;
+            const auto &pacer { serial->pacer() };
+            progress << port << " paced at "
+                     << duration_cast<milliseconds>(pacer.gap()).count() << " ms gap, "
+                     << duration_cast<milliseconds>(pacer.rtt()).count() << " ms round trip, "
+                     << pacer.failures() << " of the last " << PACE_WINDOW << " failed, "
+                     << serial->skipped() << " stray frames skipped, "
+                     << serial->discards() << " discards" << std::endl;
+        }
+
+        // Each port is visited once, so none stays locked against other
+        // processes while the rest of the ports run.
+        serial.release();
+        pool.clear(port);
+    }
 
-    auto ret { device.write(msg.c_str(), msg.length()) };
-    if ( ret < 0 ) {
-        throw std::runtime_error("Fatal error while writing to projector.");
+    if ( cache != nullptr ) {
+        try {
+            cache->save();
+        } catch ( const std::system_error &e ) {
+            if ( verbose ) {
+                progress << e.what() << std::endl;
+            }
+        }
     }
-    std::cout << "sent '" << cmd << "'" << std::endl;
 
-    return ret;
+    return status;
 }
 
 
@@ -92,14 +494,124 @@ argparse::ArgumentParser read_args(const std::vector<std::string> arguments) {
         .default_value(std::string { "query_model" })
         .help("projector command");
 
+    program.add_argument("level")
+        .default_value(std::string {})
+        .help("volume for audio_vol_set, from 0 to " + std::to_string(VOLUME_MAX));
+
     program.add_argument("-l", "--list-commands")
         .help("list commands and exit")
         .default_value(false)
         .implicit_value(true);
 
     program.add_argument("-p", "--port")
-        .help("serial port")
-        .default_value(DEFAULT_DEVICE);
+        .help("serial port, repeat for several ports")
+        .default_value(std::vector<std::string> { DEFAULT_DEVICE })
+        .append();
+
+    program.add_argument("--board")
+        .help("publish projector status to a shared memory file until interrupted")
+        .default_value(std::string {});
+
+    program.add_argument("--read-board")
+        .help("show the projector status published in a shared memory file")
+        .default_value(std::string {});
+
+    program.add_argument("--history")
+        .help("with --board or --serve, record state changes in a directory of segment files")
+        .default_value(std::string {});
+
+    program.add_argument("--interval")
+        .help("milliseconds between status polls, with --board or --serve")
+        .default_value(POLL_INTERVAL)
+        .scan<'i', int>();
+
+    program.add_argument("-t", "--target")
+        .help("run on the inventory ports named by an expression, e.g. \"building-3&floor-2\"")
+        .default_value(std::string {});
+
+    program.add_argument("--inventory")
+        .help("file of ports and their tags and groups")
+        .default_value(default_inventory_path());
+
+    program.add_argument("--stagger")
+        .help("milliseconds between starting commands on different ports")
+        .default_value(0)
+        .scan<'i', int>();
+
+    program.add_argument("--serve")
+        .help("keep running, e.g. to run scheduled commands, until interrupted")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--schedule")
+        .help("with --serve, run \"m h dom mon dow [port] command\" lines from a file")
+        .default_value(std::string {});
+
+    program.add_argument("--http")
+        .help("with --serve, answer HTTP clients on [host:]port")
+        .default_value(std::string {});
+
+    program.add_argument("--control")
+        .help("with --serve, answer binary control clients on [host:]port or a socket path")
+        .default_value(std::string {});
+
+    program.add_argument("--gateway")
+        .help("with --serve, relay \"*msg#\" frames from [host:]port or a socket path to the -p port in the same place")
+        .default_value(std::vector<std::string> {})
+        .append();
+
+    program.add_argument("--events")
+        .help("with --serve, push state changes to clients of [host:]port or a socket path")
+        .default_value(std::string {});
+
+    program.add_argument("--concurrency")
+        .help("most ports to run commands on at once, with --target or --serve")
+        .default_value(FANOUT_CONCURRENCY)
+        .scan<'i', int>();
+
+    program.add_argument("-b", "--batch")
+        .help("read \"[port] command\" lines from a file, or - for stdin")
+        .default_value(std::string {});
+
+    program.add_argument("-f", "--format")
+        .help("result format: text, jsonl or tsv")
+        .default_value(std::string { "text" });
+
+    program.add_argument("--retries")
+        .help("times to retry a busy, garbled or unanswered command")
+        .default_value(0)
+        .scan<'i', int>();
+
+    program.add_argument("--lock-wait")
+        .help("milliseconds to wait for a port another bewield is using")
+        .default_value(LOCK_WAIT)
+        .scan<'i', int>();
+
+    program.add_argument("--deadline")
+        .help("drop commands not answered by HH:MM[:SS] today, or within this many milliseconds")
+        .default_value(std::string {});
+
+    program.add_argument("--cache")
+        .help("file of commands each projector model supports")
+        .default_value(default_capability_path());
+
+    program.add_argument("--no-cache")
+        .help("neither read nor update the capability cache")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--probe")
+        .help("identify and probe each projector again")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--trace")
+        .help("record serial traffic to a file at exit, or on SIGUSR1")
+        .default_value(std::string {});
+
+    program.add_argument("--capture")
+        .help("record all serial traffic to a file, e.g. for fake_proj --replay")
+        .default_value(std::string {});
 
     program.add_argument("--verbose")
         .help("show detailed status")
@@ -129,50 +641,128 @@ int main(int argc, const char* argv[]) {
         return EINVAL;
     }
 
-    if ( program.get<bool>("--list-commands") ) {
-        std::cout << "bewield commands:" << std::endl;
-        for ( const auto &[cmd, _unused] : commands ) {
-            std::cout << "  " << cmd << std::endl;
+    PortLock::patience(std::max(program.get<int>("--lock-wait"), 0));
+
+    auto arg_ports { program.get<std::vector<std::string>>("--port") };
+
+    auto arg_target { program.get("--target") };
+    Inventory inventory;
+    // A daemon reads the inventory, if there is one, for its event clients.
+    if ( ! arg_target.empty() || program.get<bool>("--serve") ) {
+        try {
+            auto arg_inventory { program.get("--inventory") };
+            std::ifstream in { arg_inventory };
+            if ( in ) {
+                inventory = Inventory { in };
+            } else if ( ! arg_target.empty() ) {
+                throw std::runtime_error("Cannot read inventory file '" + arg_inventory + "'.");
+            }
+            if ( ! arg_target.empty() ) {
+                arg_ports = inventory.select(arg_target);
+            }
+        } catch ( const std::runtime_error &e ) {
+            std::cout << e.what() << std::endl;
+            return EINVAL;
+        }
+        if ( arg_ports.empty() ) {
+            std::cout << "No ports match '" << arg_target << "'." << std::endl;
+            return EINVAL;
         }
-        return EXIT_SUCCESS;
     }
 
-    auto arg_cmd { program.get("command") };
-    auto arg_port { program.get("--port") };
-    auto arg_verbose { program.get<bool>("--verbose") };
+    std::unique_ptr<Capabilities> cache;
+    if ( auto arg_cache { program.get("--cache") };
+            ! program.get<bool>("--no-cache") && ! arg_cache.empty() ) {
+        cache = std::make_unique<Capabilities>(arg_cache);
+    }
 
-    if ( arg_verbose ) {
-        std::cout << "opening " << arg_port << std::endl;
+    if ( program.get<bool>("--list-commands") ) {
+        list_commands(cache.get(), arg_ports);
+        return EXIT_SUCCESS;
     }
 
-    std::unique_ptr<Lineal> serial;
-    try {
-        serial = std::make_unique<Lineal>(arg_port);
-    } catch ( const std::system_error &e ) {
-        std::cout << e.what() << std::endl;
+    auto arg_trace { program.get("--trace") };
+    auto arg_capture { program.get("--capture") };
+    if ( ! arg_trace.empty() && ! arg_capture.empty() ) {
+        std::cout << "Use only one of --trace and --capture." << std::endl;
         return EINVAL;
     }
+    std::unique_ptr<Trace> trace;
+    if ( ! arg_trace.empty() || ! arg_capture.empty() ) {
+        try {
+            if ( arg_capture.empty() ) {
+                trace = std::make_unique<Trace>(arg_trace);
+            } else {
+                trace = std::make_unique<Trace>(arg_capture, true);
+            }
+        } catch ( const std::system_error &e ) {
+            std::cout << e.what() << std::endl;
+            return EINVAL;
+        }
+        std::signal(SIGUSR1, Trace::handle);
+        std::signal(SIGINT, Trace::handle);
+        std::signal(SIGTERM, Trace::handle);
+    }
 
-    if ( arg_verbose ) {
-        std::cout << arg_port << " ready" << std::endl;
+    if ( auto arg_board { program.get("--read-board") }; ! arg_board.empty() ) {
+        return show_board(arg_board);
+    }
+    if ( auto arg_board { program.get("--board") }; ! arg_board.empty() ) {
+        return publish_board(arg_board, arg_ports, program.get("--history"),
+                             program.get<int>("--interval"));
     }
 
-    // Flush erroneous, pending IO before continuing.
-    tcflush(serial->fd(), TCIOFLUSH);
+    auto arg_verbose { program.get<bool>("--verbose") };
 
-    std::string reply;
+    Format format;
+    std::vector<Task> tasks;
+    Deadline deadline;
     try {
-        send(*serial, arg_cmd);
-        reply = recv(*serial);
-    } catch ( const std::out_of_range &e ) {
-        std::cout << "Unrecognized command." << std::endl;
-        return EINVAL;
+        format = parse_format(program.get("--format"));
+        deadline = parse_deadline(program.get("--deadline"));
+        auto arg_batch { program.get("--batch") };
+        if ( arg_batch.empty() ) {
+            auto command { program.get("command") };
+            // "audio_vol_set 12" is "audio_vol_set=12" as batch files spell it.
+            if ( auto level { program.get("level") }; ! level.empty() ) {
+                if ( command != VOLUME_SET ) {
+                    throw std::runtime_error("Only one command at a time supported.");
+                }
+                command += '=' + level;
+            }
+            for ( const auto &port : arg_ports ) {
+                tasks.push_back(Task { port, command });
+            }
+        } else if ( arg_batch == "-" ) {
+            tasks = read_batch(std::cin, arg_ports);
+        } else {
+            std::ifstream batch { arg_batch };
+            if ( ! batch ) {
+                throw std::runtime_error("Cannot read batch file '" + arg_batch + "'.");
+            }
+            tasks = read_batch(batch, arg_ports);
+        }
     } catch ( const std::runtime_error &e ) {
         std::cout << e.what() << std::endl;
-        return EAGAIN;
+        return EINVAL;
     }
 
-    std::cout << "reply: " << cook(reply) << std::endl;
+    if ( program.get<bool>("--serve") ) {
+        Report report { std::cout, format, true };
+        return serve(program.get("--schedule"), arg_ports, inventory, program.get("--http"),
+                     program.get("--control"),
+                     program.get<std::vector<std::string>>("--gateway"),
+                     program.get("--events"), program.get("--history"), report,
+                     program.get<int>("--concurrency"),
+                     program.get<int>("--retries"), program.get<int>("--interval"));
+    }
 
-    return EXIT_SUCCESS;
+    Report report { std::cout, format, arg_ports.size() > 1 };
+    if ( ! arg_target.empty() ) {
+        return fan_out(tasks, report, inventory, arg_target, program.get<int>("--concurrency"),
+                       program.get<int>("--stagger"), program.get<int>("--retries"),
+                       deadline, cache.get());
+    }
+    return run_tasks(tasks, report, program.get<int>("--retries"), deadline, cache.get(),
+                     program.get<bool>("--probe"), arg_verbose);
 }
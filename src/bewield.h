@@ -33,7 +33,7 @@
  * The order of entries is the order commands are displayed with
  * `--list-commands`, so keep to alphabetic order by pair.first.
  */
-std::map<const std::string, const std::string> commands {
+inline std::map<const std::string, const std::string> commands {
     std::make_pair("asource_hdmi1", "audiosour=hdmi"),
     std::make_pair("asource_hdmi2", "audiosour=hdmi2"),
 
@@ -68,15 +68,18 @@ std::map<const std::string, const std::string> commands {
 constexpr char CR { 0x0d };
 
 /* The two following characters delimit the bounds of a serial message. */
-const std::string PREFIX { '*' };
-const std::string SUFFIX { '#' };
+inline const std::string PREFIX { '*' };
+inline const std::string SUFFIX { '#' };
+
+/* Top of the volume scale, which runs from 0 on BenQ projectors. */
+constexpr int VOLUME_MAX { 20 };
 
 // default serial port
-const std::string DEFAULT_DEVICE { "/dev/ttyUSB0" };
+inline const std::string DEFAULT_DEVICE { "/dev/ttyUSB0" };
 
 
 /* Returns a new string with carriage returns placed with new-lines.  */
-const std::string cook(const std::string msg) {
+inline const std::string cook(const std::string msg) {
     auto slate { msg.substr() };
     std::replace(slate.begin(), slate.end(), '\r', '\n');
     return slate;
@@ -0,0 +1,209 @@
+/*
+    board.cpp - shared memory status board of projector state
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include "board.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+
+
+/* Returns the size in bytes of a board file holding `ports` records. */
+static std::size_t board_size(std::size_t ports) {
+    return sizeof(BoardHeader) + ports * (sizeof(BoardRecord) + sizeof(BoardName));
+}
+
+
+/* Creates, or replaces, the board at `path` with one record for each of
+ * `ports` and maps it for writing.
+ *
+ * A new board is built beside `path` and renamed over it, so readers still
+ * holding an old board keep a valid, if stale, mapping.
+ *
+ * Throws `std::runtime_error` if a port path does not fit in a BoardName
+ * and `std::system_error` if the board file cannot be set up.
+ */
+Board::Board(const std::string &path, const std::vector<std::string> &ports) {
+    for ( const auto &port : ports ) {
+        if ( port.size() >= sizeof(BoardName::path) ) {
+            throw std::runtime_error("Port path too long for the status board: " + port);
+        }
+    }
+
+    auto staging { path + ".new" };
+    auto fd { open(staging.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644) };
+    if ( fd < 0 ) {
+        throw std::system_error(std::error_code(errno, std::system_category()),
+                                std::string("status board open failed"));
+    }
+
+    auto size { board_size(ports.size()) };
+    if ( ftruncate(fd, size) != 0 ) {
+        auto err { errno };
+        close(fd);
+        throw std::system_error(std::error_code(err, std::system_category()),
+                                std::string("status board resize failed"));
+    }
+    map(fd, size, true);
+
+    for ( std::size_t i { 0 }; i < ports.size(); ++i ) {
+        std::memcpy(m_names[i].path, ports[i].c_str(), ports[i].size() + 1);
+        m_records[i].state.volume = -1;
+    }
+
+    m_header->magic = BOARD_MAGIC;
+    m_header->version = BOARD_VERSION;
+    m_header->record_size = sizeof(BoardRecord);
+    m_header->ports = ports.size();
+
+    if ( rename(staging.c_str(), path.c_str()) != 0 ) {
+        auto err { errno };
+        unlink(staging.c_str());
+        unmap();
+        throw std::system_error(std::error_code(err, std::system_category()),
+                                std::string("status board publish failed"));
+    }
+}
+
+/* Maps the existing board at `path` for reading.
+ *
+ * Throws `std::system_error` if the file cannot be mapped and
+ * `std::runtime_error` if it is not a compatible status board.
+ */
+Board::Board(const std::string &path) {
+    auto fd { open(path.c_str(), O_RDONLY | O_CLOEXEC) };
+    if ( fd < 0 ) {
+        throw std::system_error(std::error_code(errno, std::system_category()),
+                                std::string("status board open failed"));
+    }
+
+    struct stat info;
+    if ( fstat(fd, &info) != 0 ) {
+        auto err { errno };
+        close(fd);
+        throw std::system_error(std::error_code(err, std::system_category()),
+                                std::string("status board open failed"));
+    }
+    if ( static_cast<std::size_t>(info.st_size) < sizeof(BoardHeader) ) {
+        close(fd);
+        throw std::runtime_error("Not a status board.");
+    }
+    map(fd, info.st_size, false);
+
+    if ( m_header->magic != BOARD_MAGIC
+         || m_header->version != BOARD_VERSION
+         || m_header->record_size != sizeof(BoardRecord)
+         || board_size(m_header->ports) > m_size ) {
+        unmap();
+        throw std::runtime_error("Not a compatible status board.");
+    }
+}
+
+Board::~Board() {
+    unmap();
+}
+
+/* Maps `size` bytes of `fd` and locates the board sections within the map.
+ *
+ * `fd` is always closed, since the mapping outlives it.
+ */
+void Board::map(int fd, std::size_t size, bool writable) {
+    auto prot { writable ? PROT_READ | PROT_WRITE : PROT_READ };
+    auto map { mmap(nullptr, size, prot, MAP_SHARED, fd, 0) };
+    auto err { errno };
+    close(fd);
+    if ( map == MAP_FAILED ) {
+        throw std::system_error(std::error_code(err, std::system_category()),
+                                std::string("status board map failed"));
+    }
+
+    m_map = map;
+    m_size = size;
+    m_header = static_cast<BoardHeader *>(m_map);
+    m_records = reinterpret_cast<BoardRecord *>(m_header + 1);
+
+    auto ports { writable ? (size - sizeof(BoardHeader))
+                            / (sizeof(BoardRecord) + sizeof(BoardName))
+                          : m_header->ports };
+    m_names = reinterpret_cast<BoardName *>(m_records + ports);
+}
+
+/* Returns the serial port path of the record at `index`. */
+std::string Board::port(std::size_t index) const {
+    const auto &name { m_names[index].path };
+    return std::string(name, strnlen(name, sizeof(name)));
+}
+
+/* Returns the quantity of records on the board. */
+std::size_t Board::ports() const {
+    return m_header->ports;
+}
+
+/* Copies a consistent snapshot of the record at `index` into `state`.
+ *
+ * Returns false if the record kept changing for BOARD_READ_TRIES attempts,
+ * which also covers a writer which died while updating it.
+ */
+bool Board::read(std::size_t index, BoardState &state) const {
+    auto &record { m_records[index] };
+    for ( int tries { 0 }; tries < BOARD_READ_TRIES; ++tries ) {
+        auto before { record.sequence.load(std::memory_order_acquire) };
+        if ( before & 1 ) {
+            continue;
+        }
+        std::memcpy(&state, &record.state, sizeof(state));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if ( record.sequence.load(std::memory_order_relaxed) == before ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Releases the mapping, if any, for a board which is going away or which a
+ * constructor is giving up on, since no destructor runs for those.
+ */
+void Board::unmap() {
+    if ( m_map != nullptr ) {
+        munmap(m_map, m_size);
+        m_map = nullptr;
+    }
+}
+
+/* Replaces the record at `index` with `state`.
+ *
+ * There must be only one writer per board.
+ */
+void Board::write(std::size_t index, const BoardState &state) {
+    auto &record { m_records[index] };
+    auto sequence { record.sequence.load(std::memory_order_relaxed) };
+    record.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(&record.state, &state, sizeof(state));
+    record.sequence.store(sequence + 2, std::memory_order_release);
+}
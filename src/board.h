@@ -0,0 +1,129 @@
+/*
+    board.h - shared memory status board of projector state
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#ifndef BOARD_H
+#define BOARD_H true
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+/* A status board file is laid out as:
+ *
+ *   BoardHeader                    one cache line
+ *   BoardRecord[ports]             one cache line per port
+ *   BoardName[ports]               port paths, written once at creation
+ *
+ * Every structure is fixed size and naturally aligned, so readers in any
+ * language can mmap the file and index it directly.  Readers never take a
+ * lock or make a system call; each record carries its own sequence counter
+ * (a seqlock) which is odd while the record is being rewritten.
+ */
+
+/* "BWBD" in a little endian file. */
+constexpr uint32_t BOARD_MAGIC { 0x44425742 };
+constexpr uint32_t BOARD_VERSION { 2 };
+
+/* Bytes in one cache line on the machines bewield runs on. */
+constexpr std::size_t CACHE_LINE { 64 };
+
+/* Times a reader retries a record which keeps changing underneath it. */
+constexpr int BOARD_READ_TRIES { 1000 };
+
+/* BoardState.flags: the last poll of this port got a reply. */
+constexpr uint32_t BOARD_ONLINE { 1u << 0 };
+
+
+struct alignas(CACHE_LINE) BoardHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t ports;
+    char reserved[ CACHE_LINE - 4 * sizeof(uint32_t) ];
+};
+
+/* Latest known state of one projector.
+ *
+ * `power`, `blank` and `source` hold a `Value` from decode.h and are
+ * Value::Unknown (0) while unknown.  `volume` is -1 while unknown.
+ */
+struct BoardState {
+    uint32_t flags;
+    int32_t volume;
+    // wall clock time of the latest update, in nanoseconds since the epoch
+    uint64_t updated;
+    uint8_t power;
+    uint8_t blank;
+    uint8_t source;
+    char reserved[ 37 ];
+};
+
+struct alignas(CACHE_LINE) BoardRecord {
+    std::atomic<uint32_t> sequence;
+    uint32_t reserved;
+    BoardState state;
+};
+
+struct BoardName {
+    char path[ 128 ];
+};
+
+static_assert(sizeof(BoardHeader) == CACHE_LINE);
+static_assert(sizeof(BoardRecord) == CACHE_LINE);
+static_assert(std::atomic<uint32_t>::is_always_lock_free);
+
+
+/* A memory mapped status board, opened either to publish or to read. */
+class Board {
+
+    private:
+
+        void *m_map { nullptr };
+        std::size_t m_size { 0 };
+
+        BoardHeader *m_header { nullptr };
+        BoardRecord *m_records { nullptr };
+        BoardName *m_names { nullptr };
+
+        void map(int fd, std::size_t size, bool writable);
+        void unmap();
+
+    public:
+
+        Board(const std::string &path, const std::vector<std::string> &ports);
+        explicit Board(const std::string &path);
+        ~Board();
+
+        Board(const Board &) = delete;
+        Board &operator=(const Board &) = delete;
+
+        std::string port(std::size_t index) const;
+        std::size_t ports() const;
+        bool read(std::size_t index, BoardState &state) const;
+        void write(std::size_t index, const BoardState &state);
+
+};
+
+
+#endif
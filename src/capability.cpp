@@ -0,0 +1,346 @@
+/*
+    capability.cpp - commands each projector model supports, cached on disk
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include "capability.h"
+#include "decode.h"
+
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <system_error>
+
+
+/* Returns the position of `cmd` in `commands`.
+ *
+ * Throws `std::out_of_range` if `cmd` is not in `commands` or does not fit
+ * in a capability bitmap.
+ */
+static std::size_t command_index(const std::string &cmd) {
+    auto it { commands.find(cmd) };
+    if ( it == commands.end() ) {
+        throw std::out_of_range("unknown command");
+    }
+    auto index { static_cast<std::size_t>(std::distance(commands.begin(), it)) };
+    if ( index >= CAPABILITY_BITS ) {
+        throw std::out_of_range("command beyond capability bitmap");
+    }
+    return index;
+}
+
+/* Returns a hash of the command names, in table order, so a cache written
+ * for another `commands` table is recognized.
+ */
+static uint64_t table_signature() {
+    uint64_t hash { 0xcbf29ce484222325 };
+    for ( const auto &[cmd, _unused] : commands ) {
+        for ( auto c : cmd + '\n' ) {
+            hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001b3;
+        }
+    }
+    return hash;
+}
+
+/* Returns the name the model on `port` is kept under: the link in
+ * SERIAL_BY_ID to the same device if there is one, or else `port` itself.
+ * Numbered names like /dev/ttyUSB0 go to whichever adapter appears first,
+ * so they can pass to another projector between runs.
+ */
+static std::string device_key(const std::string &port) {
+    char resolved[ PATH_MAX ];
+    auto *listing { opendir(SERIAL_BY_ID) };
+    if ( ! listing ) {
+        return port;
+    }
+    std::string key { port };
+    if ( realpath(port.c_str(), resolved) ) {
+        while ( auto *entry { readdir(listing) } ) {
+            std::string link { std::string(SERIAL_BY_ID) + '/' + entry->d_name };
+            char target[ PATH_MAX ];
+            if ( entry->d_name[0] != '.' && realpath(link.c_str(), target)
+                    && std::strcmp(target, resolved) == 0 ) {
+                key = link;
+                break;
+            }
+        }
+    }
+    closedir(listing);
+    return key;
+}
+
+/* Returns true if `cmd` only asks the projector something. */
+static bool is_query(const std::string &message) {
+    return decode(message).value == Value::Query;
+}
+
+
+/* Returns where the capability cache lives by default:
+ * $XDG_CACHE_HOME/bewield/capabilities, or ~/.cache/bewield/capabilities.
+ * Returns "" if neither variable is set.
+ */
+std::string default_capability_path() {
+    if ( auto cache { std::getenv("XDG_CACHE_HOME") }; cache != nullptr && *cache ) {
+        return std::string(cache) + "/bewield/capabilities";
+    }
+    if ( auto home { std::getenv("HOME") }; home != nullptr && *home ) {
+        return std::string(home) + "/.cache/bewield/capabilities";
+    }
+    return "";
+}
+
+
+/* Capabilities cached at `path`, loaded now if the file exists. */
+Capabilities::Capabilities(const std::string &path)
+    : m_path { path }
+{
+    load();
+}
+
+/* Forgets all that is known of `model`, so it will be probed again. */
+void Capabilities::forget(const std::string &model) {
+    if ( m_models.erase(model) > 0 ) {
+        m_changed = true;
+    }
+}
+
+/* Returns the model name of the projector on `device`, asking it, and
+ * remembers it for that port.  Returns "" if the projector does not say.
+ */
+std::string Capabilities::identify(Lineal &device, int retries) {
+    auto result { transact(device, "query_model", retries) };
+    if ( result.error ) {
+        return "";
+    }
+    std::string model { result.decoded().text };
+    learn(model, result);
+    return model;
+}
+
+/* Learns from `result` whether `model` supports its command.  An answer to
+ * query_model names the model itself, and is remembered for its port.  A
+ * command blocked before its support is known is marked tried, so probe()
+ * does not send it again on every run.  Results which tell nothing else,
+ * such as a busy projector or no reply, are ignored.
+ */
+void Capabilities::learn(const std::string &model, const Result &result) {
+    if ( result.attempts == 0 ) {
+        return;
+    }
+    std::string owner { model };
+    if ( result.cmd == "query_model" && ! result.error ) {
+        std::string answered { result.decoded().text };
+        if ( ! answered.empty() ) {
+            owner = answered;
+            auto &seen { m_ports[device_key(result.port)] };
+            if ( seen != answered ) {
+                seen = answered;
+                m_changed = true;
+            }
+        }
+    }
+    if ( owner.empty() ) {
+        return;
+    }
+
+    std::size_t index;
+    try {
+        index = command_index(result.cmd);
+    } catch ( const std::out_of_range &e ) {
+        return;
+    }
+
+    std::string kind { error_class(result.error) };
+    if ( kind == "blocked" ) {
+        auto &entry { m_models[owner] };
+        if ( ! entry.known[index] && ! entry.tried[index] ) {
+            entry.tried[index] = true;
+            m_changed = true;
+        }
+        return;
+    }
+    if ( kind != "ok" && kind != "unsupported" ) {
+        return;
+    }
+    auto &entry { m_models[owner] };
+    bool supported { kind == "ok" };
+    if ( ! entry.known[index] || entry.supported[index] != supported ) {
+        entry.known[index] = true;
+        entry.supported[index] = supported;
+        entry.tried[index] = false;
+        m_changed = true;
+    }
+}
+
+/* Reads the cache file, if any.  A missing, damaged or outdated file leaves
+ * the cache empty, to be relearned.
+ */
+void Capabilities::load() {
+    std::ifstream in { m_path };
+    std::string line;
+    if ( ! in || ! std::getline(in, line) ) {
+        return;
+    }
+    std::ostringstream expected;
+    expected << "bewield-capabilities " << CAPABILITY_VERSION << ' '
+             << std::hex << table_signature();
+    if ( line != expected.str() ) {
+        return;
+    }
+
+    while ( std::getline(in, line) ) {
+        std::istringstream fields { line };
+        std::string kind, name;
+        if ( ! std::getline(fields, kind, '\t') || ! std::getline(fields, name, '\t') ) {
+            continue;
+        }
+        if ( kind == "model" ) {
+            // Files from before tried commands were kept lack the third bitmap.
+            unsigned long long known, supported, tried { 0 };
+            if ( fields >> std::hex >> known >> supported ) {
+                fields >> tried;
+                m_models[name] = Model { known, supported, tried };
+            }
+        } else if ( kind == "port" ) {
+            std::string model;
+            if ( std::getline(fields, model) && ! model.empty() ) {
+                m_ports[name] = model;
+            }
+        }
+    }
+}
+
+/* Returns the model last seen on the device at `port`, or "" if none was. */
+std::string Capabilities::model(const std::string &port) const {
+    auto it { m_ports.find(device_key(port)) };
+    return it == m_ports.end() ? "" : it->second;
+}
+
+const std::string &Capabilities::path() const {
+    return m_path;
+}
+
+/* Sends every query command neither known nor tried for `model` to
+ * `device` and learns from the replies.
+ */
+void Capabilities::probe(Lineal &device, const std::string &model, int retries) {
+    for ( const auto &[cmd, message] : commands ) {
+        if ( ! is_query(message) || settled(model, cmd) ) {
+            continue;
+        }
+        learn(model, transact(device, cmd, retries));
+    }
+}
+
+/* Returns true once every query command is known or tried for `model`. */
+bool Capabilities::probed(const std::string &model) const {
+    for ( const auto &[cmd, message] : commands ) {
+        if ( is_query(message) && ! settled(model, cmd) ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Writes the cache file if anything was learned, creating its directory.
+ * The file is replaced whole, so a concurrent reader sees the old or the
+ * new cache.
+ *
+ * Throws `std::system_error` if the file cannot be written.
+ */
+void Capabilities::save() {
+    if ( ! m_changed || m_path.empty() ) {
+        return;
+    }
+
+    // Create missing directories, e.g. ~/.cache/bewield.
+    for ( auto slash { m_path.find('/', 1) }; slash != std::string::npos;
+          slash = m_path.find('/', slash + 1) ) {
+        if ( mkdir(m_path.substr(0, slash).c_str(), 0755) != 0 && errno != EEXIST ) {
+            throw std::system_error(std::error_code(errno, std::system_category()),
+                                    std::string("capability cache directory failed"));
+        }
+    }
+
+    auto staging { m_path + ".new" };
+    {
+        std::ofstream out { staging, std::ios::trunc };
+        out << "bewield-capabilities " << CAPABILITY_VERSION << ' '
+            << std::hex << table_signature() << '\n';
+        for ( const auto &[name, entry] : m_models ) {
+            out << "model\t" << name << '\t' << entry.known.to_ullong()
+                << ' ' << entry.supported.to_ullong() << ' ' << entry.tried.to_ullong() << '\n';
+        }
+        for ( const auto &[port, model] : m_ports ) {
+            out << "port\t" << port << '\t' << model << '\n';
+        }
+        if ( ! out.flush() ) {
+            throw std::system_error(std::make_error_code(std::errc::io_error),
+                                    "capability cache write failed");
+        }
+    }
+    if ( std::rename(staging.c_str(), m_path.c_str()) != 0 ) {
+        throw std::system_error(std::error_code(errno, std::system_category()),
+                                std::string("capability cache write failed"));
+    }
+    m_changed = false;
+}
+
+/* Returns true if `cmd` is known for `model`, or was tried and blocked. */
+bool Capabilities::settled(const std::string &model, const std::string &cmd) const {
+    if ( support(model, cmd) != Support::Unknown ) {
+        return true;
+    }
+    auto it { m_models.find(model) };
+    if ( it == m_models.end() ) {
+        return false;
+    }
+    try {
+        return it->second.tried[command_index(cmd)];
+    } catch ( const std::out_of_range &e ) {
+        return false;
+    }
+}
+
+/* Returns what is known of `model` supporting `cmd`. */
+Support Capabilities::support(const std::string &model, const std::string &cmd) const {
+    auto it { m_models.find(model) };
+    if ( it == m_models.end() ) {
+        return Support::Unknown;
+    }
+    std::size_t index;
+    try {
+        index = command_index(cmd);
+    } catch ( const std::out_of_range &e ) {
+        return Support::Unknown;
+    }
+    if ( ! it->second.known[index] ) {
+        return Support::Unknown;
+    }
+    return it->second.supported[index] ? Support::Supported : Support::Unsupported;
+}
@@ -0,0 +1,113 @@
+/*
+    capability.h - commands each projector model supports, cached on disk
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#ifndef CAPABILITY_H
+#define CAPABILITY_H true
+
+#include "bewield.h"
+#include "exchange.h"
+#include "lineal.h"
+
+#include <bitset>
+#include <cstddef>
+#include <map>
+#include <string>
+
+
+/* Bits in a capability bitmap, one per entry of `commands`. */
+constexpr std::size_t CAPABILITY_BITS { 64 };
+
+/* Directory of links naming each USB serial adapter by its own serial
+ * number, which stay with the adapter whatever /dev/ttyUSB number it gets.
+ */
+constexpr const char *SERIAL_BY_ID { "/dev/serial/by-id" };
+
+/* Format version of the capability cache file. */
+constexpr int CAPABILITY_VERSION { 1 };
+
+
+/* What is known of a model's support for one command. */
+enum class Support {
+    Unknown,
+    Supported,
+    Unsupported,
+};
+
+
+/* Commands each projector model supports, and the model on each port, kept
+ * in a file between runs.
+ *
+ * Support is learned from replies: "Unsupported item" marks a command
+ * unsupported and any other answer marks it supported.  "Block item", as a
+ * projector in standby answers many queries, tells nothing yet, so the
+ * command is marked tried and learned later, when it is next used or at
+ * the next --probe.  probe() learns the query commands once per model,
+ * since queries change nothing on the projector.  Other commands are only
+ * learned as they are used.
+ *
+ * Bitmaps index `commands` in table order.  A file written for a different
+ * table is ignored.
+ */
+class Capabilities {
+
+    private:
+
+        struct Model {
+            std::bitset<CAPABILITY_BITS> known;
+            std::bitset<CAPABILITY_BITS> supported;
+            // refused with "Block item" before being known
+            std::bitset<CAPABILITY_BITS> tried;
+        };
+
+        std::string m_path;
+
+        /* Models keyed by name, as answered to "modelname=?". */
+        std::map<std::string, Model> m_models;
+
+        /* Model names keyed by device, by its SERIAL_BY_ID link if any. */
+        std::map<std::string, std::string> m_ports;
+
+        bool m_changed { false };
+
+        void load();
+        bool settled(const std::string &model, const std::string &cmd) const;
+
+    public:
+
+        explicit Capabilities(const std::string &path);
+
+        void forget(const std::string &model);
+        std::string identify(Lineal &device, int retries = 0);
+        void learn(const std::string &model, const Result &result);
+        std::string model(const std::string &port) const;
+        const std::string &path() const;
+        void probe(Lineal &device, const std::string &model, int retries = 0);
+        bool probed(const std::string &model) const;
+        void save();
+        Support support(const std::string &model, const std::string &cmd) const;
+
+};
+
+
+std::string default_capability_path();
+
+
+#endif
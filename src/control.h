@@ -0,0 +1,190 @@
+/*
+    control.h - compact binary protocol of the daemon's control socket
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#ifndef CONTROL_H
+#define CONTROL_H true
+
+#include "decode.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <utility>
+
+
+/* A control connection carries messages each way, every one a fixed size
+ * structure in little endian byte order which starts with its own length:
+ *
+ *   client:  ControlRequest                 one per command
+ *   daemon:  ControlReply [text]            one per request, in any order
+ *
+ * Requests carry numbers rather than names: the command's place in
+ * CONTROL_COMMANDS and the port's place in the daemon's --port list, so
+ * neither side parses text.  Each reply repeats its request's `id` and
+ * holds the decoded reply (see decode.h) ready to use.  Only text values,
+ * such as a model name, follow the reply as bytes.
+ *
+ * A message longer than its structure has fields from a later version
+ * after it, which are skipped.  A message shorter than its structure ends
+ * the connection.
+ */
+
+/* Commands by their number on the wire.  Numbers are kept for good, so only
+ * ever append, and never reuse the number of a command taken away.
+ */
+constexpr std::array<std::string_view, 23> CONTROL_COMMANDS { {
+    "asource_hdmi1",
+    "asource_hdmi2",
+    "audio_mute_off",
+    "audio_mute_on",
+    "audio_vol_down",
+    "audio_vol_up",
+    "blank_off",
+    "blank_on",
+    "power_off",
+    "power_on",
+    "query_audio_mute",
+    "query_audio_source",
+    "query_audio_volume",
+    "query_blank",
+    "query_model",
+    "query_power",
+    "query_source",
+    "source_dp",
+    "source_hdmi1",
+    "source_hdmi2",
+    "source_rgb1",
+    "source_rgb2",
+    "audio_vol_set",        // to ControlRequest.argument
+} };
+
+/* ControlRequest.command asking for the daemon's ports, which are answered
+ * with their number in ControlReply.number and their paths in the text,
+ * each ended by '\n'.
+ */
+constexpr uint16_t CONTROL_LIST_PORTS { 0xffff };
+
+/* ControlRequest.flags: answer a query from the latest value the daemon
+ * knows, if it knows one, without asking the projector.
+ */
+constexpr uint16_t CONTROL_CACHED { 1u << 0 };
+
+/* Every flag this version knows.  A request with others is refused. */
+constexpr uint16_t CONTROL_FLAGS { CONTROL_CACHED };
+
+
+/* How a request ended.  Up to Error these are the error classes of
+ * error_class() in exchange.h, spelled the same way.
+ */
+enum class ControlStatus : uint8_t {
+    Ok,
+    Blocked,
+    Unsupported,
+    Illegal,
+    Timeout,
+    Busy,
+    Overload,
+    Expired,
+    Io,
+    UnknownCommand,
+    Error,
+    UnknownPort,        // no port with this number
+    BadRequest,         // unknown flags
+};
+
+constexpr std::array<std::pair<std::string_view, ControlStatus>, 13> CONTROL_STATUS_WORDS { {
+    { "ok", ControlStatus::Ok },
+    { "blocked", ControlStatus::Blocked },
+    { "unsupported", ControlStatus::Unsupported },
+    { "illegal", ControlStatus::Illegal },
+    { "timeout", ControlStatus::Timeout },
+    { "busy", ControlStatus::Busy },
+    { "overload", ControlStatus::Overload },
+    { "expired", ControlStatus::Expired },
+    { "io", ControlStatus::Io },
+    { "unknown_command", ControlStatus::UnknownCommand },
+    { "error", ControlStatus::Error },
+    { "unknown_port", ControlStatus::UnknownPort },
+    { "bad_request", ControlStatus::BadRequest },
+} };
+
+
+struct ControlRequest {
+    // sizeof(ControlRequest), or more from a later version
+    uint16_t length;
+    // place in CONTROL_COMMANDS, or CONTROL_LIST_PORTS
+    uint16_t command;
+    // place in the daemon's --port list
+    uint16_t port;
+    // CONTROL_* flags
+    uint16_t flags;
+    // chosen by the client, and repeated in the reply
+    uint32_t id;
+    // the level for audio_vol_set, otherwise 0
+    int32_t argument;
+    // milliseconds since the epoch after which the result is not wanted,
+    // or 0 for none (see Deadline)
+    uint64_t deadline;
+};
+
+struct ControlReply {
+    // sizeof(ControlReply) plus the bytes of text which follow
+    uint16_t length;
+    // a ControlStatus
+    uint8_t status;
+    // the Key and Value of the projector's reply
+    uint8_t key;
+    uint32_t id;
+    uint8_t value;
+    uint8_t reserved;
+    // times the command was sent, 0 for an answer from memory
+    uint16_t attempts;
+    // the value of Value::Number
+    int32_t number;
+    // from the first send to the last reply or failure
+    uint32_t latency_us;
+};
+
+static_assert(sizeof(ControlRequest) == 24);
+static_assert(sizeof(ControlReply) == 20);
+// Both sides copy these structures to and from the wire as they lie in memory.
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__,
+              "the control protocol is little endian");
+
+
+/* Returns the number of command `name` on the wire, or CONTROL_LIST_PORTS if
+ * there is none, e.g. control_command("power_on") is 9.
+ */
+constexpr uint16_t control_command(std::string_view name) {
+    for ( std::size_t i { 0 }; i < CONTROL_COMMANDS.size(); ++i ) {
+        if ( CONTROL_COMMANDS[i] == name ) {
+            return static_cast<uint16_t>(i);
+        }
+    }
+    return CONTROL_LIST_PORTS;
+}
+
+static_assert(control_command("power_on") == 9);
+static_assert(control_command("audio_vol_set") == 22);
+
+
+#endif
@@ -0,0 +1,189 @@
+/*
+    ctl_bench.cpp - load generator for the daemon's binary control socket
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include "ctlclient.h"
+
+#include "argparse.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <vector>
+
+
+/* Returns the place of `name` in `ports`, either a whole path or a file name
+ * only one port has, or a number given as is.
+ *
+ * Throws `std::runtime_error` if there is no such port.
+ */
+uint16_t port_number(const std::vector<std::string> &ports, const std::string &name) {
+    if ( ! name.empty() && name.find_first_not_of("0123456789") == std::string::npos
+            && std::stoul(name) < ports.size() ) {
+        return std::stoul(name);
+    }
+    std::vector<std::size_t> found;
+    for ( std::size_t i { 0 }; i < ports.size(); ++i ) {
+        if ( ports[i] == name || ports[i].substr(ports[i].rfind('/') + 1) == name ) {
+            found.push_back(i);
+        }
+    }
+    if ( found.size() != 1 ) {
+        throw std::runtime_error("No single port named '" + name + "'.");
+    }
+    return found.front();
+}
+
+/* Returns an ArgumentParser object created from command line arguments. */
+argparse::ArgumentParser read_args(const std::vector<std::string> arguments) {
+    argparse::ArgumentParser program { "ctl_bench" };
+
+    program.add_argument("control")
+        .help("control socket of a bewield --serve, as given to --control");
+
+    program.add_argument("-p", "--port")
+        .help("port to send to, by path, file name or place in the daemon's list")
+        .default_value(std::string { "0" });
+
+    program.add_argument("-c", "--command")
+        .help("command to send")
+        .default_value(std::string { "query_power" });
+
+    program.add_argument("--argument")
+        .help("level for audio_vol_set")
+        .default_value(0)
+        .scan<'i', int>();
+
+    program.add_argument("-n", "--count")
+        .help("requests to send")
+        .default_value(10000)
+        .scan<'i', int>();
+
+    program.add_argument("-w", "--window")
+        .help("most requests to have unanswered at once")
+        .default_value(256)
+        .scan<'i', int>();
+
+    program.add_argument("--cached")
+        .help("let queries be answered from the daemon's latest known values")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--deadline")
+        .help("milliseconds each request's result is wanted for, 0 for no limit")
+        .default_value(0)
+        .scan<'i', int>();
+
+    program.parse_args(arguments);
+
+    return program;
+}
+
+/* Keeps `count` requests of `command` going to `port` through `client`,
+ * up to `window` at a time, and prints how they ended and how fast.
+ */
+void run(ControlClient &client, uint16_t port, uint16_t command, int32_t argument,
+         uint16_t flags, int deadline_ms, int count, int window) {
+    std::map<uint32_t, std::chrono::steady_clock::time_point> sent;
+    std::map<ControlStatus, int> statuses;
+    std::chrono::microseconds total { 0 }, longest { 0 };
+
+    auto start { std::chrono::steady_clock::now() };
+    int issued { 0 }, answered { 0 };
+    while ( answered < count ) {
+        while ( issued < count && static_cast<int>(sent.size()) < window ) {
+            std::chrono::system_clock::time_point deadline {};
+            if ( deadline_ms > 0 ) {
+                deadline = std::chrono::system_clock::now()
+                         + std::chrono::milliseconds(deadline_ms);
+            }
+            sent[client.send(port, command, argument, flags, deadline)]
+                = std::chrono::steady_clock::now();
+            ++issued;
+        }
+
+        ControlAnswer answer;
+        client.receive(answer);
+        do {
+            auto it { sent.find(answer.id) };
+            if ( it == sent.end() ) {
+                continue;
+            }
+            auto took { std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - it->second) };
+            total += took;
+            longest = std::max(longest, took);
+            sent.erase(it);
+            ++statuses[answer.status];
+            ++answered;
+        } while ( client.receive(answer, 0) );
+    }
+    auto seconds { std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() };
+
+    for ( const auto &[status, number] : statuses ) {
+        std::cout << status_name(status) << '\t' << number << '\n';
+    }
+    char line[ 160 ];
+    std::snprintf(line, sizeof(line), "%d requests in %.3f s: %.0f/s, mean %.3f ms, max %.3f ms",
+                  count, seconds, count / seconds, total.count() / 1e3 / count,
+                  longest.count() / 1e3);
+    std::cout << line << std::endl;
+}
+
+
+int main(int argc, const char* argv[]) {
+    argparse::ArgumentParser program;
+    try {
+        std::vector<std::string> args;
+        std::copy(argv, argv + argc, std::back_inserter(args));
+
+        program = read_args(args);
+    } catch ( const std::runtime_error &e ) {
+        std::cout << e.what() << std::endl;
+        return EINVAL;
+    }
+
+    try {
+        auto command { control_command(program.get("--command")) };
+        if ( command == CONTROL_LIST_PORTS ) {
+            throw std::runtime_error("Unknown command '" + program.get("--command") + "'.");
+        }
+        auto count { program.get<int>("--count") };
+        auto window { program.get<int>("--window") };
+        if ( count < 1 || window < 1 ) {
+            throw std::runtime_error("Give a --count and --window of at least 1.");
+        }
+
+        ControlClient client { program.get("control") };
+        auto port { port_number(client.ports(), program.get("--port")) };
+        run(client, port, command, program.get<int>("--argument"),
+            program.get<bool>("--cached") ? CONTROL_CACHED : 0,
+            program.get<int>("--deadline"), count, window);
+    } catch ( const std::runtime_error &e ) {
+        std::cout << e.what() << std::endl;
+        return EINVAL;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,259 @@
+/*
+    ctlclient.cpp - client library for the daemon's binary control socket
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include "ctlclient.h"
+#include "listener.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <sstream>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <system_error>
+#include <unistd.h>
+
+
+/* Bytes of requests gathered before send() writes them without a flush(). */
+constexpr std::size_t CONTROL_MAX_GATHER { 1 << 16 };
+
+
+/* Returns the error for a failed system call named `what`. */
+static std::system_error failure(const std::string &what) {
+    return std::system_error(std::error_code(errno, std::system_category()), what);
+}
+
+
+/* A client connected to the control socket at `address`, given as for the
+ * daemon's --control option.
+ *
+ * Throws `std::runtime_error` for a malformed address, or
+ * `std::system_error` if it cannot be connected to.
+ */
+ControlClient::ControlClient(const std::string &address)
+    : m_fd { connect_to(address, "control") }
+{
+}
+
+ControlClient::~ControlClient() {
+    close(m_fd);
+}
+
+/* Returns the socket, to poll() for replies alongside other descriptors. */
+int ControlClient::fd() const {
+    return m_fd;
+}
+
+/* Reads whatever replies have arrived, waiting up to `timeout_ms` (forever
+ * if negative) for the first.  Returns false if nothing came in time.
+ *
+ * Throws `std::runtime_error` if the daemon closed the connection, or
+ * `std::system_error` if it fails.
+ */
+bool ControlClient::fill(int timeout_ms) {
+    pollfd pfd { m_fd, POLLIN, 0 };
+    auto ready { poll(&pfd, 1, timeout_ms) };
+    if ( ready < 0 ) {
+        if ( errno == EINTR ) {
+            return false;
+        }
+        throw failure("control poll failed");
+    }
+    if ( ready == 0 ) {
+        return false;
+    }
+
+    if ( m_used > 0 ) {
+        m_in.erase(0, m_used);
+        m_used = 0;
+    }
+    char buffer[ 16384 ];
+    auto got { recv(m_fd, buffer, sizeof(buffer), MSG_DONTWAIT) };
+    if ( got == 0 ) {
+        throw std::runtime_error("Control connection closed.");
+    }
+    if ( got < 0 ) {
+        if ( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ) {
+            return false;
+        }
+        throw failure("control recv failed");
+    }
+    m_in.append(buffer, got);
+    return true;
+}
+
+/* Writes every queued request, reading any replies which come meanwhile.
+ *
+ * Throws `std::system_error` if the connection fails.
+ */
+void ControlClient::flush() {
+    std::size_t sent { 0 };
+    while ( sent < m_out.size() ) {
+        pollfd pfd { m_fd, POLLIN | POLLOUT, 0 };
+        if ( poll(&pfd, 1, -1) < 0 ) {
+            if ( errno == EINTR ) {
+                continue;
+            }
+            throw failure("control poll failed");
+        }
+        if ( pfd.revents & POLLIN ) {
+            fill(0);
+        }
+        if ( pfd.revents & (POLLOUT | POLLERR | POLLHUP) ) {
+            auto ret { ::send(m_fd, m_out.data() + sent, m_out.size() - sent,
+                              MSG_DONTWAIT | MSG_NOSIGNAL) };
+            if ( ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR ) {
+                throw failure("control send failed");
+            }
+            sent += ret > 0 ? ret : 0;
+        }
+    }
+    m_out.clear();
+}
+
+/* Returns the paths of the daemon's ports, in the order requests name them.
+ *
+ * Throws `std::runtime_error` if the connection fails.
+ */
+std::vector<std::string> ControlClient::ports() {
+    ControlRequest request {};
+    request.length = sizeof(request);
+    request.command = CONTROL_LIST_PORTS;
+    request.id = m_next_id++;
+    m_out.append(reinterpret_cast<const char *>(&request), sizeof(request));
+    flush();
+
+    ControlAnswer answer;
+    while ( true ) {
+        while ( ! unpack(answer) ) {
+            fill(-1);
+        }
+        if ( answer.id == request.id ) {
+            break;
+        }
+        m_early.push_back(std::move(answer));
+    }
+
+    std::vector<std::string> paths;
+    std::istringstream lines { answer.text };
+    std::string path;
+    while ( std::getline(lines, path) ) {
+        paths.push_back(path);
+    }
+    return paths;
+}
+
+/* Takes the next reply into `answer`, waiting up to `timeout_ms` for one
+ * (forever if negative), and returns true, or returns false if none came.
+ * Requests still queued are written first.
+ *
+ * Throws `std::runtime_error` if the connection fails.
+ */
+bool ControlClient::receive(ControlAnswer &answer, int timeout_ms) {
+    if ( ! m_early.empty() ) {
+        answer = std::move(m_early.front());
+        m_early.pop_front();
+        return true;
+    }
+    if ( ! m_out.empty() ) {
+        flush();
+    }
+
+    auto until { std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms) };
+    while ( ! unpack(answer) ) {
+        auto wait { timeout_ms };
+        if ( timeout_ms > 0 ) {
+            wait = std::max<int>(0, std::chrono::duration_cast<std::chrono::milliseconds>(
+                    until - std::chrono::steady_clock::now()).count());
+        }
+        if ( ! fill(wait) && timeout_ms >= 0 && std::chrono::steady_clock::now() >= until ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Queues `command` (see control_command) for the port at place `port` in
+ * the daemon's port list, with `argument` for audio_vol_set, CONTROL_*
+ * `flags`, and a `deadline` after which its result is not wanted, if any.
+ * Returns the id its reply will carry.
+ *
+ * Throws `std::system_error` if the connection fails.
+ */
+uint32_t ControlClient::send(uint16_t port, uint16_t command, int32_t argument, uint16_t flags,
+                             std::chrono::system_clock::time_point deadline) {
+    ControlRequest request {};
+    request.length = sizeof(request);
+    request.command = command;
+    request.port = port;
+    request.flags = flags;
+    request.id = m_next_id++;
+    request.argument = argument;
+    if ( deadline.time_since_epoch().count() > 0 ) {
+        request.deadline = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline.time_since_epoch()).count();
+    }
+    m_out.append(reinterpret_cast<const char *>(&request), sizeof(request));
+    if ( m_out.size() >= CONTROL_MAX_GATHER ) {
+        flush();
+    }
+    return request.id;
+}
+
+/* Takes the first whole reply read into `answer` and returns true, or
+ * returns false if there is none yet.
+ *
+ * Throws `std::runtime_error` for a reply too short to be one.
+ */
+bool ControlClient::unpack(ControlAnswer &answer) {
+    if ( m_in.size() - m_used < sizeof(uint16_t) ) {
+        return false;
+    }
+    uint16_t length;
+    std::memcpy(&length, m_in.data() + m_used, sizeof(length));
+    if ( length < sizeof(ControlReply) ) {
+        throw std::runtime_error("Malformed control reply.");
+    }
+    if ( m_in.size() - m_used < length ) {
+        return false;
+    }
+
+    ControlReply reply;
+    std::memcpy(&reply, m_in.data() + m_used, sizeof(reply));
+    answer.id = reply.id;
+    answer.status = static_cast<ControlStatus>(reply.status);
+    answer.key = static_cast<Key>(reply.key);
+    answer.value = static_cast<Value>(reply.value);
+    answer.number = reply.number;
+    answer.attempts = reply.attempts;
+    answer.latency = std::chrono::microseconds(reply.latency_us);
+    answer.text.assign(m_in, m_used + sizeof(reply), length - sizeof(reply));
+    m_used += length;
+    return true;
+}
+
+
+/* Returns the name of `status`, e.g. "ok", as error_class() spells it. */
+const char *status_name(ControlStatus status) {
+    auto name { spelling(CONTROL_STATUS_WORDS, status) };
+    return name.empty() ? "error" : name.data();
+}
@@ -0,0 +1,101 @@
+/*
+    ctlclient.h - client library for the daemon's binary control socket
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#ifndef CTLCLIENT_H
+#define CTLCLIENT_H true
+
+#include "control.h"
+#include "decode.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+
+/* One reply from the daemon, unpacked from a ControlReply. */
+struct ControlAnswer {
+    uint32_t id { 0 };
+    ControlStatus status { ControlStatus::Error };
+    Key key { Key::Unknown };
+    Value value { Value::Unknown };
+    int32_t number { 0 };
+    int attempts { 0 };
+    std::chrono::microseconds latency { 0 };
+    // the value of a Value::Text reply, e.g. a model name
+    std::string text;
+};
+
+
+/* A connection to a daemon's --control socket (see control.h), for programs
+ * which keep many requests going at once.
+ *
+ * send() queues a request and returns the id its reply will carry.  Queued
+ * requests go out together at flush(), or when enough have gathered, and
+ * receive() hands back replies as they come, in whatever order the commands
+ * complete, reading all that have arrived with each system call.  Replies
+ * which arrive while requests are being written are kept, so a client
+ * never blocks the daemon by not reading.
+ *
+ * A ControlClient is not safe to share between threads.
+ */
+class ControlClient {
+
+    private:
+
+        int m_fd { -1 };
+        uint32_t m_next_id { 0 };
+
+        std::string m_out;
+        std::string m_in;
+        std::size_t m_used { 0 };
+
+        /* Replies put aside while waiting for another. */
+        std::deque<ControlAnswer> m_early;
+
+        bool fill(int timeout_ms);
+        bool unpack(ControlAnswer &answer);
+
+    public:
+
+        explicit ControlClient(const std::string &address);
+        ~ControlClient();
+
+        ControlClient(const ControlClient &) = delete;
+        ControlClient &operator=(const ControlClient &) = delete;
+
+        int fd() const;
+        void flush();
+        std::vector<std::string> ports();
+        bool receive(ControlAnswer &answer, int timeout_ms = -1);
+        uint32_t send(uint16_t port, uint16_t command, int32_t argument = 0,
+                      uint16_t flags = 0,
+                      std::chrono::system_clock::time_point deadline = {});
+
+};
+
+
+const char *status_name(ControlStatus status);
+
+
+#endif
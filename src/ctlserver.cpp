@@ -0,0 +1,311 @@
+/*
+    ctlserver.cpp - daemon end of the binary control socket
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include "ctlserver.h"
+#include "decode.h"
+#include "listener.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <limits>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+
+/* Returns `number` cut down to fit in a T. */
+template <typename T>
+static T clamped(long long number) {
+    return static_cast<T>(std::clamp<long long>(number, 0, std::numeric_limits<T>::max()));
+}
+
+
+/* A control server listening on `address` (see listen_on) for commands to
+ * `ports`, which clients name by their place in it, and which passes each
+ * command to `submit`.
+ *
+ * Throws `std::runtime_error` for a malformed address, or
+ * `std::system_error` if it cannot be listened on.
+ */
+ControlServer::ControlServer(const std::string &address, const std::vector<std::string> &ports,
+                             Submit submit)
+    : m_listen { listen_on(address, "control") },
+      m_submit { std::move(submit) },
+      m_ports { ports }
+{
+}
+
+ControlServer::~ControlServer() {
+    for ( const auto &[fd, _unused] : m_clients ) {
+        ::close(fd);
+    }
+    ::close(m_listen);
+}
+
+/* Accepts every pending connection, while there is room for them. */
+void ControlServer::accept() {
+    while ( m_clients.size() < CONTROL_MAX_CLIENTS ) {
+        auto fd { accept4(m_listen, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC) };
+        if ( fd < 0 ) {
+            return;
+        }
+        // Replies are written in batches already, so never hold them back.
+        int on { 1 };
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        m_clients[fd] = Client { ++m_serial, peer_name(fd) };
+    }
+}
+
+/* Sends `result` as the reply to request `id` of connection `fd`, if it is
+ * still the connection numbered `serial`.
+ */
+void ControlServer::answer(int fd, uint64_t serial, uint32_t id, const Result &result) {
+    auto it { m_clients.find(fd) };
+    if ( it == m_clients.end() || it->second.serial != serial ) {
+        return;
+    }
+    auto &client { it->second };
+    --client.pending;
+
+    auto decoded { result.decoded() };
+    ControlReply reply {};
+    reply.status = static_cast<uint8_t>(lookup(CONTROL_STATUS_WORDS, error_class(result.error),
+                                               ControlStatus::Error));
+    reply.key = static_cast<uint8_t>(decoded.key);
+    reply.id = id;
+    reply.value = static_cast<uint8_t>(decoded.value);
+    reply.attempts = clamped<uint16_t>(result.attempts);
+    reply.number = decoded.number;
+    reply.latency_us = clamped<uint32_t>(result.latency.count());
+    this->reply(client, reply, decoded.value == Value::Text ? decoded.text : "");
+
+    // Replies given while requests are read go out with the rest.
+    if ( ! client.reading ) {
+        serve(fd, client);
+    }
+}
+
+/* Returns the number of open connections. */
+std::size_t ControlServer::clients() const {
+    return m_clients.size();
+}
+
+void ControlServer::close(int fd) {
+    ::close(fd);
+    m_clients.erase(fd);
+}
+
+/* Appends the descriptors the server needs watched to `fds`.  Pass the same
+ * `fds`, after poll(), to process().
+ */
+void ControlServer::prepare(std::vector<pollfd> &fds) {
+    if ( m_clients.size() < CONTROL_MAX_CLIENTS ) {
+        fds.push_back(pollfd { m_listen, POLLIN, 0 });
+    }
+    for ( const auto &[fd, client] : m_clients ) {
+        short events { 0 };
+        if ( ! client.eof && client.in.size() < CONTROL_MAX_BACKLOG && ready(client) ) {
+            events |= POLLIN;
+        }
+        if ( client.sent < client.out.size() ) {
+            events |= POLLOUT;
+        }
+        fds.push_back(pollfd { fd, events, 0 });
+    }
+}
+
+/* Handles the poll() results in `fds` for descriptors added by prepare().
+ *
+ * Descriptors in `fds` belonging to anyone else are ignored.
+ */
+void ControlServer::process(const std::vector<pollfd> &fds) {
+    for ( const auto &pfd : fds ) {
+        if ( pfd.revents == 0 ) {
+            continue;
+        }
+        if ( pfd.fd == m_listen ) {
+            accept();
+            continue;
+        }
+        auto it { m_clients.find(pfd.fd) };
+        if ( it == m_clients.end() ) {
+            continue;
+        }
+        if ( pfd.revents & POLLOUT ) {
+            write(pfd.fd, it->second);
+            it = m_clients.find(pfd.fd);
+        }
+        if ( it != m_clients.end() && (pfd.revents & POLLIN) ) {
+            read(pfd.fd, it->second);
+            it = m_clients.find(pfd.fd);
+        } else if ( it != m_clients.end() && (pfd.revents & (POLLHUP | POLLERR)) ) {
+            // Nobody is left to answer.
+            close(pfd.fd);
+            continue;
+        }
+        if ( it != m_clients.end() ) {
+            serve(pfd.fd, it->second);
+        }
+    }
+}
+
+/* Reads what has arrived on connection `fd`, up to CONTROL_MAX_BACKLOG
+ * bytes not yet taken as requests.
+ */
+void ControlServer::read(int fd, Client &client) {
+    char buffer[ 16384 ];
+    ssize_t ret { 1 };
+    while ( client.in.size() < CONTROL_MAX_BACKLOG
+            && (ret = recv(fd, buffer, sizeof(buffer), 0)) > 0 ) {
+        client.in.append(buffer, ret);
+    }
+    if ( ret == 0 ) {
+        client.eof = true;
+    } else if ( ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR ) {
+        close(fd);
+    }
+}
+
+/* Returns true if `client` may have more of its requests taken. */
+bool ControlServer::ready(const Client &client) const {
+    return client.pending < CONTROL_MAX_PENDING
+        && client.out.size() - client.sent < CONTROL_MAX_BACKLOG;
+}
+
+/* Queues `reply`, followed by `text`, to go to `client`. */
+void ControlServer::reply(Client &client, ControlReply reply, std::string_view text) {
+    reply.length = static_cast<uint16_t>(sizeof(reply) + text.size());
+    client.out.append(reinterpret_cast<const char *>(&reply), sizeof(reply));
+    client.out.append(text);
+}
+
+/* Runs one request from `client`, or refuses it at once. */
+void ControlServer::request(int fd, Client &client, const ControlRequest &request) {
+    ControlReply refusal {};
+    refusal.id = request.id;
+    auto refuse { [this, &client, &refusal](ControlStatus status) {
+        refusal.status = static_cast<uint8_t>(status);
+        reply(client, refusal, "");
+    } };
+
+    if ( request.command == CONTROL_LIST_PORTS ) {
+        std::string text;
+        for ( const auto &port : m_ports ) {
+            if ( sizeof(ControlReply) + text.size() + port.size() + 1
+                    > std::numeric_limits<uint16_t>::max() ) {
+                break;
+            }
+            text += port + '\n';
+        }
+        refusal.number = static_cast<int32_t>(m_ports.size());
+        reply(client, refusal, text);
+        return;
+    }
+    if ( request.port >= m_ports.size() ) {
+        refuse(ControlStatus::UnknownPort);
+        return;
+    }
+    if ( request.command >= CONTROL_COMMANDS.size() ) {
+        refuse(ControlStatus::UnknownCommand);
+        return;
+    }
+    if ( request.flags & ~CONTROL_FLAGS ) {
+        refuse(ControlStatus::BadRequest);
+        return;
+    }
+
+    std::string cmd { CONTROL_COMMANDS[request.command] };
+    if ( cmd == VOLUME_SET ) {
+        // A level out of range fails "illegal" on the way, as on every path.
+        cmd += '=' + std::to_string(request.argument);
+    }
+    auto deadline { NO_DEADLINE };
+    if ( request.deadline != 0 ) {
+        deadline = deadline_at(std::chrono::milliseconds(clamped<int64_t>(
+                std::min<uint64_t>(request.deadline, std::numeric_limits<int64_t>::max()))));
+    }
+
+    ++client.pending;
+    m_submit(client.peer, m_ports[request.port], cmd, request.flags, deadline,
+        [this, fd, serial { client.serial }, id { request.id }](const Result &result) {
+            answer(fd, serial, id, result);
+        });
+}
+
+/* Runs the whole requests received on connection `fd`, while the client
+ * has room for more, and writes the replies ready.  A client which has sent
+ * all it will is closed once its last reply is sent.
+ */
+void ControlServer::serve(int fd, Client &client) {
+    client.reading = true;
+    std::size_t used { 0 };
+    while ( ready(client) && client.in.size() - used >= sizeof(uint16_t) ) {
+        uint16_t length;
+        std::memcpy(&length, client.in.data() + used, sizeof(length));
+        if ( length < sizeof(ControlRequest) ) {
+            // There is no telling where the next request starts.
+            close(fd);
+            return;
+        }
+        if ( client.in.size() - used < length ) {
+            break;
+        }
+        ControlRequest request;
+        std::memcpy(&request, client.in.data() + used, sizeof(request));
+        used += length;
+        this->request(fd, client, request);
+    }
+    client.in.erase(0, used);
+    client.reading = false;
+
+    write(fd, client);
+    auto it { m_clients.find(fd) };
+    if ( it != m_clients.end() && it->second.eof && it->second.pending == 0
+            && it->second.sent >= it->second.out.size() ) {
+        close(fd);
+    }
+}
+
+/* Sends what it can of the output queued on connection `fd`. */
+void ControlServer::write(int fd, Client &client) {
+    while ( client.sent < client.out.size() ) {
+        auto ret { send(fd, client.out.data() + client.sent, client.out.size() - client.sent,
+                        MSG_NOSIGNAL) };
+        if ( ret < 0 ) {
+            if ( errno == EAGAIN || errno == EWOULDBLOCK ) {
+                // Keep only what is left, as more replies join it.
+                client.out.erase(0, client.sent);
+                client.sent = 0;
+                return;
+            }
+            if ( errno == EINTR ) {
+                continue;
+            }
+            close(fd);
+            return;
+        }
+        client.sent += ret;
+    }
+    client.out.clear();
+    client.sent = 0;
+}
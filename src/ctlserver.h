@@ -0,0 +1,123 @@
+/*
+    ctlserver.h - daemon end of the binary control socket
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#ifndef CTLSERVER_H
+#define CTLSERVER_H true
+
+#include "control.h"
+#include "exchange.h"
+#include "portman.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <poll.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+/* Most connections open at once.  Others wait in the listen backlog. */
+constexpr std::size_t CONTROL_MAX_CLIENTS { 256 };
+
+/* Most requests one client may have unanswered.  A client with this many is
+ * not read from until some are answered, which holds it back through socket
+ * flow control instead of queueing without bound.
+ */
+constexpr std::size_t CONTROL_MAX_PENDING { 1024 };
+
+/* Most bytes of replies queued for one client before it is not read from
+ * either, until it takes some.
+ */
+constexpr std::size_t CONTROL_MAX_BACKLOG { 1 << 16 };
+
+
+/* Serves the binary protocol of control.h to socket clients, to embed in a
+ * poll loop with prepare() and process().
+ *
+ * A client may have many requests running at once, on any of the ports,
+ * and gets each reply as soon as its command completes, so replies come
+ * back in any order.  Requests read together are answered together, with
+ * one write for all the replies ready by then.
+ */
+class ControlServer {
+
+    public:
+
+        /* Runs UI command `cmd` (see commands in bewield.h) on `port` for
+         * client `peer` (see peer_name), by `deadline`, and calls `done`.
+         * `flags` are those of the request.
+         */
+        using Submit = std::function<void(const std::string &peer, const std::string &port,
+                                          const std::string &cmd, uint16_t flags,
+                                          Deadline deadline, PortManager::Completion done)>;
+
+    private:
+
+        struct Client {
+            // distinguishes this connection from a later one on the same fd
+            uint64_t serial;
+            std::string peer;
+            std::string in;
+            std::string out;
+            std::size_t sent { 0 };
+            // requests submitted and not yet answered
+            std::size_t pending { 0 };
+            // replies are being gathered to write at once
+            bool reading { false };
+            // the client has sent all it will
+            bool eof { false };
+        };
+
+        int m_listen { -1 };
+        Submit m_submit;
+        std::vector<std::string> m_ports;
+        std::map<int, Client> m_clients;
+        uint64_t m_serial { 0 };
+
+        void accept();
+        void answer(int fd, uint64_t serial, uint32_t id, const Result &result);
+        void close(int fd);
+        void read(int fd, Client &client);
+        bool ready(const Client &client) const;
+        void reply(Client &client, ControlReply reply, std::string_view text);
+        void request(int fd, Client &client, const ControlRequest &request);
+        void serve(int fd, Client &client);
+        void write(int fd, Client &client);
+
+    public:
+
+        ControlServer(const std::string &address, const std::vector<std::string> &ports,
+                      Submit submit);
+        ~ControlServer();
+
+        ControlServer(const ControlServer &) = delete;
+        ControlServer &operator=(const ControlServer &) = delete;
+
+        std::size_t clients() const;
+        void prepare(std::vector<pollfd> &fds);
+        void process(const std::vector<pollfd> &fds);
+
+};
+
+
+#endif
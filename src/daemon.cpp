@@ -0,0 +1,693 @@
+/*
+    daemon.cpp - long-running bewield serving schedules and clients
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include "daemon.h"
+#include "bewield.h"
+#include "decode.h"
+#include "poller.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <iostream>
+#include <sstream>
+#include <system_error>
+
+
+/* Returns `entry`, the value of `key` on `port`, as an event line:
+ *
+ *   {"port":"/dev/ttyUSB0","key":"pow","value":"on","previous":"off",
+ *    "updated":...}
+ *
+ * with "previous" left out if there is none and the time in nanoseconds
+ * since the epoch.
+ */
+static std::string event_json(const std::string &port, Key key,
+                              const StateCache::Entry &entry, const std::string *previous) {
+    std::ostringstream json;
+    json << "{\"port\":";
+    json_string(json, port);
+    json << ",\"key\":\"" << spelling(KEY_WORDS, key) << "\",\"value\":";
+    json_string(json, entry.value);
+    if ( previous ) {
+        json << ",\"previous\":";
+        json_string(json, *previous);
+    }
+    json << ",\"updated\":" << std::chrono::duration_cast<std::chrono::nanoseconds>(
+            entry.updated.time_since_epoch()).count() << "}\n";
+    return json.str();
+}
+
+/* Returns `text` with %XX escapes decoded. */
+static std::string percent_decoded(const std::string &text) {
+    std::string decoded;
+    for ( std::size_t i { 0 }; i < text.size(); ++i ) {
+        if ( text[i] == '%' && i + 2 < text.size()
+                && std::isxdigit(static_cast<unsigned char>(text[i + 1]))
+                && std::isxdigit(static_cast<unsigned char>(text[i + 2])) ) {
+            decoded += static_cast<char>(std::stoi(text.substr(i + 1, 2), nullptr, 16));
+            i += 2;
+        } else {
+            decoded += text[i];
+        }
+    }
+    return decoded;
+}
+
+/* Returns the HTTP status for a command which ended as `result`. */
+static int http_status(const Result &result) {
+    std::string kind { error_class(result.error) };
+    if ( kind == "ok" ) {
+        return 200;
+    } else if ( kind == "unknown_command" ) {
+        return 404;
+    } else if ( kind == "blocked" ) {
+        return 409;
+    } else if ( kind == "unsupported" ) {
+        return 501;
+    } else if ( kind == "busy" || kind == "overload" ) {
+        return 503;
+    } else if ( kind == "timeout" || kind == "expired" ) {
+        return 504;
+    } else if ( kind == "illegal" || kind == "io" ) {
+        return 502;
+    }
+    return 500;
+}
+
+/* Returns `result` as a JSON object, as written by Format::JsonLines. */
+static std::string result_json(const Result &result) {
+    std::ostringstream out;
+    Report { out, Format::JsonLines }.write(result);
+    auto json { out.str() };
+    json.pop_back();
+    return json;
+}
+
+/* Returns the command which queries `key`, or "" if there is none. */
+static std::string query_command(Key key) {
+    for ( const auto &[cmd, message] : commands ) {
+        auto command { decode(message) };
+        if ( command.key == key && command.value == Value::Query ) {
+            return cmd;
+        }
+    }
+    return "";
+}
+
+/* Returns `path` split at '/', without empty segments. */
+static std::vector<std::string> segments(const std::string &path) {
+    std::vector<std::string> parts;
+    std::istringstream in { path };
+    std::string part;
+    while ( std::getline(in, part, '/') ) {
+        if ( ! part.empty() ) {
+            parts.push_back(percent_decoded(part));
+        }
+    }
+    return parts;
+}
+
+
+/* A daemon for `ports`, and any other ports named by `actions`, which runs
+ * `actions` on schedule and reports their results to `report`.  Event
+ * clients may name ports through `inventory`.
+ *
+ * The state of each port is polled every `interval_ms` milliseconds, backing
+ * off up to POLL_BACKOFF times that while it holds still, or never if
+ * `interval_ms` is 0.
+ */
+Daemon::Daemon(const std::vector<std::string> &ports, std::vector<Action> actions,
+               const Inventory &inventory, Report &report, int concurrency, int retries,
+               int interval_ms)
+    : m_report { report },
+      m_scheduler { m_ports, std::move(actions),
+                    [this](const Result &result) { complete(result); },
+                    concurrency, retries },
+      m_served { ports },
+      m_inventory { inventory },
+      m_polling { interval_ms > 0 },
+      m_plan { std::chrono::milliseconds(interval_ms),
+               std::chrono::milliseconds(interval_ms) * POLL_BACKOFF }
+{
+    for ( const auto &port : m_served ) {
+        m_ports.add(port);
+        m_state.add(port);
+        if ( m_polling ) {
+            for ( const auto &cmd : POLL_QUERIES ) {
+                m_plan.add(port, decode(commands.at(cmd)).key);
+            }
+        }
+    }
+
+    std::ostringstream json;
+    json << "{\"commands\":[";
+    const char *separator { "" };
+    for ( const auto &[cmd, message] : commands ) {
+        json << separator << "{\"name\":";
+        json_string(json, cmd);
+        json << ",\"message\":";
+        json_string(json, message);
+        json << '}';
+        separator = ",";
+    }
+    json << "]}";
+    m_commands_json = json.str();
+}
+
+/* Returns true if `peer` may send `cmd`, counting it until release(), or
+ * false if `cmd` is a query and `peer` has CLIENT_MAX_QUERIES waiting.
+ */
+bool Daemon::admit(const std::string &peer, const std::string &cmd) {
+    if ( ! is_query_command(cmd) ) {
+        return true;
+    }
+    auto &waiting { m_queries[peer] };
+    if ( waiting >= CLIENT_MAX_QUERIES ) {
+        return false;
+    }
+    ++waiting;
+    return true;
+}
+
+/* Fills `result` with the latest value known for query `cmd` on `port`, as
+ * though the projector had just given it, and returns true.  Returns false
+ * if `cmd` is no query or its value is not yet known.
+ */
+bool Daemon::cached(const std::string &port, const std::string &cmd, Result &result) const {
+    auto message { commands.find(cmd) };
+    if ( message == commands.end() ) {
+        return false;
+    }
+    auto command { decode(message->second) };
+    const auto *projector { m_state.find(port) };
+    if ( command.value != Value::Query || ! projector ) {
+        return false;
+    }
+    auto entry { projector->values.find(command.key) };
+    if ( entry == projector->values.end() ) {
+        return false;
+    }
+    result = Result { port, cmd,
+                      std::string(spelling(KEY_WORDS, command.key)) + '=' + entry->second.value };
+    return true;
+}
+
+/* Records and reports the result of a command run for someone.  Commands
+ * turned away for load were never run, and are not reported either, so a
+ * flood of them cannot flood the report as well.
+ */
+void Daemon::complete(const Result &result) {
+    if ( std::string(error_class(result.error)) == "overload" ) {
+        return;
+    }
+    record(result);
+    m_report.write(result);
+    std::cout.flush();
+}
+
+/* Returns the served port named by a URL path segment, either its whole
+ * path (e.g. "%2Fdev%2FttyUSB0") or a file name only one port has (e.g.
+ * "ttyUSB0").  Returns "" if there is no such port.
+ */
+std::string Daemon::find(const std::string &segment) const {
+    if ( std::find(m_served.begin(), m_served.end(), segment) != m_served.end() ) {
+        return segment;
+    }
+    std::string found;
+    for ( const auto &port : m_served ) {
+        auto name { port.substr(port.rfind('/') + 1) };
+        if ( name == segment ) {
+            if ( ! found.empty() ) {
+                return "";
+            }
+            found = port;
+        }
+    }
+    return found;
+}
+
+/* Answers one HTTP request:
+ *
+ *   GET  /commands                 the commands table
+ *   GET  /ports                    the state of every port
+ *   GET  /ports/PORT               the state of one port
+ *   GET  /ports/PORT/QUERY         a query's latest value, asking the
+ *                                  projector only if there is none yet
+ *   POST /ports/PORT/COMMAND       runs a command and returns its result
+ */
+void Daemon::handle(const HttpServer::Request &request, HttpServer::Respond respond) {
+    auto parts { segments(request.path) };
+    bool get { request.method == "GET" };
+    auto not_found { [&respond]() {
+        respond(HttpServer::Response { 404, "{\"error\":\"not found\"}" });
+    } };
+
+    if ( parts.size() == 1 && parts[0] == "commands" ) {
+        if ( ! get ) {
+            respond(HttpServer::Response { 405, "" });
+            return;
+        }
+        respond(HttpServer::Response { 200, m_commands_json });
+        return;
+    }
+    if ( parts.empty() || parts[0] != "ports" || parts.size() > 3 ) {
+        not_found();
+        return;
+    }
+
+    if ( parts.size() == 1 ) {
+        if ( ! get ) {
+            respond(HttpServer::Response { 405, "" });
+            return;
+        }
+        std::ostringstream json;
+        json << "{\"ports\":[";
+        const char *separator { "" };
+        for ( const auto &port : m_served ) {
+            json << separator;
+            m_state.json(json, port);
+            separator = ",";
+        }
+        json << "]}";
+        respond(HttpServer::Response { 200, json.str() });
+        return;
+    }
+
+    auto port { find(parts[1]) };
+    if ( port.empty() ) {
+        not_found();
+        return;
+    }
+    if ( parts.size() == 2 ) {
+        if ( ! get ) {
+            respond(HttpServer::Response { 405, "" });
+            return;
+        }
+        std::ostringstream json;
+        m_state.json(json, port);
+        respond(HttpServer::Response { 200, json.str() });
+        return;
+    }
+
+    const auto &cmd { parts[2] };
+    Reply command;
+    if ( auto message { commands.find(cmd) }; message != commands.end() ) {
+        command = decode(message->second);
+    } else if ( ! is_volume_set(cmd) ) {
+        not_found();
+        return;
+    }
+    if ( get ) {
+        if ( command.value != Value::Query ) {
+            respond(HttpServer::Response { 405, "" });
+            return;
+        }
+        // Answer from the cache when it has a value for this key.
+        const auto *projector { m_state.find(port) };
+        auto entry { projector->values.find(command.key) };
+        if ( entry != projector->values.end() ) {
+            std::ostringstream json;
+            json << "{\"port\":";
+            json_string(json, port);
+            json << ",\"command\":";
+            json_string(json, cmd);
+            json << ",\"key\":\"" << spelling(KEY_WORDS, command.key) << "\",\"value\":";
+            json_string(json, entry->second.value);
+            json << ",\"updated\":" << std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    entry->second.updated.time_since_epoch()).count() << '}';
+            respond(HttpServer::Response { 200, json.str() });
+            return;
+        }
+    } else if ( request.method != "POST" ) {
+        respond(HttpServer::Response { 405, "" });
+        return;
+    }
+
+    if ( ! m_ports.connected(port) ) {
+        respond(HttpServer::Response { 503, "{\"error\":\"port unavailable\"}" });
+        return;
+    }
+    // A client which will stop waiting by some time sends it as a Deadline
+    // header, in milliseconds since the epoch.
+    auto deadline { NO_DEADLINE };
+    if ( auto header { request.headers.find("deadline") }; header != request.headers.end() ) {
+        const auto &value { header->second };
+        if ( value.empty() || value.size() > 15
+                || value.find_first_not_of("0123456789") != std::string::npos ) {
+            respond(HttpServer::Response { 400, "{\"error\":\"bad deadline\"}" });
+            return;
+        }
+        deadline = deadline_at(std::chrono::milliseconds(std::stoll(value)));
+    }
+
+    if ( ! admit(request.peer, cmd) ) {
+        respond(HttpServer::Response { 429, "{\"error\":\"too many queries\"}",
+                                       "application/json", RETRY_AFTER });
+        return;
+    }
+    m_scheduler.submit(port, cmd,
+        [this, respond, peer { request.peer }, cmd](const Result &result) {
+            release(peer, cmd);
+            complete(result);
+            HttpServer::Response response { http_status(result), result_json(result) };
+            if ( response.status == 503 ) {
+                response.retry_after = RETRY_AFTER;
+            }
+            respond(response);
+        }, deadline);
+}
+
+/* Starts recording every change of state of the served ports in the
+ * history directory `dir` (see HistoryWriter).
+ */
+void Daemon::archive(const std::string &dir) {
+    m_history = std::make_unique<HistoryWriter>(dir, m_served);
+}
+
+/* Starts serving binary control clients on `address` (see ControlServer),
+ * who name the served ports by their place in the --port list.  Queries
+ * flagged CONTROL_CACHED are answered from the state cache when it has a
+ * value for them, and are neither counted against the client nor reported.
+ */
+void Daemon::control(const std::string &address) {
+    m_control = std::make_unique<ControlServer>(address, m_served,
+        [this](const std::string &peer, const std::string &port, const std::string &cmd,
+               uint16_t flags, Deadline deadline, PortManager::Completion done) {
+            Result result;
+            if ( (flags & CONTROL_CACHED) && cached(port, cmd, result) ) {
+                done(result);
+                return;
+            }
+            request(peer, port, cmd, deadline, std::move(done));
+        });
+}
+
+/* Starts serving HTTP clients on `address` (see HttpServer). */
+void Daemon::listen(const std::string &address) {
+    m_http = std::make_unique<HttpServer>(address,
+        [this](const HttpServer::Request &request, HttpServer::Respond respond) {
+            handle(request, std::move(respond));
+        });
+}
+
+/* Starts pushing changes of state to clients of `address`.
+ *
+ * Clients send lines of "watch KEYS [TARGET]", where KEYS is "all" or a
+ * comma separated list of keys, such as "pow,vol", and TARGET names ports
+ * as --target does, every port by default.  Each watch is answered with
+ * the values already known, then an event line (see event_json) follows
+ * whenever one of those values changes.
+ */
+void Daemon::push(const std::string &address) {
+    m_events = std::make_unique<EventServer>(address,
+        [this](uint64_t client, const std::string &line) { subscribe(client, line); });
+}
+
+/* Records `result` in the state cache, and in the history if kept, and
+ * sends any value it changes to the clients watching it.  Returns true if
+ * a value changed.
+ */
+bool Daemon::record(const Result &result) {
+    if ( m_history ) {
+        m_history->record(result);
+    }
+    auto key { result.decoded().key };
+    const auto *projector { m_state.find(result.port) };
+    std::string previous;
+    bool known { false };
+    if ( projector && projector->values.count(key) ) {
+        previous = projector->values.at(key).value;
+        known = true;
+    }
+
+    m_state.record(result);
+    if ( result.error || key == Key::Unknown ) {
+        return false;
+    }
+    const auto &entry { m_state.find(result.port)->values.at(key) };
+    if ( known && entry.value == previous ) {
+        return false;
+    }
+    if ( m_events ) {
+        m_events->publish(result.port, key,
+                          event_json(result.port, key, entry, known ? &previous : nullptr));
+    }
+    return true;
+}
+
+/* Queues a query for every key due to be polled on every open port. */
+void Daemon::refresh() {
+    for ( const auto &port : m_served ) {
+        auto keys { m_plan.due(port) };
+        if ( ! m_ports.connected(port) ) {
+            if ( m_history ) {
+                m_history->offline(port);
+            }
+            // Try again later rather than queue queries behind a lost port.
+            for ( auto key : keys ) {
+                m_plan.polled(port, key);
+            }
+            continue;
+        }
+        for ( auto key : keys ) {
+            m_scheduler.submit(port, query_command(key), [this, port, key](const Result &result) {
+                bool changed { record(result) };
+                m_plan.polled(port, key);
+                if ( changed ) {
+                    m_plan.changed(port);
+                }
+            });
+        }
+    }
+}
+
+/* Starts relaying frames from clients of `address` to `port` (see Gateway).
+ * Frames for a port which is not connected get no answer, as they would
+ * from a dead serial line.  Frames turned away for load are refused as a
+ * busy projector would refuse them.
+ */
+void Daemon::relay(const std::string &address, const std::string &port) {
+    m_gateways.push_back(std::make_unique<Gateway>(address,
+        [this, port](const std::string &peer, const std::string &cmd,
+                     PortManager::Completion done) {
+            request(peer, port, cmd, NO_DEADLINE, std::move(done));
+        }));
+}
+
+/* Stops counting `cmd` against `peer`, as counted by admit(). */
+void Daemon::release(const std::string &peer, const std::string &cmd) {
+    if ( ! is_query_command(cmd) ) {
+        return;
+    }
+    auto it { m_queries.find(peer) };
+    if ( it != m_queries.end() && --it->second == 0 ) {
+        m_queries.erase(it);
+    }
+}
+
+/* Runs `cmd` on `port` for client `peer` by `deadline`, then reports its
+ * result and calls `done`.  A port which is not connected fails the
+ * command at once with an "io" error, and a client with too many queries
+ * waiting (see admit()) with an "overload" one.
+ */
+void Daemon::request(const std::string &peer, const std::string &port, const std::string &cmd,
+                     Deadline deadline, PortManager::Completion done) {
+    if ( ! m_ports.connected(port) ) {
+        done(Result { port, cmd, "", std::make_exception_ptr(std::system_error(
+                std::make_error_code(std::errc::no_such_device),
+                "Port unavailable.")) });
+        return;
+    }
+    if ( ! admit(peer, cmd) ) {
+        done(Result { port, cmd, "", std::make_exception_ptr(std::system_error(
+                std::make_error_code(std::errc::resource_unavailable_try_again),
+                "Too many queries from " + peer + ".")) });
+        return;
+    }
+    m_scheduler.submit(port, cmd, [this, peer, cmd, done](const Result &result) {
+        release(peer, cmd);
+        complete(result);
+        done(result);
+    }, deadline);
+}
+
+/* Returns the served ports named by a target expression (see Inventory),
+ * or by a port's path or a file name only one port has, or every served
+ * port for an empty `target`.
+ *
+ * Throws `std::runtime_error` if `target` names nothing.
+ */
+std::vector<std::string> Daemon::resolve(const std::string &target) const {
+    if ( target.empty() ) {
+        return m_served;
+    }
+    std::vector<std::string> chosen;
+    try {
+        chosen = m_inventory.select(target);
+    } catch ( const std::runtime_error &e ) {
+        auto port { find(target) };
+        if ( port.empty() ) {
+            throw;
+        }
+        return { port };
+    }
+
+    std::vector<std::string> ports;
+    for ( const auto &port : m_served ) {
+        if ( std::find(chosen.begin(), chosen.end(), port) != chosen.end() ) {
+            ports.push_back(port);
+        }
+    }
+    return ports;
+}
+
+/* Serves until `stop` becomes non-zero. */
+void Daemon::run(const volatile std::sig_atomic_t &stop) {
+    while ( ! stop ) {
+        if ( m_polling ) {
+            refresh();
+        }
+        m_scheduler.tick();
+
+        std::vector<pollfd> fds;
+        m_ports.prepare(fds);
+        if ( m_http ) {
+            m_http->prepare(fds);
+        }
+        for ( auto &gateway : m_gateways ) {
+            gateway->prepare(fds);
+        }
+        if ( m_events ) {
+            m_events->prepare(fds);
+        }
+        if ( m_control ) {
+            m_control->prepare(fds);
+        }
+
+        int wait { -1 };
+        auto sooner { [&wait](int due) {
+            if ( due > -1 && (wait < 0 || due < wait) ) {
+                wait = due;
+            }
+        } };
+        sooner(m_scheduler.timeout());
+        sooner(m_ports.timeout());
+        if ( m_http ) {
+            sooner(m_http->timeout());
+        }
+        if ( m_polling ) {
+            sooner(m_plan.timeout());
+        }
+
+        if ( poll(fds.data(), fds.size(), wait) < 0 ) {
+            if ( errno != EINTR ) {
+                throw std::system_error(std::error_code(errno, std::system_category()),
+                                        std::string("daemon poll failed"));
+            }
+            continue;
+        }
+
+        m_ports.process(fds);
+        if ( m_http ) {
+            m_http->process(fds);
+        }
+        for ( auto &gateway : m_gateways ) {
+            gateway->process(fds);
+        }
+        if ( m_events ) {
+            m_events->process(fds);
+        }
+        if ( m_control ) {
+            m_control->process(fds);
+        }
+    }
+}
+
+/* Answers one line from event client `client` (see push()). */
+void Daemon::subscribe(uint64_t client, const std::string &line) {
+    std::istringstream in { line };
+    std::string verb, names, target, word;
+    in >> verb >> names;
+    while ( in >> word ) {
+        target += word;
+    }
+    if ( verb.empty() ) {
+        return;
+    }
+    auto refuse { [this, client](const std::string &why) {
+        std::ostringstream json;
+        json << "{\"error\":";
+        json_string(json, why);
+        json << "}\n";
+        m_events->send(client, json.str());
+    } };
+    if ( verb != "watch" || names.empty() ) {
+        refuse("Expected \"watch KEYS [TARGET]\".");
+        return;
+    }
+
+    std::vector<Key> keys;
+    if ( names == "all" ) {
+        for ( const auto &[_unused, key] : KEY_WORDS ) {
+            if ( ! query_command(key).empty() ) {
+                keys.push_back(key);
+            }
+        }
+    } else {
+        std::istringstream list { names };
+        std::string name;
+        while ( std::getline(list, name, ',') ) {
+            auto key { lookup(KEY_WORDS, name, Key::Unknown) };
+            if ( key == Key::Unknown || query_command(key).empty() ) {
+                refuse("Unknown key '" + name + "'.");
+                return;
+            }
+            keys.push_back(key);
+        }
+    }
+
+    std::vector<std::string> ports;
+    try {
+        ports = resolve(target);
+    } catch ( const std::runtime_error &e ) {
+        refuse(e.what());
+        return;
+    }
+    if ( ports.empty() ) {
+        refuse("No ports match '" + target + "'.");
+        return;
+    }
+
+    m_events->send(client, "{\"watching\":" + std::to_string(ports.size() * keys.size()) + "}\n");
+    for ( const auto &port : ports ) {
+        const auto &values { m_state.find(port)->values };
+        for ( auto key : keys ) {
+            m_events->watch(client, port, key);
+            if ( m_polling ) {
+                m_plan.add(port, key);
+            }
+            if ( auto entry { values.find(key) }; entry != values.end() ) {
+                m_events->send(client, event_json(port, key, entry->second, nullptr));
+            }
+        }
+    }
+}
@@ -0,0 +1,130 @@
+/*
+    daemon.h - long-running bewield serving schedules and clients
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#ifndef DAEMON_H
+#define DAEMON_H true
+
+#include "ctlserver.h"
+#include "events.h"
+#include "gateway.h"
+#include "history.h"
+#include "http.h"
+#include "inventory.h"
+#include "portman.h"
+#include "report.h"
+#include "scheduler.h"
+#include "state.h"
+
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+/* Most times --interval a key's polls back off to while its value holds. */
+constexpr int POLL_BACKOFF { 8 };
+
+/* Most queries one client may have waiting at once.  A TCP client is one
+ * connection, told apart by address and port, and a Unix socket client is
+ * one process (see peer_name), so one busy local client cannot use up the
+ * quota of the others.  Commands which change something are never held to
+ * it.
+ */
+constexpr std::size_t CLIENT_MAX_QUERIES { 16 };
+
+/* Seconds a client turned away for load is asked to wait before retrying. */
+constexpr int RETRY_AFTER { 1 };
+
+
+/* A long-running bewield: it keeps its serial ports open, runs scheduled
+ * commands, keeps the state of every projector current, and serves that
+ * state and the commands to local clients, over HTTP, a binary control
+ * socket or gateways speaking the projector's own protocol, and pushes
+ * state changes to clients which watch for them.
+ *
+ * Everything runs in one poll loop.  Commands from every source share the
+ * Scheduler's per-port queues and concurrency limit, with each client held
+ * to CLIENT_MAX_QUERIES.  State is polled on a PollPlan, once for all
+ * clients however many there are.
+ */
+class Daemon {
+
+    private:
+
+        PortManager m_ports;
+        Report &m_report;
+        StateCache m_state;
+        Scheduler m_scheduler;
+        std::unique_ptr<HttpServer> m_http;
+        std::vector<std::unique_ptr<Gateway>> m_gateways;
+        std::unique_ptr<EventServer> m_events;
+        std::unique_ptr<ControlServer> m_control;
+        std::unique_ptr<HistoryWriter> m_history;
+
+        /* Ports clients may use, in the order given. */
+        std::vector<std::string> m_served;
+
+        /* Names event clients may use for groups of ports. */
+        Inventory m_inventory;
+
+        /* Polling is off with an --interval of 0. */
+        bool m_polling;
+        PollPlan m_plan;
+
+        /* The body of GET /commands, which never changes. */
+        std::string m_commands_json;
+
+        /* Queries each client has waiting, by peer_name. */
+        std::map<std::string, std::size_t> m_queries;
+
+        bool admit(const std::string &peer, const std::string &cmd);
+        bool cached(const std::string &port, const std::string &cmd, Result &result) const;
+        void complete(const Result &result);
+        std::string find(const std::string &segment) const;
+        void handle(const HttpServer::Request &request, HttpServer::Respond respond);
+        bool record(const Result &result);
+        void refresh();
+        void release(const std::string &peer, const std::string &cmd);
+        void request(const std::string &peer, const std::string &port, const std::string &cmd,
+                     Deadline deadline, PortManager::Completion done);
+        std::vector<std::string> resolve(const std::string &target) const;
+        void subscribe(uint64_t client, const std::string &line);
+
+    public:
+
+        Daemon(const std::vector<std::string> &ports, std::vector<Action> actions,
+               const Inventory &inventory, Report &report, int concurrency, int retries,
+               int interval_ms);
+
+        void archive(const std::string &dir);
+        void control(const std::string &address);
+        void listen(const std::string &address);
+        void push(const std::string &address);
+        void relay(const std::string &address, const std::string &port);
+        void run(const volatile std::sig_atomic_t &stop);
+
+};
+
+
+#endif
@@ -0,0 +1,228 @@
+/*
+    decode.h - typed decoding of BenQ protocol messages
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#ifndef DECODE_H
+#define DECODE_H true
+
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <string_view>
+#include <utility>
+
+
+/* Item named on the left of '=' in a message.
+ *
+ * The numeric values are stored in shared files (see board.h), so only ever
+ * append to these enums.
+ */
+enum class Key : uint8_t {
+    Unknown,
+    AudioSource,
+    Blank,
+    Model,
+    Mute,
+    Power,
+    Source,
+    Volume,
+};
+
+/* Setting named on the right of '=' in a message. */
+enum class Value : uint8_t {
+    Unknown,    // not yet known, or not one of the values below
+    Query,      // "?"
+    Number,     // decimal, see Reply.number
+    Text,       // free text, e.g. a model name
+    On,
+    Off,
+    Hdmi,
+    Hdmi2,
+    Rgb,
+    Rgb2,
+    Dp,
+    Up,         // "+"
+    Down,       // "-"
+};
+
+/* The ways a projector refuses a command. */
+enum class Refusal : uint8_t {
+    None,
+    Blocked,        // "Block item": not available right now
+    Unsupported,    // "Unsupported item": not available on this model
+    Illegal,        // "Illegal format": the command was garbled
+};
+
+
+/* A decoded message.  `text` views the value part of the decoded frame, so
+ * it is only valid while that frame is.
+ */
+struct Reply {
+    Key key { Key::Unknown };
+    Value value { Value::Unknown };
+    int32_t number { 0 };
+    Refusal refusal { Refusal::None };
+    std::string_view text;
+};
+
+
+/* Protocol spelling of each Key, matched without regard to case. */
+constexpr std::array<std::pair<std::string_view, Key>, 7> KEY_WORDS { {
+    { "audiosour", Key::AudioSource },
+    { "blank", Key::Blank },
+    { "modelname", Key::Model },
+    { "mute", Key::Mute },
+    { "pow", Key::Power },
+    { "sour", Key::Source },
+    { "vol", Key::Volume },
+} };
+
+/* Protocol spelling of each enumerated Value, matched without regard to case. */
+constexpr std::array<std::pair<std::string_view, Value>, 10> VALUE_WORDS { {
+    { "?", Value::Query },
+    { "on", Value::On },
+    { "off", Value::Off },
+    { "hdmi", Value::Hdmi },
+    { "hdmi2", Value::Hdmi2 },
+    { "rgb", Value::Rgb },
+    { "rgb2", Value::Rgb2 },
+    { "dp", Value::Dp },
+    { "+", Value::Up },
+    { "-", Value::Down },
+} };
+
+/* Whole-frame replies which refuse the latest command. */
+constexpr std::array<std::pair<std::string_view, Refusal>, 3> REFUSAL_WORDS { {
+    { "Block item", Refusal::Blocked },
+    { "Unsupported item", Refusal::Unsupported },
+    { "Illegal format", Refusal::Illegal },
+} };
+
+
+/* Returns true if `a` and `b` are equal without regard to ASCII case. */
+constexpr bool same_word(std::string_view a, std::string_view b) {
+    if ( a.size() != b.size() ) {
+        return false;
+    }
+    for ( std::size_t i { 0 }; i < a.size(); ++i ) {
+        auto x { a[i] >= 'A' && a[i] <= 'Z' ? a[i] - 'A' + 'a' : a[i] };
+        auto y { b[i] >= 'A' && b[i] <= 'Z' ? b[i] - 'A' + 'a' : b[i] };
+        if ( x != y ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Returns the entry of `table` spelled `word`, or `fallback`. */
+template <typename T, std::size_t N>
+constexpr T lookup(const std::array<std::pair<std::string_view, T>, N> &table,
+                   std::string_view word, T fallback) {
+    for ( const auto &[spelling, entry] : table ) {
+        if ( same_word(spelling, word) ) {
+            return entry;
+        }
+    }
+    return fallback;
+}
+
+/* Returns the protocol spelling of `entry` in `table`, or "" if absent. */
+template <typename T, std::size_t N>
+constexpr std::string_view spelling(const std::array<std::pair<std::string_view, T>, N> &table,
+                                    T entry) {
+    for ( const auto &[word, candidate] : table ) {
+        if ( candidate == entry ) {
+            return word;
+        }
+    }
+    return "";
+}
+
+
+/* Returns the typed content of a message, such as "POW=ON" or a command like
+ * "pow=?".  Framing bytes (CR, '*' and '#') around the message are ignored.
+ *
+ * Decoding never allocates; an unrecognized message has Key::Unknown, and a
+ * number too large for Reply.number, as line noise can make, has
+ * Value::Unknown.
+ */
+constexpr Reply decode(std::string_view frame) {
+    Reply reply;
+
+    auto start { frame.find_first_not_of("\r*") };
+    if ( start == std::string_view::npos ) {
+        return reply;
+    }
+    frame.remove_prefix(start);
+    frame = frame.substr(0, frame.find_first_of("#\r"));
+
+    reply.refusal = lookup(REFUSAL_WORDS, frame, Refusal::None);
+    if ( reply.refusal != Refusal::None ) {
+        return reply;
+    }
+
+    auto equals { frame.find('=') };
+    if ( equals == std::string_view::npos ) {
+        return reply;
+    }
+    reply.key = lookup(KEY_WORDS, frame.substr(0, equals), Key::Unknown);
+    reply.text = frame.substr(equals + 1);
+
+    bool numeric { ! reply.text.empty() };
+    bool overflow { false };
+    int32_t number { 0 };
+    for ( auto c : reply.text ) {
+        if ( c < '0' || c > '9' ) {
+            numeric = false;
+            break;
+        }
+        // Line noise can make a number of any length.
+        if ( number > (std::numeric_limits<int32_t>::max() - (c - '0')) / 10 ) {
+            overflow = true;
+        } else {
+            number = number * 10 + (c - '0');
+        }
+    }
+
+    if ( numeric && overflow ) {
+        reply.value = Value::Unknown;
+    } else if ( numeric ) {
+        reply.value = Value::Number;
+        reply.number = number;
+    } else {
+        reply.value = lookup(VALUE_WORDS, reply.text,
+                             reply.text.empty() ? Value::Unknown : Value::Text);
+    }
+
+    return reply;
+}
+
+
+static_assert(decode("\r*POW=ON#\r").key == Key::Power);
+static_assert(decode("POW=ON").value == Value::On);
+static_assert(decode("VOL=12").number == 12);
+static_assert(decode("VOL=2147483647").number == 2147483647);
+static_assert(decode("VOL=99999999999").value == Value::Unknown);
+static_assert(decode("sour=RGB2").value == Value::Rgb2);
+static_assert(decode("*Block item#").refusal == Refusal::Blocked);
+static_assert(decode("MODELNAME=MW632ST").value == Value::Text);
+
+
+#endif
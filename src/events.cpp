@@ -0,0 +1,217 @@
+/*
+    events.cpp - state change events pushed to socket clients
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include "events.h"
+#include "listener.h"
+
+#include <cerrno>
+#include <sys/socket.h>
+#include <unistd.h>
+
+
+/* A server listening on `address` (see listen_on), which passes each line
+ * received to `handler`.
+ *
+ * Throws `std::runtime_error` for a malformed address, or
+ * `std::system_error` if it cannot be listened on.
+ */
+EventServer::EventServer(const std::string &address, Handler handler)
+    : m_listen { listen_on(address, "events") },
+      m_handler { std::move(handler) }
+{
+}
+
+EventServer::~EventServer() {
+    for ( const auto &[fd, _unused] : m_fds ) {
+        ::close(fd);
+    }
+    ::close(m_listen);
+}
+
+/* Accepts every pending connection, while there is room for them. */
+void EventServer::accept() {
+    while ( m_clients.size() < EVENTS_MAX_CLIENTS ) {
+        auto fd { accept4(m_listen, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC) };
+        if ( fd < 0 ) {
+            return;
+        }
+        m_clients[++m_serial] = Client { fd };
+        m_fds[fd] = m_serial;
+    }
+}
+
+/* Returns the number of open connections. */
+std::size_t EventServer::clients() const {
+    return m_clients.size();
+}
+
+void EventServer::close(uint64_t id) {
+    auto it { m_clients.find(id) };
+    if ( it == m_clients.end() ) {
+        return;
+    }
+    ::close(it->second.fd);
+    m_fds.erase(it->second.fd);
+    m_clients.erase(it);
+
+    for ( auto watched { m_watchers.begin() }; watched != m_watchers.end(); ) {
+        watched->second.erase(id);
+        if ( watched->second.empty() ) {
+            watched = m_watchers.erase(watched);
+        } else {
+            ++watched;
+        }
+    }
+}
+
+/* Appends the descriptors the server needs watched to `fds`.  Pass the same
+ * `fds`, after poll(), to process().
+ */
+void EventServer::prepare(std::vector<pollfd> &fds) {
+    if ( m_clients.size() < EVENTS_MAX_CLIENTS ) {
+        fds.push_back(pollfd { m_listen, POLLIN, 0 });
+    }
+    for ( const auto &[_unused, client] : m_clients ) {
+        short events { POLLIN };
+        if ( client.sent < client.out.size() ) {
+            events |= POLLOUT;
+        }
+        fds.push_back(pollfd { client.fd, events, 0 });
+    }
+}
+
+/* Handles the poll() results in `fds` for descriptors added by prepare().
+ *
+ * Descriptors in `fds` belonging to anyone else are ignored.
+ */
+void EventServer::process(const std::vector<pollfd> &fds) {
+    for ( const auto &pfd : fds ) {
+        if ( pfd.revents == 0 ) {
+            continue;
+        }
+        if ( pfd.fd == m_listen ) {
+            accept();
+            continue;
+        }
+        auto fd { m_fds.find(pfd.fd) };
+        if ( fd == m_fds.end() ) {
+            continue;
+        }
+        auto id { fd->second };
+        if ( pfd.revents & POLLOUT ) {
+            write(id, m_clients[id]);
+        }
+        if ( m_clients.count(id) && (pfd.revents & (POLLIN | POLLHUP | POLLERR)) ) {
+            read(id, m_clients[id]);
+        }
+    }
+}
+
+/* Sends `event` to every client watching `key` of `port`. */
+void EventServer::publish(const std::string &port, Key key, const std::string &event) {
+    auto watchers { m_watchers.find({ port, key }) };
+    if ( watchers == m_watchers.end() ) {
+        return;
+    }
+    // Sending may close a client, and with it change the set.
+    std::vector<uint64_t> ids { watchers->second.begin(), watchers->second.end() };
+    for ( auto id : ids ) {
+        send(id, event);
+    }
+}
+
+/* Reads what has arrived from `client`, up to a little over
+ * EVENTS_MAX_LINE bytes at a time, and passes it each whole line.
+ */
+void EventServer::read(uint64_t id, Client &client) {
+    char buffer[ 4096 ];
+    ssize_t ret { 1 };
+    while ( client.in.size() <= EVENTS_MAX_LINE
+            && (ret = recv(client.fd, buffer, sizeof(buffer), 0)) > 0 ) {
+        client.in.append(buffer, ret);
+    }
+    if ( ret == 0 || (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) ) {
+        close(id);
+        return;
+    }
+
+    std::size_t end;
+    while ( (end = client.in.find('\n')) != std::string::npos ) {
+        auto line { client.in.substr(0, end) };
+        client.in.erase(0, end + 1);
+        if ( ! line.empty() && line.back() == '\r' ) {
+            line.pop_back();
+        }
+        m_handler(id, line);
+        // The handler may have closed the client.
+        if ( ! m_clients.count(id) ) {
+            return;
+        }
+    }
+    if ( client.in.size() > EVENTS_MAX_LINE ) {
+        close(id);
+    }
+}
+
+/* Sends `line`, which ends with a newline, to `client`.  A client too far
+ * behind to take it is disconnected instead.
+ */
+void EventServer::send(uint64_t id, const std::string &line) {
+    auto it { m_clients.find(id) };
+    if ( it == m_clients.end() ) {
+        return;
+    }
+    auto &client { it->second };
+    if ( client.out.size() - client.sent + line.size() > EVENTS_MAX_BACKLOG ) {
+        close(id);
+        return;
+    }
+    client.out += line;
+    write(id, client);
+}
+
+/* Registers `client` as watching `key` of `port`. */
+void EventServer::watch(uint64_t id, const std::string &port, Key key) {
+    if ( m_clients.count(id) ) {
+        m_watchers[{ port, key }].insert(id);
+    }
+}
+
+/* Sends what it can of the output queued for `client`. */
+void EventServer::write(uint64_t id, Client &client) {
+    while ( client.sent < client.out.size() ) {
+        auto ret { ::send(client.fd, client.out.data() + client.sent,
+                          client.out.size() - client.sent, MSG_NOSIGNAL) };
+        if ( ret < 0 ) {
+            if ( errno == EAGAIN || errno == EWOULDBLOCK ) {
+                return;
+            }
+            if ( errno == EINTR ) {
+                continue;
+            }
+            close(id);
+            return;
+        }
+        client.sent += ret;
+    }
+    client.out.clear();
+    client.sent = 0;
+}
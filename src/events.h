@@ -0,0 +1,109 @@
+/*
+    events.h - state change events pushed to socket clients
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#ifndef EVENTS_H
+#define EVENTS_H true
+
+#include "decode.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <poll.h>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+/* Most connections open at once.  Others wait in the listen backlog. */
+constexpr std::size_t EVENTS_MAX_CLIENTS { 1024 };
+
+/* Longest request line accepted. */
+constexpr std::size_t EVENTS_MAX_LINE { 1024 };
+
+/* Most bytes of events queued for one client.  A client which falls further
+ * behind is disconnected, rather than held in memory without bound.
+ */
+constexpr std::size_t EVENTS_MAX_BACKLOG { 1 << 20 };
+
+
+/* Pushes events to socket clients as they happen, to embed in a poll loop
+ * with prepare() and process().
+ *
+ * Each line a client sends goes to the handler, which answers through
+ * send() and registers the client's interest in keys of ports with watch().
+ * publish() then sends an event to every client watching its port and key,
+ * however many there are, without anyone asking the projector again.
+ */
+class EventServer {
+
+    public:
+
+        using Handler = std::function<void(uint64_t client, const std::string &line)>;
+
+    private:
+
+        struct Client {
+            int fd;
+            std::string in;
+            std::string out;
+            std::size_t sent { 0 };
+        };
+
+        int m_listen { -1 };
+        Handler m_handler;
+
+        /* Clients keyed by a number never reused, so a handler's client
+         * number stays valid even once the client is gone.
+         */
+        std::map<uint64_t, Client> m_clients;
+        std::map<int, uint64_t> m_fds;
+        uint64_t m_serial { 0 };
+
+        /* Clients watching each key of each port. */
+        std::map<std::pair<std::string, Key>, std::set<uint64_t>> m_watchers;
+
+        void accept();
+        void close(uint64_t id);
+        void read(uint64_t id, Client &client);
+        void write(uint64_t id, Client &client);
+
+    public:
+
+        EventServer(const std::string &address, Handler handler);
+        ~EventServer();
+
+        EventServer(const EventServer &) = delete;
+        EventServer &operator=(const EventServer &) = delete;
+
+        std::size_t clients() const;
+        void prepare(std::vector<pollfd> &fds);
+        void process(const std::vector<pollfd> &fds);
+        void publish(const std::string &port, Key key, const std::string &event);
+        void send(uint64_t client, const std::string &line);
+        void watch(uint64_t client, const std::string &port, Key key);
+
+};
+
+
+#endif
@@ -0,0 +1,613 @@
+/*
+    exchange.cpp - command and reply exchange with a BenQ projector
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include "exchange.h"
+#include "bewield.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <ctime>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+
+/* Returns the outcome of `cmd`, which sets the volume to `level`, with
+ * every frame it takes sent and answered in turn on `device` before
+ * `deadline`.
+ */
+static Result set_volume(Lineal &device, const std::string &cmd, int level, int retries,
+                         Deadline deadline) {
+    Result result { device.name(), cmd };
+    auto start { std::chrono::steady_clock::now() };
+
+    VolumeRamp ramp { level, retries };
+    for ( auto step { ramp.next() }; ! step.empty(); step = ramp.next() ) {
+        auto outcome { transact(device, step, 0, deadline) };
+        ramp.feed(outcome.reply, outcome.error);
+    }
+
+    result.reply = ramp.reply();
+    result.error = ramp.error();
+    result.attempts = ramp.sent();
+    result.latency = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start);
+    return result;
+}
+
+
+/* Returns a short, stable name for the kind of failure held by `error`, or
+ * "ok" if `error` is null.  These names are part of the structured output.
+ * A command whose argument is out of range (see volume_error) is "illegal",
+ * as one the projector finds garbled is.
+ */
+const char *error_class(const std::exception_ptr &error) {
+    if ( ! error ) {
+        return "ok";
+    }
+    try {
+        std::rethrow_exception(error);
+    } catch ( const ProjectorError &e ) {
+        switch ( e.refusal() ) {
+            case Refusal::None:
+                return "ok";
+            case Refusal::Blocked:
+                return "blocked";
+            case Refusal::Unsupported:
+                return "unsupported";
+            case Refusal::Illegal:
+                return "illegal";
+        }
+    } catch ( const std::system_error &e ) {
+        if ( e.code() == std::errc::timed_out ) {
+            return "timeout";
+        } else if ( e.code() == std::errc::device_or_resource_busy ) {
+            return "busy";
+        } else if ( e.code() == std::errc::resource_unavailable_try_again ) {
+            return "overload";
+        } else if ( e.code() == std::errc::stream_timeout ) {
+            return "expired";
+        }
+        return "io";
+    } catch ( const std::out_of_range &e ) {
+        return "unknown_command";
+    } catch ( const std::invalid_argument &e ) {
+        return "illegal";
+    } catch ( ... ) {
+    }
+    return "error";
+}
+
+
+/* Returns the message sent for `cmd`, without framing: the message of a UI
+ * command in `commands`, or the inside of a raw frame such as "*pow=?#",
+ * which is relayed as given.
+ *
+ * Throws `std::out_of_range` if `cmd` is neither, or volume_error() for an
+ * "audio_vol_set=N" with no valid level, which is no single message.
+ */
+std::string command_message(const std::string &cmd) {
+    if ( cmd.size() > 2 && cmd.front() == PREFIX.front() && cmd.back() == SUFFIX.back() ) {
+        auto message { cmd.substr(1, cmd.size() - 2) };
+        for ( auto c : message ) {
+            if ( c < ' ' || c > '~' || c == PREFIX.front() || c == SUFFIX.back() ) {
+                throw std::out_of_range("malformed frame");
+            }
+        }
+        return message;
+    }
+    if ( is_volume_set(cmd) ) {
+        throw volume_error();
+    }
+    return commands.at(cmd);
+}
+
+/* Returns the Deadline at `unix_time`, in milliseconds since the epoch by
+ * the wall clock.  A time already past gives a Deadline already passed,
+ * and one more than a year ahead gives NO_DEADLINE.
+ */
+Deadline deadline_at(std::chrono::milliseconds unix_time) {
+    using namespace std::chrono;
+    auto now { steady_clock::now() };
+    auto wall { duration_cast<milliseconds>(system_clock::now().time_since_epoch()) };
+    if ( unix_time <= wall ) {
+        return now;
+    }
+    if ( unix_time - wall > hours(24 * 366) ) {
+        return NO_DEADLINE;
+    }
+    return now + (unix_time - wall);
+}
+
+/* Returns the failure of a command whose Deadline passed. */
+std::system_error deadline_error() {
+    return std::system_error(std::make_error_code(std::errc::stream_timeout),
+                             "Deadline passed.");
+}
+
+/* Returns the serial message for `cmd`, framing included.
+ *
+ * Throws `std::out_of_range` if `cmd` is not a command (see command_message).
+ */
+std::string frame(const std::string &cmd) {
+    // Build a message from necessary parts.
+    return CR + PREFIX + command_message(cmd) + SUFFIX + CR;
+}
+
+
+/* Returns the frame closing `line`, e.g. "*POW=ON#" from "\r*POW=ON#\r", or
+ * an empty view if `line` holds no intact frame.
+ *
+ * A frame runs from the last PREFIX to a SUFFIX immediately followed by the
+ * CR ending the line, and holds only printable text.
+ */
+std::string_view frame_of(std::string_view line) {
+    if ( line.size() < 2 || line.back() != CR || line[line.size() - 2] != SUFFIX.back() ) {
+        return {};
+    }
+    line.remove_suffix(1);
+    auto start { line.rfind(PREFIX.front()) };
+    if ( start == std::string_view::npos || start + 2 >= line.size() ) {
+        return {};
+    }
+    auto frame { line.substr(start) };
+    for ( auto c : frame ) {
+        if ( c < ' ' || c > '~' ) {
+            return {};
+        }
+    }
+    return frame;
+}
+
+
+/* Returns true if `cmd`, a UI command or raw frame, only asks for a value,
+ * such as "query_power" or "*vol=?#".
+ */
+bool is_query_command(const std::string &cmd) {
+    try {
+        return decode(command_message(cmd)).value == Value::Query;
+    } catch ( const std::logic_error &e ) {
+        return false;
+    }
+}
+
+/* Returns true if `cmd` sets the volume, "audio_vol_set=" followed by
+ * anything, whether or not it is a level volume_level() accepts.
+ */
+bool is_volume_set(const std::string &cmd) {
+    return cmd.size() > VOLUME_SET.size() && cmd.compare(0, VOLUME_SET.size(), VOLUME_SET) == 0
+           && cmd[VOLUME_SET.size()] == '=';
+}
+
+/* Returns the projector's answer from its `frame`, e.g. "POW=ON" from
+ * "*POW=ON#".
+ *
+ * Throws `ProjectorError` for various errors and warnings reported by the
+ * projector.
+ */
+std::string unframe(std::string_view frame) {
+    if ( ! frame.empty() && frame.front() == PREFIX.front() ) {
+        frame.remove_prefix(1);
+    }
+    if ( ! frame.empty() && frame.back() == SUFFIX.back() ) {
+        frame.remove_suffix(1);
+    }
+
+    switch ( decode(frame).refusal ) {
+        case Refusal::None:
+            break;
+        case Refusal::Blocked:
+            throw ProjectorError(Refusal::Blocked,
+                                 "Command not currently available, try again.");
+        case Refusal::Unsupported:
+            throw ProjectorError(Refusal::Unsupported, "Command not supported.");
+        case Refusal::Illegal:
+            throw ProjectorError(Refusal::Illegal, "Incorrect command format.");
+    }
+
+    return std::string(frame);
+}
+
+
+/* A matcher for the reply to `message`, e.g. "pow=?". */
+ReplyMatcher::ReplyMatcher(std::string_view message)
+    : m_sent { message },
+      m_command { decode(message) }
+{
+}
+
+/* Returns true if `reply` could answer the command sent. */
+bool ReplyMatcher::answers(const Reply &reply) const {
+    if ( reply.refusal != Refusal::None ) {
+        return true;
+    }
+    if ( reply.value == Value::Query ) {
+        // Only commands, never answers, ask a question.
+        return false;
+    }
+    return m_command.key == Key::Unknown || reply.key == m_command.key;
+}
+
+bool ReplyMatcher::echoed() const {
+    return m_echoed;
+}
+
+/* Returns the answer frame if `line` completes the reply, or else an empty
+ * view.  The frame views `line`, so it is only valid while `line` is.
+ *
+ * Until the echo arrives, other frames are leftovers from earlier exchanges.
+ * A query's echo may itself be lost to line noise, so an answer about the
+ * same item is accepted for a query even without it; any answer to that
+ * item is current.  After the echo, a frame which cannot answer the command
+ * (a mismatched echo) is skipped.
+ */
+std::string_view ReplyMatcher::feed(std::string_view line) {
+    auto frame { frame_of(line) };
+    if ( frame.empty() ) {
+        return {};
+    }
+    auto body { frame.substr(1, frame.size() - 2) };
+
+    if ( body == m_sent ) {
+        m_echoed = true;
+        return {};
+    }
+
+    auto reply { decode(body) };
+    bool query { m_command.value == Value::Query };
+    if ( (m_echoed || (query && reply.refusal == Refusal::None)) && answers(reply) ) {
+        return frame;
+    }
+
+    ++m_skipped;
+    return {};
+}
+
+int ReplyMatcher::skipped() const {
+    return m_skipped;
+}
+
+
+VolumeRamp::VolumeRamp(int level, int retries)
+    : m_level { level },
+      m_retries { retries }
+{
+}
+
+bool VolumeRamp::done() const {
+    return m_done;
+}
+
+/* Returns the failure which ended the ramp, or null if the volume is set. */
+std::exception_ptr VolumeRamp::error() const {
+    return m_error;
+}
+
+/* Takes the outcome of the command last returned by next().  A command
+ * whose deadline passed ends the ramp where it is.
+ */
+void VolumeRamp::feed(const std::string &reply, std::exception_ptr error) {
+    ++m_sent;
+
+    if ( std::string_view(error_class(error)) == "expired" ) {
+        finish(error);
+        return;
+    }
+
+    if ( m_steps != 0 ) {
+        // A step whose answer was lost was most likely taken, and the query
+        // at the end finds out.  A refusal or a failed port ends the round.
+        bool stop { error && std::string_view(error_class(error)) != "timeout" };
+        m_steps = stop ? 0 : m_steps - (m_steps > 0 ? 1 : -1);
+        return;
+    }
+
+    if ( error ) {
+        if ( m_retries-- <= 0 || ! retryable(error) ) {
+            finish(error);
+        }
+        return;
+    }
+
+    auto answer { decode(reply) };
+    if ( answer.key != Key::Volume || answer.value != Value::Number ) {
+        finish(std::make_exception_ptr(std::runtime_error(
+                "Unexpected volume reply '" + reply + "'.")));
+        return;
+    }
+    m_reply = reply;
+    if ( answer.number == m_level ) {
+        finish();
+        return;
+    }
+    if ( m_rounds > 0 && m_retries-- <= 0 ) {
+        finish(std::make_exception_ptr(ProjectorError(Refusal::Blocked,
+                "Volume stopped at " + std::to_string(answer.number) + ".")));
+        return;
+    }
+    ++m_rounds;
+    m_steps = m_level - answer.number;
+}
+
+void VolumeRamp::finish(std::exception_ptr error) {
+    m_error = error;
+    m_done = true;
+}
+
+/* Returns the command to send next, or an empty string once done. */
+std::string VolumeRamp::next() const {
+    if ( m_done ) {
+        return "";
+    } else if ( m_steps > 0 ) {
+        return "audio_vol_up";
+    } else if ( m_steps < 0 ) {
+        return "audio_vol_down";
+    }
+    return "query_audio_volume";
+}
+
+/* Returns the latest volume reply, e.g. "VOL=12", or an empty string. */
+const std::string &VolumeRamp::reply() const {
+    return m_reply;
+}
+
+/* Returns the frames sent so far. */
+int VolumeRamp::sent() const {
+    return m_sent;
+}
+
+
+/* Returns how the exchange which ended in `error`, or null, bears on the
+ * pace of its link.
+ */
+Outcome outcome(const std::exception_ptr &error) {
+    if ( ! error ) {
+        return Outcome::Answered;
+    }
+    try {
+        std::rethrow_exception(error);
+    } catch ( const ProjectorError &e ) {
+        return e.refusal() == Refusal::Blocked ? Outcome::Refused : Outcome::Answered;
+    } catch ( ... ) {
+    }
+    return Outcome::Lost;
+}
+
+
+/* Returns true if the failure in `error` might clear on its own, so the
+ * command is worth sending again: a busy projector, a garbled command or a
+ * lost reply.
+ */
+bool retryable(const std::exception_ptr &error) {
+    try {
+        std::rethrow_exception(error);
+    } catch ( const ProjectorError &e ) {
+        return e.refusal() != Refusal::Unsupported;
+    } catch ( const std::system_error &e ) {
+        return e.code() == std::errc::timed_out;
+    } catch ( ... ) {
+    }
+    return false;
+}
+
+
+/* Returns the Deadline given as `text` on the command line: a local time of
+ * day, "HH:MM" or "HH:MM:SS", today, or a number of milliseconds from now.
+ * An empty `text` is NO_DEADLINE.
+ *
+ * Throws `std::runtime_error` for anything else.
+ */
+Deadline parse_deadline(const std::string &text) {
+    auto bad { std::runtime_error("Bad deadline '" + text + "'.") };
+    if ( text.empty() ) {
+        return NO_DEADLINE;
+    }
+
+    if ( text.find(':') == std::string::npos ) {
+        if ( text.find_first_not_of("0123456789") != std::string::npos || text.size() > 9 ) {
+            throw bad;
+        }
+        return std::chrono::steady_clock::now() + std::chrono::milliseconds(std::stol(text));
+    }
+
+    std::istringstream in { text };
+    int hour { -1 }, minute { -1 }, second { 0 };
+    char colon { 0 }, again { ':' };
+    in >> hour >> colon >> minute;
+    if ( in && ! in.eof() ) {
+        in >> again >> second;
+    }
+    if ( ! in || ! in.eof() || colon != ':' || again != ':'
+            || hour < 0 || hour > 23 || minute < 0 || minute > 59
+            || second < 0 || second > 59 ) {
+        throw bad;
+    }
+
+    auto now { std::time(nullptr) };
+    std::tm when {};
+    localtime_r(&now, &when);
+    when.tm_hour = hour;
+    when.tm_min = minute;
+    when.tm_sec = second;
+    when.tm_isdst = -1;
+    return deadline_at(std::chrono::seconds(std::mktime(&when)));
+}
+
+
+/* Returns the projector's answer to `cmd`, skipping whatever else arrives
+ * first (see ReplyMatcher).
+ *
+ * Throws `std::system_error` if the serial port fails or no answer arrives
+ * within RESPONSE_TIMEOUT milliseconds, or deadline_error() if `deadline`
+ * comes first.
+ *
+ * Throws `ProjectorError` for various errors and warnings reported by the
+ * projector.
+ */
+const std::string recv(Lineal &device, const std::string &cmd, Deadline deadline) {
+    ReplyMatcher matcher { command_message(cmd) };
+
+    auto timeout { std::chrono::steady_clock::now()
+                   + std::chrono::milliseconds(RESPONSE_TIMEOUT) };
+
+    while ( true ) {
+        auto line { device.readUntil(CR, std::min(timeout, deadline)) };
+        if ( line.empty() ) {
+            resynchronize(device, matcher, true);
+            if ( deadline < timeout ) {
+                throw deadline_error();
+            }
+            throw silence_error(matcher);
+        }
+        if ( auto answer { matcher.feed(line) }; ! answer.empty() ) {
+            resynchronize(device, matcher, false);
+            return unframe(answer);
+        }
+    }
+}
+
+/* Counts the frames `matcher` passed over against `device`, and discards
+ * its input if the exchange `failed` after passing over RESYNC_SKIPS or
+ * more, so the next exchange starts on a clean line.
+ */
+void resynchronize(Lineal &device, const ReplyMatcher &matcher, bool failed) {
+    device.skip(matcher.skipped());
+    if ( failed && matcher.skipped() >= RESYNC_SKIPS ) {
+        device.discard();
+    }
+}
+
+
+/* Returns the error for a projector which did not answer the command
+ * `matcher` follows, telling whether it at least echoed the command.
+ */
+std::system_error silence_error(const ReplyMatcher &matcher) {
+    return std::system_error(std::make_error_code(std::errc::timed_out),
+                             matcher.echoed() ? "Projector echoed but did not answer."
+                                              : "No reply from projector.");
+}
+
+/* Sends a message to the projector and returns the quantity of sent bytes.
+ *
+ * Throws `std::out_of_range` if `cmd` is not a command (see command_message).
+ */
+std::size_t send(Lineal &device, const std::string cmd) {
+    const std::string msg { frame(cmd) };
+
+    auto ret { device.write(msg.c_str(), msg.length()) };
+    if ( ret < 0 ) {
+        throw std::system_error(std::error_code(errno, std::system_category()),
+                                "Fatal error while writing to projector.");
+    }
+
+    return ret;
+}
+
+
+/* Returns the outcome of sending `cmd` and reading its reply, retrying up to
+ * `retries` more times while the failure is retryable().  Each attempt waits
+ * for the pace of `device` (see Pacer) and is recorded there.  A command
+ * not answered before `deadline` ends with deadline_error(), and no attempt
+ * is started once the pace would hold it past then.
+ *
+ * "audio_vol_set=N" runs a VolumeRamp instead, with `Result.attempts`
+ * counting every frame it sent.
+ *
+ * Failures are returned in `Result.error`, never thrown.
+ */
+Result transact(Lineal &device, const std::string &cmd, int retries, Deadline deadline) {
+    if ( auto level { volume_level(cmd) } ) {
+        return set_volume(device, cmd, *level, retries, deadline);
+    }
+
+    Result result { device.name(), cmd };
+    if ( is_volume_set(cmd) ) {
+        // Nothing is sent for a level the projector cannot be set to.
+        result.error = std::make_exception_ptr(volume_error());
+        return result;
+    }
+    auto start { std::chrono::steady_clock::now() };
+
+    while ( true ) {
+        // Nothing is sent which could not be answered in time.
+        if ( std::max(device.pacer().ready(), std::chrono::steady_clock::now()) >= deadline ) {
+            result.reply.clear();
+            result.error = std::make_exception_ptr(deadline_error());
+            break;
+        }
+        ++result.attempts;
+        device.pacer().wait();
+        auto sent { std::chrono::steady_clock::now() };
+        try {
+            send(device, cmd);
+            result.reply = recv(device, cmd, deadline);
+            result.error = nullptr;
+        } catch ( ... ) {
+            result.error = std::current_exception();
+        }
+        device.pacer().record(std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - sent), outcome(result.error));
+        if ( ! result.error ) {
+            break;
+        }
+        if ( result.attempts > retries || ! retryable(result.error) ) {
+            break;
+        }
+    }
+
+    result.latency = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start);
+    return result;
+}
+
+
+/* Returns the error for an "audio_vol_set=N" whose N is not a level from 0
+ * to VOLUME_MAX, classed "illegal" (see error_class).
+ */
+std::invalid_argument volume_error() {
+    return std::invalid_argument("Volume level must be from 0 to " + std::to_string(VOLUME_MAX)
+                                 + '.');
+}
+
+/* Returns the level `cmd` sets the volume to, for "audio_vol_set=N" with N
+ * from 0 to VOLUME_MAX, or nothing for any other command.
+ */
+std::optional<int> volume_level(const std::string &cmd) {
+    auto prefix { VOLUME_SET + '=' };
+    if ( cmd.size() <= prefix.size() || cmd.size() > prefix.size() + 2
+            || cmd.compare(0, prefix.size(), prefix) != 0 ) {
+        return std::nullopt;
+    }
+    int level { 0 };
+    for ( auto c : cmd.substr(prefix.size()) ) {
+        if ( c < '0' || c > '9' ) {
+            return std::nullopt;
+        }
+        level = level * 10 + (c - '0');
+    }
+    if ( level > VOLUME_MAX ) {
+        return std::nullopt;
+    }
+    return level;
+}
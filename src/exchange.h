@@ -0,0 +1,211 @@
+/*
+    exchange.h - command and reply exchange with a BenQ projector
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#ifndef EXCHANGE_H
+#define EXCHANGE_H true
+
+#include "decode.h"
+#include "lineal.h"
+#include "pacer.h"
+
+#include <chrono>
+#include <exception>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+
+/* Time, in milliseconds, to wait for a complete reply before giving up.
+ *
+ * A projector normally answers within a second.  A serial port which stays
+ * silent much longer than that has likely been unplugged.
+ */
+constexpr int RESPONSE_TIMEOUT { 5000 };
+
+/* Frames a failed exchange may pass over before the port's input is
+ * discarded (see resynchronize).  A few are stragglers, which the next
+ * exchange skips in turn; more mean a line full of junk, better dropped
+ * than read through again.
+ */
+constexpr int RESYNC_SKIPS { 4 };
+
+/* Command setting an absolute volume, written "audio_vol_set=N". */
+inline const std::string VOLUME_SET { "audio_vol_set" };
+
+
+/* The time after which nobody wants a command's result any more.  A command
+ * still waiting then is dropped, and one in flight stops waiting for its
+ * reply, with a deadline_error() ("expired" from error_class).
+ */
+using Deadline = std::chrono::steady_clock::time_point;
+
+/* The Deadline of a command wanted however long it takes. */
+constexpr Deadline NO_DEADLINE { Deadline::max() };
+
+
+/* Thrown when the projector answers a command with a refusal. */
+class ProjectorError : public std::runtime_error {
+
+    private:
+
+        Refusal m_refusal;
+
+    public:
+
+        ProjectorError(Refusal refusal, const std::string &what)
+            : std::runtime_error { what }, m_refusal { refusal } {}
+
+        Refusal refusal() const {
+            return m_refusal;
+        }
+
+};
+
+
+/* Picks the projector's answer to one command out of the lines received.
+ *
+ * The projector echoes each command and then answers it, every frame
+ * closed by "#" CR.  Lines which hold no intact frame (line noise, damaged
+ * or truncated frames) are skipped, as are frames left over from earlier
+ * exchanges, so the stream resynchronizes without flushing the port.
+ */
+class ReplyMatcher {
+
+    private:
+
+        /* The message sent, e.g. "pow=?", without framing. */
+        std::string m_sent;
+        Reply m_command;
+
+        /* Our echo has arrived, so the next matching frame answers us. */
+        bool m_echoed { false };
+
+        /* Frames passed over as stale or mismatched. */
+        int m_skipped { 0 };
+
+        bool answers(const Reply &reply) const;
+
+    public:
+
+        explicit ReplyMatcher(std::string_view message);
+
+        bool echoed() const;
+        std::string_view feed(std::string_view line);
+        int skipped() const;
+
+};
+
+
+/* Steps the volume to an absolute level with the only volume commands the
+ * projector has: a query and single steps up and down.
+ *
+ * The level is read once, the steps between it and the target are sent one
+ * after another, each as soon as the last is answered, and a final query
+ * checks the result.  Steps are never retried, since a step whose answer was
+ * lost was most likely taken; instead a level off the target is stepped
+ * again from where it stopped, up to `retries` more times.
+ *
+ * The ramp only picks commands: call next() for the command to send and
+ * feed() with its outcome until done().
+ */
+class VolumeRamp {
+
+    private:
+
+        int m_level;
+        int m_retries;
+
+        /* Steps left to send this round, negative for steps down; zero
+         * while a query is due.
+         */
+        int m_steps { 0 };
+
+        /* Rounds of steps sent so far. */
+        int m_rounds { 0 };
+
+        int m_sent { 0 };
+        bool m_done { false };
+
+        /* The latest volume reply, e.g. "VOL=12". */
+        std::string m_reply;
+        std::exception_ptr m_error;
+
+        void finish(std::exception_ptr error = nullptr);
+
+    public:
+
+        VolumeRamp(int level, int retries);
+
+        bool done() const;
+        std::exception_ptr error() const;
+        void feed(const std::string &reply, std::exception_ptr error);
+        std::string next() const;
+        const std::string &reply() const;
+        int sent() const;
+
+};
+
+
+/* Outcome of running one command on one port. */
+struct Result {
+    std::string port;
+    std::string cmd;
+    // projector reply, e.g. "POW=ON", empty on error
+    std::string reply;
+    // null on success
+    std::exception_ptr error;
+    int attempts { 0 };
+    // from the first send to the last reply or failure
+    std::chrono::microseconds latency { 0 };
+
+    /* Returns the typed content of `reply`, valid while `reply` is. */
+    Reply decoded() const {
+        return decode(reply);
+    }
+};
+
+
+std::string command_message(const std::string &cmd);
+Deadline deadline_at(std::chrono::milliseconds unix_time);
+std::system_error deadline_error();
+const char *error_class(const std::exception_ptr &error);
+std::string frame(const std::string &cmd);
+Outcome outcome(const std::exception_ptr &error);
+std::string_view frame_of(std::string_view line);
+bool is_query_command(const std::string &cmd);
+bool is_volume_set(const std::string &cmd);
+Deadline parse_deadline(const std::string &text);
+const std::string recv(Lineal &device, const std::string &cmd,
+                       Deadline deadline = NO_DEADLINE);
+void resynchronize(Lineal &device, const ReplyMatcher &matcher, bool failed);
+bool retryable(const std::exception_ptr &error);
+std::size_t send(Lineal &device, const std::string cmd);
+std::system_error silence_error(const ReplyMatcher &matcher);
+Result transact(Lineal &device, const std::string &cmd, int retries = 0,
+                Deadline deadline = NO_DEADLINE);
+std::string unframe(std::string_view frame);
+std::invalid_argument volume_error();
+std::optional<int> volume_level(const std::string &cmd);
+
+
+#endif
@@ -20,8 +20,14 @@
 
 #include "bewield.h"
 #include "lineal.h"
+#include "trace.h"
 
+#include "argparse.hpp"
+
+#include <algorithm>
+#include <chrono>
 #include <iostream>
+#include <iterator>
 #include <map>
 #include <memory>
 #include <random>
@@ -29,6 +35,7 @@
 #include <termios.h>
 #include <thread>
 #include <utility>
+#include <vector>
 
 
 /* Map UI protocol command message to response message. */
@@ -65,32 +72,74 @@ std::map<const std::string, const std::string> responses {
 };
 
 
+/* Ways to damage replies, to exercise bewield's recovery from a bad line.
+ *
+ * Each rate is a probability from 0 to 1.
+ */
+struct Faults {
+    // split replies into random chunks sent with random delays
+    bool chunking { true };
+    // chance each byte is lost
+    double drop { 0.0 };
+    // chance each byte has one bit flipped
+    double corrupt { 0.0 };
+    // chance of line noise ahead of each chunk
+    double garbage { 0.0 };
+    // chance a reply is cut short
+    double truncate { 0.0 };
+    // chance a reply goes silent partway for `stall_ms`
+    double stall { 0.0 };
+    int stall_ms { 2000 };
+    // refuse commands sent sooner than this after the last reply
+    int min_gap_ms { 0 };
+};
+
+/* Named sets of Faults, chosen with --profile. */
+const std::map<const std::string, const Faults> profiles {
+    // replies arrive whole and intact
+    std::make_pair("clean", Faults { false }),
+    // the historical behavior: chunked and delayed, otherwise intact
+    std::make_pair("chunked", Faults {}),
+    // noise between frames and the odd flipped bit
+    std::make_pair("noisy", Faults { true, 0.0, 0.005, 0.2 }),
+    // lost bytes and replies cut short
+    std::make_pair("lossy", Faults { true, 0.01, 0.0, 0.0, 0.1 }),
+    // replies which stop partway for longer than bewield waits
+    std::make_pair("stalling", Faults { true, 0.0, 0.0, 0.0, 0.0, 0.2, 6000 }),
+    // everything at once
+    std::make_pair("hostile", Faults { true, 0.01, 0.005, 0.2, 0.1, 0.1, 6000 }),
+};
+
+
 /* Constants to change runtime behavior. */
 constexpr bool debug { false };
-const std::string port { "port_b" };
+
+/* Source of every random choice, seeded with --seed for repeatable runs. */
+std::mt19937 random_source;
+
+
+/* Returns true with probability `rate`. */
+bool chance(double rate) {
+    return rate > 0.0 && std::bernoulli_distribution { rate }(random_source);
+}
 
 
-/* Returns the full protocol string received.
+/* Returns the next command message received, e.g. "pow=?".
  *
  * Because recv is reading a virtual serial port, it does not do any error
- * handling, including for incomplete messages.
+ * handling beyond skipping bytes outside of a frame.
 */
 const std::string recv(Lineal &device) {
-    char buffer[ 32 ];
-
-    auto ret { device.readBytes(buffer, sizeof(buffer)) };
-
-    if ( ret < 0 ) {
-        std::cout << "Read failed for response" << std::endl;
-        throw std::runtime_error("Fatal error while reading from bewield.");
+    std::string_view frame;
+    while ( frame.empty() ) {
+        frame = device.readFrame(PREFIX.front(), SUFFIX.back(),
+                                 std::chrono::steady_clock::now() + std::chrono::seconds(1));
     }
-    if ( debug && (ret > 0) ) {
-        std::cout << "read " << ret << " bytes" << std::endl;
-        std::string msg { buffer };
-        std::cout << cook(msg) << std::endl;
+    if ( debug ) {
+        std::cout << "read " << cook(std::string(frame)) << std::endl;
     }
 
-    return std::string(buffer);
+    return std::string(frame.substr(1, frame.size() - 2));
 }
 
 
@@ -98,31 +147,63 @@ const std::string recv(Lineal &device) {
  * quantity of sent bytes.
  *
  * To simulate a noisy serial line, send "transmits" partial random-length
- * messages with random delays between "packets".
+ * messages with random delays between "packets", and damages the message
+ * as set in `faults`.
  */
-std::size_t send(Lineal &device, const std::string response) {
+std::size_t send(Lineal &device, std::string response, const Faults &faults) {
 
-    // Random seed source
-    std::random_device rd;
-    // Random number generator
-    std::mt19937 gen(rd());
     // Functions returning random ints in different ranges.
     std::uniform_int_distribution<> random_delay { 20, 500 };
     std::uniform_int_distribution<> random_size { 1, 20 };
+    std::uniform_int_distribution<> random_byte { 0, 255 };
+    std::uniform_int_distribution<> random_bit { 0, 7 };
+
+    if ( response.length() > 1 && chance(faults.truncate) ) {
+        std::uniform_int_distribution<std::size_t> random_cut { 1, response.length() - 1 };
+        response.resize(random_cut(random_source));
+    }
+    auto stall_at { response.length() };
+    if ( chance(faults.stall) ) {
+        std::uniform_int_distribution<std::size_t> random_stall { 0, response.length() - 1 };
+        stall_at = random_stall(random_source);
+    }
 
     std::size_t bytes_sent { 0 };
     std::size_t start { 0 };
 
     while ( start < response.length() ) {
-        std::chrono::duration<int, std::milli> delay { random_delay(gen) };
-        std::this_thread::sleep_for(delay);
-        if ( debug ) {
-            std::cout << "delayed: " << delay.count() << " ms" << std::endl;
+        std::size_t length { response.length() };
+        if ( faults.chunking ) {
+            std::chrono::duration<int, std::milli> delay { random_delay(random_source) };
+            std::this_thread::sleep_for(delay);
+            if ( debug ) {
+                std::cout << "delayed: " << delay.count() << " ms" << std::endl;
+            }
+            length = random_size(random_source);
+        }
+        if ( start <= stall_at && stall_at < start + length ) {
+            // Go silent partway through this chunk.
+            length = std::max<std::size_t>(stall_at - start, 1);
+            stall_at = response.length();
+            std::this_thread::sleep_for(std::chrono::milliseconds(faults.stall_ms));
         }
 
-        auto random_length { random_size(gen) };
-        auto partial_msg { response.substr(start, random_length) };
-        start += random_length;
+        std::string partial_msg;
+        if ( chance(faults.garbage) ) {
+            for ( auto noise { random_size(random_source) / 4 + 1 }; noise > 0; --noise ) {
+                partial_msg += static_cast<char>(random_byte(random_source));
+            }
+        }
+        for ( auto c : response.substr(start, length) ) {
+            if ( chance(faults.drop) ) {
+                continue;
+            }
+            if ( chance(faults.corrupt) ) {
+                c ^= 1 << random_bit(random_source);
+            }
+            partial_msg += c;
+        }
+        start += length;
 
         auto ret { device.write(partial_msg.c_str(), partial_msg.length()) };
         if ( ret < 0 ) {
@@ -141,11 +222,197 @@ std::size_t send(Lineal &device, const std::string response) {
 }
 
 
+/* Answers bewield with the projector side of the port named `port_name` in
+ * `capture` (from `bewield --capture`), reproducing it byte for byte.
+ *
+ * Each command recorded as sent waits for bewield to send a command, and
+ * the bytes recorded as received then follow with their original spacing,
+ * divided by `speed`.  A `speed` of 0 sends them without delay.
+ *
+ * Returns the exit status once the capture is exhausted.
+ */
+int replay(Lineal &device, const TraceReader &capture, const std::string &port_name,
+           double speed) {
+    uint16_t port { TRACE_UNNAMED };
+    for ( uint16_t i { 0 }; i < capture.header().ports; ++i ) {
+        if ( port_name.empty() || capture.port(i) == port_name ) {
+            port = i;
+            break;
+        }
+    }
+    if ( port == TRACE_UNNAMED ) {
+        std::cout << "No port '" << port_name << "' in capture." << std::endl;
+        return EINVAL;
+    }
+
+    auto records { capture.records() };
+    auto count { capture.size() };
+    // Recorded time matching the live time `live`; replies are paced from it.
+    auto recorded { capture.header().start };
+    auto live { std::chrono::steady_clock::now() };
+
+    std::size_t i { 0 };
+    while ( i < count ) {
+        const auto &record { records[i] };
+        if ( record.port != port ) {
+            ++i;
+            continue;
+        }
+
+        // Every record up to the next of the other direction.
+        std::string bytes;
+        auto time { record.time };
+        for ( ; i < count; ++i ) {
+            if ( records[i].port != port ) {
+                continue;
+            }
+            if ( records[i].direction != record.direction
+                 || (record.direction == TraceDirection::Read && records[i].time != time) ) {
+                break;
+            }
+            bytes.append(records[i].bytes, std::min<std::size_t>(records[i].length, TRACE_CHUNK));
+            time = records[i].time;
+        }
+
+        if ( record.direction == TraceDirection::Write ) {
+            auto cmd { recv(device) };
+            if ( bytes.find(PREFIX + cmd + SUFFIX) == std::string::npos ) {
+                std::cout << "replay expected '" << cook(bytes)
+                          << "' but got '" << cmd << "'" << std::endl;
+            }
+            recorded = time;
+            live = std::chrono::steady_clock::now();
+            continue;
+        }
+
+        if ( speed > 0.0 ) {
+            std::chrono::duration<double, std::nano> gap { (time - recorded) / speed };
+            std::this_thread::sleep_until(
+                    live + std::chrono::duration_cast<std::chrono::nanoseconds>(gap));
+        }
+        if ( device.write(bytes.c_str(), bytes.length()) < 0 ) {
+            throw std::runtime_error("Fatal error while writing to bewield.");
+        }
+        if ( debug ) {
+            std::cout << "replayed " << cook(bytes) << std::endl;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+
+/* Returns the chance given as `name` in `program`, or `fallback` if none
+ * was.
+ *
+ * Throws `std::runtime_error` for a chance outside 0 to 1.
+ */
+double chance_arg(const argparse::ArgumentParser &program, const std::string &name,
+                  double fallback) {
+    auto rate { program.present<double>(name).value_or(fallback) };
+    if ( ! (rate >= 0.0 && rate <= 1.0) ) {
+        throw std::runtime_error("Give " + name + " as a chance from 0 to 1.");
+    }
+    return rate;
+}
+
+/* Returns an ArgumentParser object created from command line arguments. */
+argparse::ArgumentParser read_args(const std::vector<std::string> arguments) {
+    argparse::ArgumentParser program { "fake_proj" };
+
+    program.add_argument("-p", "--port")
+        .help("serial port to answer on")
+        .default_value(std::string { "port_b" });
+
+    program.add_argument("--profile")
+        .help("fault profile: clean, chunked, noisy, lossy, stalling or hostile")
+        .default_value(std::string { "chunked" });
+
+    program.add_argument("--replay")
+        .help("answer with the projector side of a bewield --capture file")
+        .default_value(std::string {});
+
+    program.add_argument("--replay-port")
+        .help("captured port to replay, instead of the first")
+        .default_value(std::string {});
+
+    program.add_argument("--speed")
+        .help("replay timing divisor, 0 to send without delay")
+        .default_value(1.0)
+        .scan<'g', double>();
+
+    program.add_argument("--seed")
+        .help("seed for random faults, 0 for a different run each time")
+        .default_value(0)
+        .scan<'i', int>();
+
+    program.add_argument("--drop")
+        .help("chance each reply byte is lost")
+        .scan<'g', double>();
+
+    program.add_argument("--corrupt")
+        .help("chance each reply byte has a bit flipped")
+        .scan<'g', double>();
+
+    program.add_argument("--garbage")
+        .help("chance of line noise ahead of each chunk")
+        .scan<'g', double>();
+
+    program.add_argument("--truncate")
+        .help("chance a reply is cut short")
+        .scan<'g', double>();
+
+    program.add_argument("--stall")
+        .help("chance a reply goes silent partway")
+        .scan<'g', double>();
+
+    program.add_argument("--stall-ms")
+        .help("milliseconds a stalled reply stays silent")
+        .scan<'i', int>();
+
+    program.add_argument("--min-gap")
+        .help("milliseconds after a reply during which commands get \"Block item\"")
+        .scan<'i', int>();
+
+    program.parse_args(arguments);
+
+    return program;
+}
+
+
 int main(int argc, const char* argv[]) {
+    argparse::ArgumentParser program;
+    Faults faults;
+    try {
+        std::vector<std::string> args;
+        std::copy(argv, argv + argc, std::back_inserter(args));
+
+        program = read_args(args);
+        faults = profiles.at(program.get("--profile"));
+
+        // Single faults given on the command line override the profile.
+        faults.drop = chance_arg(program, "--drop", faults.drop);
+        faults.corrupt = chance_arg(program, "--corrupt", faults.corrupt);
+        faults.garbage = chance_arg(program, "--garbage", faults.garbage);
+        faults.truncate = chance_arg(program, "--truncate", faults.truncate);
+        faults.stall = chance_arg(program, "--stall", faults.stall);
+    } catch ( const std::out_of_range &e ) {
+        std::cout << "Unknown fault profile '" << program.get("--profile") << "'." << std::endl;
+        return EINVAL;
+    } catch ( const std::runtime_error &e ) {
+        std::cout << e.what() << std::endl;
+        return EINVAL;
+    }
+
+    faults.stall_ms = program.present<int>("--stall-ms").value_or(faults.stall_ms);
+    faults.min_gap_ms = program.present<int>("--min-gap").value_or(faults.min_gap_ms);
+
+    auto seed { program.get<int>("--seed") };
+    random_source.seed(seed != 0 ? seed : std::random_device {}());
 
     std::unique_ptr<Lineal> serial;
     try {
-        serial = std::make_unique<Lineal>(port);
+        serial = std::make_unique<Lineal>(program.get("--port"));
     } catch ( const std::system_error &e ) {
         std::cout << e.what() << std::endl;
         return EINVAL;
@@ -154,31 +421,54 @@ int main(int argc, const char* argv[]) {
     // Flush erroneous, pending IO before continuing.
     tcflush(serial->fd(), TCIOFLUSH);
 
+    if ( auto arg_replay { program.get("--replay") }; ! arg_replay.empty() ) {
+        try {
+            TraceReader capture { arg_replay };
+            return replay(*serial, capture, program.get("--replay-port"),
+                          program.get<double>("--speed"));
+        } catch ( const std::runtime_error &e ) {
+            std::cout << e.what() << std::endl;
+            return EINVAL;
+        }
+    }
+
+    // Volume steps change what "vol=?" answers.
+    int volume { 0 };
+
+    // A projector still busy with the last command refuses the next.
+    auto idle { std::chrono::steady_clock::now() };
+
     while ( true ) {
-        std::string cmd { recv(*serial) };
-        auto start { cmd.rfind(PREFIX, std::string::npos) + 1 };
-        auto end { cmd.rfind(SUFFIX, std::string::npos) };
-        std::string cooked_cmd { cmd.substr(start, end-start) };
+        std::string cooked_cmd { recv(*serial) };
+        bool busy { std::chrono::steady_clock::now() < idle };
 
         if ( debug ) {
             std::cout << "cooked_cmd: " << cooked_cmd << std::endl;
         }
 
-        std::string response;
+        std::string answer;
         try {
-            response = "  >*" + cooked_cmd + "#\r\r*" + responses.at(cooked_cmd) + "#\r";
-            if ( debug ) {
-                std::cout << "response: " << cook(response) << std::endl;
-            }
+            answer = responses.at(cooked_cmd);
         } catch ( const std::out_of_range &e ) {
             continue;
         }
+        if ( busy ) {
+            answer = "Block item";
+        } else if ( cooked_cmd == "vol=+" ) {
+            volume = std::min(volume + 1, VOLUME_MAX);
+        } else if ( cooked_cmd == "vol=-" ) {
+            volume = std::max(volume - 1, 0);
+        } else if ( cooked_cmd == "vol=?" ) {
+            answer = "VOL=" + std::to_string(volume);
+        }
 
-        if ( ! cmd.empty() ) {
-            if ( send(*serial, response) < response.length() ) {
-                throw std::runtime_error("Fake response not fully sent.");
-            }
+        std::string response { "  >*" + cooked_cmd + "#\r\r*" + answer + "#\r" };
+        if ( debug ) {
+            std::cout << "response: " << cook(response) << std::endl;
         }
+
+        send(*serial, response, faults);
+        idle = std::chrono::steady_clock::now() + std::chrono::milliseconds(faults.min_gap_ms);
     }
 
     return EXIT_SUCCESS;
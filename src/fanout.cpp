@@ -0,0 +1,169 @@
+/*
+    fanout.cpp - one command run on many ports at once
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include "fanout.h"
+#include "exchange.h"
+
+#include <algorithm>
+
+
+FanOut::FanOut(PortManager &ports, int concurrency, int stagger_ms, int retries,
+               Deadline deadline)
+    : m_ports { ports },
+      m_concurrency { std::max(concurrency, 1) },
+      m_stagger { std::max(stagger_ms, 0) },
+      m_retries { retries },
+      m_deadline { deadline }
+{
+}
+
+/* Starts ready commands, one per port, on up to `m_concurrency` ports and
+ * no faster than one per `m_stagger`, taking ports in turn.
+ */
+void FanOut::dispatch(const PortManager::Completion &done) {
+    auto it { m_ready.upper_bound(m_cursor) };
+    for ( auto remaining { m_ready.size() }; remaining > 0 && m_running < m_concurrency;
+          --remaining ) {
+        auto now { std::chrono::steady_clock::now() };
+        if ( now < m_next_start ) {
+            return;
+        }
+        if ( it == m_ready.end() ) {
+            it = m_ready.begin();
+        }
+        auto &[port, queue] { *it };
+        if ( ! m_ports.connected(port) || m_ports.pending(port) > 0 ) {
+            ++it;
+            continue;
+        }
+
+        m_cursor = port;
+        m_next_start = now + m_stagger;
+        ++m_running;
+        m_ports.submit(port, queue.front(),
+            [this, &done](const Result &result) {
+                --m_running;
+                done(result);
+            }, m_retries, m_deadline);
+        queue.pop_front();
+        it = queue.empty() ? m_ready.erase(it) : std::next(it);
+    }
+}
+
+/* Completes every command left for `port` with `error`. */
+void FanOut::fail(const std::string &port, std::exception_ptr error,
+                  const PortManager::Completion &done) {
+    m_ports.abandon(port, error);
+    auto it { m_ready.find(port) };
+    if ( it == m_ready.end() ) {
+        return;
+    }
+    auto queue { std::move(it->second) };
+    m_ready.erase(it);
+    for ( const auto &cmd : queue ) {
+        Result result { port, cmd };
+        result.error = error;
+        done(result);
+    }
+}
+
+/* Runs `tasks` and calls `done` with each result as it completes.  Returns
+ * once every task has completed.
+ */
+void FanOut::run(const std::vector<Task> &tasks, const PortManager::Completion &done) {
+    auto remaining { tasks.size() };
+    PortManager::Completion finish { [&remaining, &done](const Result &result) {
+        --remaining;
+        done(result);
+    } };
+
+    for ( const auto &task : tasks ) {
+        m_targets.insert(task.port);
+        m_ports.add(task.port);
+        m_ready[task.port].push_back(task.cmd);
+    }
+    for ( auto it { m_ready.begin() }; it != m_ready.end(); ) {
+        auto port { (it++)->first };
+        if ( ! m_ports.connected(port) ) {
+            fail(port, open_error(port), finish);
+        }
+    }
+
+    m_next_start = std::chrono::steady_clock::now();
+    while ( remaining > 0 ) {
+        dispatch(finish);
+        m_ports.update(timeout());
+        watch(finish);
+    }
+}
+
+/* Returns the milliseconds until a command may start or a lost port gives
+ * up, or -1 if only the PortManager has anything due.
+ */
+int FanOut::timeout() const {
+    using clock = std::chrono::steady_clock;
+    auto next { clock::time_point::max() };
+    if ( m_running < m_concurrency && ! m_ready.empty() ) {
+        next = m_next_start;
+    }
+    for ( const auto &[_unused, since] : m_lost ) {
+        next = std::min(next, since + std::chrono::milliseconds(RESPONSE_TIMEOUT));
+    }
+    if ( ! m_ready.empty() ) {
+        next = std::min(next, m_deadline);
+    }
+
+    if ( next == clock::time_point::max() ) {
+        return -1;
+    }
+    auto now { clock::now() };
+    if ( next <= now ) {
+        return 0;
+    }
+    return std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count() + 1;
+}
+
+/* Notes ports which closed with commands outstanding, and fails those
+ * closed for longer than RESPONSE_TIMEOUT.  Once the deadline has passed,
+ * fails every command not yet started.
+ */
+void FanOut::watch(const PortManager::Completion &done) {
+    auto now { std::chrono::steady_clock::now() };
+    if ( now >= m_deadline ) {
+        for ( auto it { m_ready.begin() }; it != m_ready.end(); ) {
+            auto port { (it++)->first };
+            fail(port, std::make_exception_ptr(deadline_error()), done);
+        }
+    }
+
+    for ( const auto &port : m_targets ) {
+        bool outstanding { m_ready.count(port) > 0 || m_ports.pending(port) > 0 };
+        if ( ! outstanding || m_ports.connected(port) ) {
+            m_lost.erase(port);
+            continue;
+        }
+        auto since { m_lost.emplace(port, now).first->second };
+        if ( now - since >= std::chrono::milliseconds(RESPONSE_TIMEOUT) ) {
+            m_lost.erase(port);
+            fail(port, open_error(port), done);
+        }
+    }
+}
@@ -0,0 +1,96 @@
+/*
+    fanout.h - one command run on many ports at once
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#ifndef FANOUT_H
+#define FANOUT_H true
+
+#include "portman.h"
+
+#include <chrono>
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+
+/* Default number of ports commands run on at once. */
+constexpr int FANOUT_CONCURRENCY { 8 };
+
+
+/* A command to run on a serial port. */
+struct Task {
+    std::string port;
+    std::string cmd;
+};
+
+
+/* Runs Tasks on many ports at once through a PortManager.
+ *
+ * Each port runs its Tasks in order, one at a time.  At most `concurrency`
+ * ports have a command in flight, and successive commands start at least
+ * `stagger` apart, e.g. so a room full of lamps does not strike at once.
+ * A port which is missing, or goes missing for longer than a reply may
+ * take, fails its remaining Tasks, and every Task left when the run's
+ * deadline passes is dropped (see Deadline).
+ */
+class FanOut {
+
+    private:
+
+        PortManager &m_ports;
+        int m_concurrency;
+        std::chrono::milliseconds m_stagger;
+        int m_retries;
+        Deadline m_deadline;
+
+        /* Commands not yet started, keyed by port. */
+        std::map<std::string, std::deque<std::string>> m_ready;
+
+        /* The port most recently given a command, for round robin. */
+        std::string m_cursor;
+
+        /* Every port given a Task. */
+        std::set<std::string> m_targets;
+
+        /* Ports closed with commands outstanding, and since when. */
+        std::map<std::string, std::chrono::steady_clock::time_point> m_lost;
+
+        std::chrono::steady_clock::time_point m_next_start;
+        int m_running { 0 };
+
+        void dispatch(const PortManager::Completion &done);
+        void fail(const std::string &port, std::exception_ptr error,
+                  const PortManager::Completion &done);
+        int timeout() const;
+        void watch(const PortManager::Completion &done);
+
+    public:
+
+        FanOut(PortManager &ports, int concurrency = FANOUT_CONCURRENCY,
+               int stagger_ms = 0, int retries = 0, Deadline deadline = NO_DEADLINE);
+
+        void run(const std::vector<Task> &tasks, const PortManager::Completion &done);
+
+};
+
+
+#endif
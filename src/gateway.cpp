@@ -0,0 +1,275 @@
+/*
+    gateway.cpp - relay of framed commands from socket clients to one port
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include "gateway.h"
+#include "bewield.h"
+#include "decode.h"
+#include "listener.h"
+
+#include <cerrno>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <system_error>
+#include <unistd.h>
+
+
+/* A gateway listening on `address` (see listen_on), which passes each frame
+ * received to `submit`.
+ *
+ * Throws `std::runtime_error` for a malformed address, or
+ * `std::system_error` if it cannot be listened on.
+ */
+Gateway::Gateway(const std::string &address, Submit submit)
+    : m_listen { listen_on(address, "gateway") },
+      m_submit { std::move(submit) }
+{
+}
+
+Gateway::~Gateway() {
+    for ( const auto &[fd, _unused] : m_clients ) {
+        ::close(fd);
+    }
+    ::close(m_listen);
+}
+
+/* Accepts every pending connection, while there is room for them. */
+void Gateway::accept() {
+    while ( m_clients.size() < GATEWAY_MAX_CLIENTS ) {
+        auto fd { accept4(m_listen, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC) };
+        if ( fd < 0 ) {
+            return;
+        }
+        // Answers are written whole, so never hold them back.
+        int on { 1 };
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        m_clients[fd] = Client { ++m_serial, peer_name(fd) };
+    }
+}
+
+/* Sends the answer in `result` to connection `fd`, if it is still the
+ * connection numbered `serial`, and relays its next frame.
+ */
+void Gateway::answer(int fd, uint64_t serial, const Result &result) {
+    auto it { m_clients.find(fd) };
+    if ( it == m_clients.end() || it->second.serial != serial || ! it->second.waiting ) {
+        return;
+    }
+    auto &client { it->second };
+
+    bool answered { true };
+    auto refusal { Refusal::None };
+    if ( result.error ) {
+        try {
+            std::rethrow_exception(result.error);
+        } catch ( const ProjectorError &e ) {
+            refusal = e.refusal();
+        } catch ( const std::out_of_range &e ) {
+            // The projector refuses garbled frames the same way.
+            refusal = Refusal::Illegal;
+        } catch ( const std::system_error &e ) {
+            answered = e.code() == std::errc::resource_unavailable_try_again;
+            refusal = Refusal::Blocked;
+        } catch ( ... ) {
+            answered = false;
+        }
+    }
+    if ( answered ) {
+        auto reply { refusal == Refusal::None ? result.reply
+                     : std::string(spelling(REFUSAL_WORDS, refusal)) };
+        client.out += result.cmd + CR;
+        client.out += CR + PREFIX + reply + SUFFIX + CR;
+    }
+    client.waiting = false;
+
+    write(fd, client);
+    it = m_clients.find(fd);
+    if ( it != m_clients.end() && it->second.serial == serial && ! it->second.relaying ) {
+        relay(fd, it->second);
+    }
+}
+
+/* Returns the number of open connections. */
+std::size_t Gateway::clients() const {
+    return m_clients.size();
+}
+
+void Gateway::close(int fd) {
+    ::close(fd);
+    m_clients.erase(fd);
+}
+
+/* Appends the descriptors the gateway needs watched to `fds`.  Pass the same
+ * `fds`, after poll(), to process().
+ */
+void Gateway::prepare(std::vector<pollfd> &fds) {
+    if ( m_clients.size() < GATEWAY_MAX_CLIENTS ) {
+        fds.push_back(pollfd { m_listen, POLLIN, 0 });
+    }
+    for ( const auto &[fd, client] : m_clients ) {
+        short events { 0 };
+        if ( ! client.eof && client.frames.size() < GATEWAY_MAX_QUEUE ) {
+            events |= POLLIN;
+        }
+        if ( client.sent < client.out.size() ) {
+            events |= POLLOUT;
+        }
+        fds.push_back(pollfd { fd, events, 0 });
+    }
+}
+
+/* Handles the poll() results in `fds` for descriptors added by prepare().
+ *
+ * Descriptors in `fds` belonging to anyone else are ignored.
+ */
+void Gateway::process(const std::vector<pollfd> &fds) {
+    for ( const auto &pfd : fds ) {
+        if ( pfd.revents == 0 ) {
+            continue;
+        }
+        if ( pfd.fd == m_listen ) {
+            accept();
+            continue;
+        }
+        auto it { m_clients.find(pfd.fd) };
+        if ( it == m_clients.end() ) {
+            continue;
+        }
+        if ( pfd.revents & POLLOUT ) {
+            write(pfd.fd, it->second);
+            it = m_clients.find(pfd.fd);
+        }
+        if ( it != m_clients.end() && (pfd.revents & POLLIN) ) {
+            read(pfd.fd, it->second);
+            it = m_clients.find(pfd.fd);
+        } else if ( it != m_clients.end() && (pfd.revents & (POLLHUP | POLLERR)) ) {
+            // Nobody is left to answer.
+            close(pfd.fd);
+            continue;
+        }
+        if ( it != m_clients.end() ) {
+            relay(pfd.fd, it->second);
+        }
+    }
+}
+
+/* Reads what has arrived on connection `fd`, until the client has as many
+ * frames waiting as it may.
+ */
+void Gateway::read(int fd, Client &client) {
+    char buffer[ 4096 ];
+    ssize_t ret { 1 };
+    while ( client.frames.size() < GATEWAY_MAX_QUEUE
+            && (ret = recv(fd, buffer, sizeof(buffer), 0)) > 0 ) {
+        client.in.append(buffer, ret);
+        split(client);
+    }
+    if ( ret == 0 ) {
+        client.eof = true;
+    } else if ( ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR ) {
+        close(fd);
+    }
+}
+
+/* Passes the next frame of connection `fd` to the port, unless one is
+ * already there or the client has yet to take its last answer.  A client
+ * which has sent all it will is closed once its last answer is sent.
+ */
+void Gateway::relay(int fd, Client &client) {
+    auto serial { client.serial };
+    client.relaying = true;
+    while ( ! client.waiting && client.sent >= client.out.size() ) {
+        split(client);
+        if ( client.frames.empty() ) {
+            break;
+        }
+        auto cmd { std::move(client.frames.front()) };
+        client.frames.pop_front();
+        client.waiting = true;
+        m_submit(client.peer, cmd, [this, fd, serial](const Result &result) {
+            answer(fd, serial, result);
+        });
+        // An answer given at once may have closed the connection.
+        auto it { m_clients.find(fd) };
+        if ( it == m_clients.end() || it->second.serial != serial ) {
+            return;
+        }
+    }
+    client.relaying = false;
+
+    if ( client.eof && ! client.waiting && client.frames.empty()
+            && client.sent >= client.out.size() ) {
+        close(fd);
+    }
+}
+
+/* Moves whole frames from the bytes received from `client` to its frames
+ * waiting, dropping bytes between frames and anything too long to be one.
+ */
+void Gateway::split(Client &client) {
+    while ( client.frames.size() < GATEWAY_MAX_QUEUE ) {
+        auto start { client.in.find(PREFIX.front()) };
+        if ( start == std::string::npos ) {
+            client.in.clear();
+            return;
+        }
+        client.in.erase(0, start);
+
+        auto end { client.in.find(SUFFIX.back()) };
+        if ( end == std::string::npos ) {
+            if ( client.in.size() <= GATEWAY_MAX_FRAME + 1 ) {
+                return;
+            }
+            client.in.erase(0, client.in.find(PREFIX.front(), 1));
+            continue;
+        }
+
+        // A frame broken off by a fresh '*' starts again there.
+        start = client.in.rfind(PREFIX.front(), end);
+        auto length { end - start + 1 };
+        if ( length > 2 && length <= GATEWAY_MAX_FRAME + 2 ) {
+            client.frames.push_back(client.in.substr(start, length));
+        }
+        client.in.erase(0, end + 1);
+    }
+}
+
+/* Sends what it can of the output queued on connection `fd`. */
+void Gateway::write(int fd, Client &client) {
+    while ( client.sent < client.out.size() ) {
+        auto ret { send(fd, client.out.data() + client.sent, client.out.size() - client.sent,
+                        MSG_NOSIGNAL) };
+        if ( ret < 0 ) {
+            if ( errno == EAGAIN || errno == EWOULDBLOCK ) {
+                return;
+            }
+            if ( errno == EINTR ) {
+                continue;
+            }
+            close(fd);
+            return;
+        }
+        client.sent += ret;
+    }
+    client.out.clear();
+    client.sent = 0;
+}
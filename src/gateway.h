@@ -0,0 +1,121 @@
+/*
+    gateway.h - relay of framed commands from socket clients to one port
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#ifndef GATEWAY_H
+#define GATEWAY_H true
+
+#include "exchange.h"
+#include "portman.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <poll.h>
+#include <string>
+#include <vector>
+
+
+/* Most connections open at once.  Others wait in the listen backlog. */
+constexpr std::size_t GATEWAY_MAX_CLIENTS { 256 };
+
+/* Longest message relayed, between '*' and '#'. */
+constexpr std::size_t GATEWAY_MAX_FRAME { 64 };
+
+/* Most frames a client may have waiting.  A client with this many is not
+ * read from until some are answered, which holds it back through socket
+ * flow control instead of queueing without bound.
+ */
+constexpr std::size_t GATEWAY_MAX_QUEUE { 32 };
+
+
+/* Relays commands from socket clients, which speak the projector's own
+ * "*message#" framing, to one serial port, to embed in a poll loop with
+ * prepare() and process().
+ *
+ * Bytes outside frames are dropped, so clients may send CRs as they would
+ * to the projector.  Each client has at most one frame with the port at a
+ * time and waits its turn in the port's queue, so frames from different
+ * clients never interleave on the line and take turns round robin.  Each
+ * answer goes back to the client that asked, as the projector would send
+ * it: the echo of the frame, then the answer or refusal.  A command which
+ * gets no answer (a timeout or a lost port) gets none from the gateway
+ * either, and one turned away for load (see error_class) is refused with
+ * "Block item".
+ */
+class Gateway {
+
+    public:
+
+        /* Runs raw frame `cmd` (see command_message) from client `peer` (see
+         * peer_name) and calls `done`.
+         */
+        using Submit = std::function<void(const std::string &peer, const std::string &cmd,
+                                          PortManager::Completion done)>;
+
+    private:
+
+        struct Client {
+            // distinguishes this connection from a later one on the same fd
+            uint64_t serial;
+            std::string peer;
+            std::string in;
+            std::deque<std::string> frames;
+            std::string out;
+            std::size_t sent { 0 };
+            // a frame is with the port
+            bool waiting { false };
+            // relay() is running for this connection
+            bool relaying { false };
+            // the client has sent all it will
+            bool eof { false };
+        };
+
+        int m_listen { -1 };
+        Submit m_submit;
+        std::map<int, Client> m_clients;
+        uint64_t m_serial { 0 };
+
+        void accept();
+        void answer(int fd, uint64_t serial, const Result &result);
+        void close(int fd);
+        void read(int fd, Client &client);
+        void relay(int fd, Client &client);
+        void split(Client &client);
+        void write(int fd, Client &client);
+
+    public:
+
+        Gateway(const std::string &address, Submit submit);
+        ~Gateway();
+
+        Gateway(const Gateway &) = delete;
+        Gateway &operator=(const Gateway &) = delete;
+
+        std::size_t clients() const;
+        void prepare(std::vector<pollfd> &fds);
+        void process(const std::vector<pollfd> &fds);
+
+};
+
+
+#endif
@@ -0,0 +1,668 @@
+/*
+    history.cpp - append-only store of projector state over time
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include "history.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <iostream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+
+
+/* Milliseconds in a day, where new segments begin. */
+constexpr int64_t DAY_MS { 24 * 60 * 60 * 1000 };
+
+
+/* Returns `time` in milliseconds since the epoch. */
+static int64_t epoch_ms(std::chrono::system_clock::time_point time) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count();
+}
+
+/* Returns the offset of the first sample in a segment of `ports` ports. */
+static std::size_t samples_offset(std::size_t ports) {
+    return sizeof(HistoryHeader) + ports * sizeof(HistoryPort);
+}
+
+/* Returns the error for a failed system call on the segment at `path`. */
+static std::system_error segment_error(const std::string &what, const std::string &path) {
+    return std::system_error(std::error_code(errno, std::system_category()),
+                             "history " + what + " failed for " + path);
+}
+
+
+/* Creates the segment at `path`, starting at `start`, for `ports` with the
+ * values they have then, and maps it to append to.
+ *
+ * The segment is built beside `path` and renamed to it once set up, so
+ * readers never find one half made.
+ *
+ * Throws `std::system_error` if the segment file cannot be set up.
+ */
+HistorySegment::HistorySegment(const std::string &path,
+                               std::chrono::system_clock::time_point start,
+                               const std::vector<std::string> &ports,
+                               const std::vector<std::array<uint8_t, HISTORY_KEYS>> &values)
+    : m_path { path }
+{
+    auto staging { path + ".new" };
+    m_fd = open(staging.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if ( m_fd < 0 ) {
+        throw segment_error("open", staging);
+    }
+    auto size { samples_offset(ports.size()) + HISTORY_SAMPLES * sizeof(HistorySample) };
+    if ( ftruncate(m_fd, size) != 0 ) {
+        auto error { segment_error("resize", staging) };
+        close(m_fd);
+        throw error;
+    }
+    map(size, true);
+
+    for ( std::size_t i { 0 }; i < ports.size(); ++i ) {
+        std::strncpy(m_ports[i].path, ports[i].c_str(), sizeof(m_ports[i].path) - 1);
+        std::copy(values[i].begin(), values[i].end(), m_ports[i].values);
+    }
+    m_header->magic = HISTORY_MAGIC;
+    m_header->version = HISTORY_VERSION;
+    m_header->sample_size = sizeof(HistorySample);
+    m_header->ports = ports.size();
+    m_header->start = epoch_ms(start);
+    m_header->capacity = HISTORY_SAMPLES;
+
+    if ( rename(staging.c_str(), path.c_str()) != 0 ) {
+        auto error { segment_error("publish", path) };
+        unlink(staging.c_str());
+        release();
+        throw error;
+    }
+}
+
+/* Maps the existing segment at `path` for reading.
+ *
+ * Throws `std::system_error` if the file cannot be mapped and
+ * `std::runtime_error` if it is not a compatible history segment.
+ */
+HistorySegment::HistorySegment(const std::string &path)
+    : m_path { path }
+{
+    m_fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if ( m_fd < 0 ) {
+        throw segment_error("open", path);
+    }
+    struct stat info;
+    if ( fstat(m_fd, &info) != 0 ) {
+        auto error { segment_error("open", path) };
+        close(m_fd);
+        throw error;
+    }
+    if ( static_cast<std::size_t>(info.st_size) < sizeof(HistoryHeader) ) {
+        close(m_fd);
+        throw std::runtime_error("Not a history segment: " + path + '.');
+    }
+    map(info.st_size, false);
+
+    auto first { samples_offset(m_header->ports) };
+    if ( m_header->magic != HISTORY_MAGIC
+         || m_header->version != HISTORY_VERSION
+         || m_header->sample_size != sizeof(HistorySample)
+         || first > m_size ) {
+        release();
+        throw std::runtime_error("Not a compatible history segment: " + path + '.');
+    }
+    m_samples = reinterpret_cast<HistorySample *>(static_cast<char *>(m_map) + first);
+
+    // The index of a sealed segment follows its last sample.
+    auto count { static_cast<std::size_t>(m_header->count.load(std::memory_order_acquire)) };
+    auto index { first + count * sizeof(HistorySample) };
+    if ( m_header->sealed
+         && index + (m_header->ports + 1 + count) * sizeof(uint32_t) <= m_size ) {
+        m_index = reinterpret_cast<const uint32_t *>(static_cast<char *>(m_map) + index);
+    }
+}
+
+HistorySegment::~HistorySegment() {
+    release();
+}
+
+/* Adds `sample` to the end of the segment and returns true, or returns false
+ * if the segment is full.
+ */
+bool HistorySegment::append(const HistorySample &sample) {
+    auto count { m_header->count.load(std::memory_order_relaxed) };
+    if ( count >= m_header->capacity ) {
+        return false;
+    }
+    m_samples[count] = sample;
+    m_header->count.store(count + 1, std::memory_order_release);
+    return true;
+}
+
+/* Returns the number of samples written, as far as the file holds them. */
+std::size_t HistorySegment::count() const {
+    auto room { (m_size - samples_offset(m_header->ports)) / sizeof(HistorySample) };
+    return std::min<std::size_t>(m_header->count.load(std::memory_order_acquire), room);
+}
+
+/* Returns the place of `port` in the segment, or -1 if it has none. */
+int HistorySegment::find(const std::string &port) const {
+    for ( std::size_t i { 0 }; i < ports(); ++i ) {
+        if ( this->port(i) == port ) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Maps `size` bytes of the segment file and locates its sections. */
+void HistorySegment::map(std::size_t size, bool writable) {
+    auto prot { writable ? PROT_READ | PROT_WRITE : PROT_READ };
+    auto map { mmap(nullptr, size, prot, MAP_SHARED, m_fd, 0) };
+    if ( map == MAP_FAILED ) {
+        auto error { segment_error("map", m_path) };
+        close(m_fd);
+        m_fd = -1;
+        throw error;
+    }
+    m_map = map;
+    m_size = size;
+    m_header = static_cast<HistoryHeader *>(m_map);
+    m_ports = reinterpret_cast<HistoryPort *>(m_header + 1);
+    if ( writable ) {
+        m_samples = reinterpret_cast<HistorySample *>(
+                static_cast<char *>(m_map) + (size - HISTORY_SAMPLES * sizeof(HistorySample)));
+    }
+}
+
+const std::string &HistorySegment::path() const {
+    return m_path;
+}
+
+/* Returns the serial port path at `index`. */
+std::string HistorySegment::port(std::size_t index) const {
+    const auto &name { m_ports[index].path };
+    return std::string(name, strnlen(name, sizeof(name)));
+}
+
+/* Returns the number of ports the segment has. */
+std::size_t HistorySegment::ports() const {
+    return m_header->ports;
+}
+
+/* Unmaps and closes the segment file, for a segment which is going away or
+ * which a constructor is giving up on, since no destructor runs for those.
+ */
+void HistorySegment::release() {
+    if ( m_map != nullptr ) {
+        munmap(m_map, m_size);
+        m_map = nullptr;
+    }
+    if ( m_fd >= 0 ) {
+        close(m_fd);
+        m_fd = -1;
+    }
+}
+
+const HistorySample &HistorySegment::sample(std::size_t number) const {
+    return m_samples[number];
+}
+
+/* Returns the numbers of the samples of the port at `port`, oldest first,
+ * from the index of a sealed segment or else by looking through them all.
+ */
+std::vector<uint32_t> HistorySegment::samples(std::size_t port) const {
+    if ( m_index ) {
+        const auto *order { m_index + ports() + 1 };
+        return std::vector<uint32_t>(order + m_index[port], order + m_index[port + 1]);
+    }
+    std::vector<uint32_t> numbers;
+    auto count { this->count() };
+    for ( std::size_t i { 0 }; i < count; ++i ) {
+        if ( m_samples[i].port == port ) {
+            numbers.push_back(i);
+        }
+    }
+    return numbers;
+}
+
+/* Ends a segment mapped to append to: cuts the file down to the samples
+ * written and puts the per-port index after them.  Nothing more can be
+ * appended afterwards.
+ *
+ * Throws `std::system_error` if the file cannot be rewritten.
+ */
+void HistorySegment::seal() {
+    if ( m_fd < 0 || m_header->sealed ) {
+        return;
+    }
+    auto ports { this->ports() };
+    auto count { static_cast<std::size_t>(m_header->count.load(std::memory_order_relaxed)) };
+
+    std::vector<uint32_t> index(ports + 1 + count);
+    for ( std::size_t i { 0 }; i < count; ++i ) {
+        ++index[m_samples[i].port + 1];
+    }
+    for ( std::size_t p { 0 }; p < ports; ++p ) {
+        index[p + 1] += index[p];
+    }
+    std::vector<uint32_t> next(index.begin(), index.begin() + ports);
+    for ( std::size_t i { 0 }; i < count; ++i ) {
+        index[ports + 1 + next[m_samples[i].port]++] = i;
+    }
+
+    // Readers never look past `count`, so cutting the file is safe under them.
+    munmap(m_map, m_size);
+    m_map = nullptr;
+    m_header = nullptr;
+    m_ports = nullptr;
+    m_samples = nullptr;
+    auto offset { samples_offset(ports) + count * sizeof(HistorySample) };
+    auto bytes { index.size() * sizeof(uint32_t) };
+    uint32_t sealed[ 2 ] { static_cast<uint32_t>(count), 1 };
+    if ( ftruncate(m_fd, offset + bytes) != 0
+         || pwrite(m_fd, index.data(), bytes, offset) != static_cast<ssize_t>(bytes)
+         || pwrite(m_fd, sealed, sizeof(sealed), offsetof(HistoryHeader, capacity))
+                != sizeof(sealed) ) {
+        auto error { segment_error("seal", m_path) };
+        close(m_fd);
+        m_fd = -1;
+        throw error;
+    }
+    close(m_fd);
+    m_fd = -1;
+}
+
+/* Returns when the segment begins. */
+std::chrono::system_clock::time_point HistorySegment::start() const {
+    return std::chrono::system_clock::time_point(std::chrono::milliseconds(m_header->start));
+}
+
+/* Returns the values of the port at `port` when the segment began, indexed
+ * by Key.
+ */
+const uint8_t *HistorySegment::values(std::size_t port) const {
+    return m_ports[port].values;
+}
+
+
+/* A writer of the history in directory `dir`, made if need be, for
+ * `ports`.  Every value starts out unknown in a new segment, since nobody
+ * watched the projectors before now.
+ *
+ * Throws `std::runtime_error` for a port path too long for a segment to hold
+ * and `std::system_error` if the directory or a segment cannot be made.
+ */
+HistoryWriter::HistoryWriter(const std::string &dir, const std::vector<std::string> &ports)
+    : m_dir { dir },
+      m_values(ports.size())
+{
+    for ( const auto &port : ports ) {
+        if ( port.size() >= sizeof(HistoryPort::path) ) {
+            throw std::runtime_error("Port path too long to record history for: " + port + '.');
+        }
+    }
+    if ( mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST ) {
+        throw segment_error("directory", dir);
+    }
+    for ( const auto &port : ports ) {
+        if ( m_numbers.count(port) == 0 && m_ports.size() <= UINT16_MAX ) {
+            m_numbers[port] = m_ports.size();
+            m_ports.push_back(port);
+        }
+    }
+    m_values.resize(m_ports.size());
+    begin(std::chrono::system_clock::now());
+}
+
+/* Marks every value unknown from now on, since nobody watches them any
+ * more, and seals the last segment.
+ */
+HistoryWriter::~HistoryWriter() {
+    try {
+        for ( std::size_t port { 0 }; port < m_values.size(); ++port ) {
+            for ( std::size_t key { 0 }; key < HISTORY_KEYS; ++key ) {
+                change(port, static_cast<Key>(key), 0);
+            }
+        }
+        if ( m_segment ) {
+            m_segment->seal();
+        }
+    } catch ( const std::system_error &e ) {
+        // The samples written are still there, and readable unsealed.
+    }
+}
+
+/* Seals the current segment, if any, and begins a new one at `now`.  The
+ * writer is left without a segment if either fails.
+ */
+void HistoryWriter::begin(std::chrono::system_clock::time_point now) {
+    if ( auto last { std::move(m_segment) } ) {
+        last->seal();
+    }
+    auto path { m_dir + '/' + std::to_string(epoch_ms(now)) + ".seg" };
+    m_segment = std::make_unique<HistorySegment>(path, now, m_ports, m_values);
+}
+
+/* Records that `key` of the port numbered `port` became `value` just now,
+ * if that is a change, beginning a new segment at midnight UTC, after
+ * HISTORY_SPAN, when the current one is full or when the last one could
+ * not be made.
+ *
+ * A history which cannot be written is reported by fail() rather than
+ * thrown, since changes are recorded from inside port callbacks.
+ */
+void HistoryWriter::change(uint16_t port, Key key, uint8_t value) {
+    auto &held { m_values[port][static_cast<std::size_t>(key)] };
+    if ( held == value ) {
+        return;
+    }
+    auto now { std::chrono::system_clock::now() };
+    try {
+        auto start { m_segment ? m_segment->start() : now };
+        if ( ! m_segment || now - start >= HISTORY_SPAN
+                || epoch_ms(now) / DAY_MS != epoch_ms(start) / DAY_MS ) {
+            begin(now);
+            start = now;
+        }
+
+        // A clock stepped back still leaves samples in order.
+        auto since { std::max<int64_t>(epoch_ms(now) - epoch_ms(start), 0) };
+        HistorySample sample { static_cast<uint32_t>(since), port, static_cast<uint8_t>(key),
+                               value };
+        if ( ! m_segment->append(sample) ) {
+            begin(now);
+            sample.time = 0;
+            m_segment->append(sample);
+        }
+        m_failing = false;
+    } catch ( const std::system_error &e ) {
+        fail(e);
+    }
+    held = value;
+}
+
+/* Reports `error` on stderr, once until the history is written again. */
+void HistoryWriter::fail(const std::system_error &error) {
+    if ( ! m_failing ) {
+        std::cerr << error.what() << std::endl;
+        m_failing = true;
+    }
+}
+
+/* Records that `port` does not answer. */
+void HistoryWriter::offline(const std::string &port) {
+    auto it { m_numbers.find(port) };
+    if ( it != m_numbers.end() ) {
+        change(it->second, Key::Unknown, static_cast<uint8_t>(Value::Off));
+    }
+}
+
+/* Records any change of state `result` shows.
+ *
+ * A silent or failed port is offline.  A reply puts the port online and
+ * gives the value it names, and a refused query (e.g. the source of a
+ * projector in standby) leaves its value unknown.  Commands which were
+ * never sent, for load or a passed deadline, show nothing.
+ */
+void HistoryWriter::record(const Result &result) {
+    auto it { m_numbers.find(result.port) };
+    if ( it == m_numbers.end() ) {
+        return;
+    }
+    auto port { it->second };
+
+    std::string kind { error_class(result.error) };
+    if ( kind == "timeout" || kind == "io" ) {
+        change(port, Key::Unknown, static_cast<uint8_t>(Value::Off));
+        return;
+    }
+    if ( kind != "ok" && kind != "blocked" && kind != "unsupported" && kind != "illegal" ) {
+        return;
+    }
+    change(port, Key::Unknown, static_cast<uint8_t>(Value::On));
+
+    if ( ! result.error ) {
+        auto reply { result.decoded() };
+        auto value { history_value(reply) };
+        if ( reply.key != Key::Unknown && value != 0 ) {
+            change(port, reply.key, value);
+        }
+        return;
+    }
+    try {
+        auto command { decode(command_message(result.cmd)) };
+        if ( command.key != Key::Unknown && command.value == Value::Query ) {
+            change(port, command.key, 0);
+        }
+    } catch ( const std::logic_error &e ) {
+    }
+}
+
+
+/* Maps every segment in the history directory `dir`.
+ *
+ * Throws `std::system_error` if the directory or a segment cannot be read,
+ * and `std::runtime_error` for a segment of another version.
+ */
+HistoryReader::HistoryReader(const std::string &dir) {
+    auto *listing { opendir(dir.c_str()) };
+    if ( ! listing ) {
+        throw segment_error("directory", dir);
+    }
+    std::vector<std::pair<uint64_t, std::string>> found;
+    while ( auto *entry { readdir(listing) } ) {
+        std::string name { entry->d_name };
+        auto stem { name.size() > 4 ? name.substr(0, name.size() - 4) : "" };
+        if ( stem.empty() || name.compare(stem.size(), 4, ".seg") != 0
+                || stem.find_first_not_of("0123456789") != std::string::npos ) {
+            continue;
+        }
+        found.emplace_back(std::stoull(stem), dir + '/' + name);
+    }
+    closedir(listing);
+
+    std::sort(found.begin(), found.end());
+    for ( const auto &[_unused, path] : found ) {
+        m_segments.push_back(std::make_unique<HistorySegment>(path));
+    }
+}
+
+/* Returns how long `key` of `port` held each value between `from` and `to`,
+ * in buckets of `every` (one bucket for the whole time if it is zero).
+ * Values last known are taken to hold up to now, not beyond.
+ */
+std::vector<HistoryBucket> HistoryReader::aggregate(const std::string &port, Key key,
+                                                    std::chrono::system_clock::time_point from,
+                                                    std::chrono::system_clock::time_point to,
+                                                    std::chrono::milliseconds every) const {
+    using std::chrono::milliseconds;
+    using std::chrono::system_clock;
+    std::vector<HistoryBucket> buckets;
+    if ( to <= from ) {
+        return buckets;
+    }
+    if ( every <= milliseconds(0) ) {
+        every = std::chrono::ceil<milliseconds>(to - from);
+    }
+    for ( auto start { from }; start < to; start += every ) {
+        buckets.push_back(HistoryBucket { start, {} });
+    }
+
+    auto bucket { [&](system_clock::time_point time) {
+        return static_cast<int64_t>((time - from) / every);
+    } };
+    auto hold { [&](system_clock::time_point begin, system_clock::time_point end,
+                    uint8_t value) {
+        while ( begin < end ) {
+            auto index { bucket(begin) };
+            auto stop { std::min<system_clock::time_point>(end, from + every * (index + 1)) };
+            buckets[index].held[value] += std::chrono::duration_cast<milliseconds>(stop - begin);
+            begin = stop;
+        }
+    } };
+
+    uint8_t current { 0 };
+    auto since { from };
+    scan(port, from, to, [&](const HistoryEvent &event) {
+        if ( event.key != key ) {
+            return;
+        }
+        hold(since, event.time, current);
+        if ( event.time > from ) {
+            ++buckets[bucket(event.time)].changes;
+        }
+        current = event.value;
+        since = event.time;
+    });
+    hold(since, std::max(since, std::min(to, system_clock::now())), current);
+    return buckets;
+}
+
+/* Returns when the history begins, or now if it is empty. */
+std::chrono::system_clock::time_point HistoryReader::begins() const {
+    if ( m_segments.empty() ) {
+        return std::chrono::system_clock::now();
+    }
+    return m_segments.front()->start();
+}
+
+/* Returns every port in the history, in the order first seen. */
+std::vector<std::string> HistoryReader::ports() const {
+    std::vector<std::string> ports;
+    for ( const auto &segment : m_segments ) {
+        for ( std::size_t i { 0 }; i < segment->ports(); ++i ) {
+            auto port { segment->port(i) };
+            if ( std::find(ports.begin(), ports.end(), port) == ports.end() ) {
+                ports.push_back(port);
+            }
+        }
+    }
+    return ports;
+}
+
+/* Calls `visit` with each change of state of `port` between `from` and `to`,
+ * oldest first.  The values known at `from` come first, all at `from`.
+ *
+ * Only segments which overlap the time are read, each from its own record
+ * of the state it began with, and only the port's own samples, through the
+ * index of a sealed segment.
+ */
+void HistoryReader::scan(const std::string &port, std::chrono::system_clock::time_point from,
+                         std::chrono::system_clock::time_point to,
+                         const std::function<void(const HistoryEvent &)> &visit) const {
+    if ( to <= from ) {
+        return;
+    }
+    std::array<uint8_t, HISTORY_KEYS> state {};
+    bool started { false };
+    auto start { [&]() {
+        if ( started ) {
+            return;
+        }
+        started = true;
+        for ( std::size_t key { 0 }; key < HISTORY_KEYS; ++key ) {
+            if ( state[key] != 0 ) {
+                visit(HistoryEvent { from, static_cast<Key>(key), state[key] });
+            }
+        }
+    } };
+    auto feed { [&](std::chrono::system_clock::time_point time, std::size_t key, uint8_t value) {
+        if ( time < from ) {
+            state[key] = value;
+            return;
+        }
+        start();
+        if ( state[key] != value ) {
+            state[key] = value;
+            visit(HistoryEvent { time, static_cast<Key>(key), value });
+        }
+    } };
+
+    for ( std::size_t s { 0 }; s < m_segments.size(); ++s ) {
+        const auto &segment { *m_segments[s] };
+        auto begins { segment.start() };
+        if ( begins >= to ) {
+            break;
+        }
+        // A later segment which starts by `from` holds all that came before.
+        if ( s + 1 < m_segments.size() && m_segments[s + 1]->start() <= from ) {
+            continue;
+        }
+
+        auto index { segment.find(port) };
+        for ( std::size_t key { 0 }; key < HISTORY_KEYS; ++key ) {
+            feed(begins, key, index < 0 ? 0 : segment.values(index)[key]);
+        }
+        if ( index < 0 ) {
+            continue;
+        }
+        for ( auto number : segment.samples(index) ) {
+            const auto &sample { segment.sample(number) };
+            auto time { begins + std::chrono::milliseconds(sample.time) };
+            if ( time >= to ) {
+                break;
+            }
+            if ( sample.key < HISTORY_KEYS ) {
+                feed(time, sample.key, sample.value);
+            }
+        }
+    }
+    start();
+}
+
+
+/* Returns the value of `reply` as a HistorySample holds it, or 0 for one
+ * which is not kept, such as free text.
+ */
+uint8_t history_value(const Reply &reply) {
+    switch ( reply.value ) {
+        case Value::Unknown:
+        case Value::Query:
+        case Value::Text:
+            return 0;
+        case Value::Number:
+            return HISTORY_NUMBER + std::clamp<int32_t>(reply.number, 0, 0x7f);
+        default:
+            return static_cast<uint8_t>(reply.value);
+    }
+}
+
+/* Returns `value` of `key`, as a HistorySample holds it, as text: e.g. "on"
+ * or "12", "online" or "offline" for Key::Unknown, or "-" if unknown.
+ */
+std::string history_text(Key key, uint8_t value) {
+    if ( value == 0 ) {
+        return "-";
+    }
+    if ( value >= HISTORY_NUMBER ) {
+        return std::to_string(value - HISTORY_NUMBER);
+    }
+    if ( key == Key::Unknown ) {
+        return static_cast<Value>(value) == Value::On ? "online" : "offline";
+    }
+    auto word { spelling(VALUE_WORDS, static_cast<Value>(value)) };
+    return word.empty() ? "-" : std::string(word);
+}
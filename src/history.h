@@ -0,0 +1,253 @@
+/*
+    history.h - append-only store of projector state over time
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#ifndef HISTORY_H
+#define HISTORY_H true
+
+#include "board.h"
+#include "decode.h"
+#include "exchange.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+
+/* A history is a directory of segment files, named for the time each
+ * begins in milliseconds since the epoch, e.g. "1760832000000.seg".  A
+ * segment covers the time from its start to the next segment's, and is
+ * laid out as:
+ *
+ *   HistoryHeader                  one cache line
+ *   HistoryPort[ports]             port paths, and their state at `start`
+ *   HistorySample[count]           oldest first
+ *   uint32_t[ports + 1]            once sealed, where each port's entries
+ *   uint32_t[count]                begin in the sample numbers that follow,
+ *                                  grouped by port, oldest first
+ *
+ * Every structure is fixed size, little endian and naturally aligned.  A
+ * sample is written only when a value changes, so a projector costs a few
+ * dozen bytes a day.  The writer publishes `count` after each sample, so
+ * readers may map a segment as it grows without a lock.
+ */
+
+/* "BWHS" in a little endian file. */
+constexpr uint32_t HISTORY_MAGIC { 0x53485742 };
+constexpr uint32_t HISTORY_VERSION { 1 };
+
+/* Samples one segment has room for, 8 MiB worth.  Segment files are sparse
+ * until written, and cut down to size once sealed.
+ */
+constexpr uint32_t HISTORY_SAMPLES { 1 << 20 };
+
+/* Longest time one segment covers.  A new one begins at the first sample
+ * after midnight UTC, or after this long.
+ */
+constexpr std::chrono::hours HISTORY_SPAN { 24 };
+
+/* Keys a state has, indexed by Key.  Key::Unknown holds whether the port
+ * answers at all, as Value::On or Value::Off.
+ */
+constexpr std::size_t HISTORY_KEYS { 8 };
+
+/* HistorySample.value of a number: this plus the number, up to 127. */
+constexpr uint8_t HISTORY_NUMBER { 0x80 };
+
+static_assert(KEY_WORDS.size() < HISTORY_KEYS);
+
+
+struct alignas(CACHE_LINE) HistoryHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t sample_size;
+    uint32_t ports;
+    // milliseconds since the epoch
+    uint64_t start;
+    // HistorySample slots in the file
+    uint32_t capacity;
+    // the per-port index follows the samples
+    uint32_t sealed;
+    std::atomic<uint32_t> count;
+    char reserved[ CACHE_LINE - 7 * sizeof(uint32_t) - sizeof(uint64_t) ];
+};
+
+struct HistoryPort {
+    char path[ 120 ];
+    // state at the start of the segment, indexed by Key, 0 while unknown
+    uint8_t values[ HISTORY_KEYS ];
+};
+
+struct HistorySample {
+    // milliseconds since HistoryHeader.start
+    uint32_t time;
+    uint16_t port;
+    // a Key, with Key::Unknown for whether the port answers at all
+    uint8_t key;
+    // a Value, HISTORY_NUMBER plus a number, or 0 once unknown
+    uint8_t value;
+};
+
+static_assert(sizeof(HistoryHeader) == CACHE_LINE);
+static_assert(sizeof(HistoryPort) == 128);
+static_assert(sizeof(HistorySample) == 8);
+static_assert(std::atomic<uint32_t>::is_always_lock_free);
+
+
+/* One segment file, mapped to append to or to read. */
+class HistorySegment {
+
+    private:
+
+        std::string m_path;
+        int m_fd { -1 };
+        void *m_map { nullptr };
+        std::size_t m_size { 0 };
+
+        HistoryHeader *m_header { nullptr };
+        HistoryPort *m_ports { nullptr };
+        HistorySample *m_samples { nullptr };
+        const uint32_t *m_index { nullptr };
+
+        void map(std::size_t size, bool writable);
+        void release();
+
+    public:
+
+        HistorySegment(const std::string &path, std::chrono::system_clock::time_point start,
+                       const std::vector<std::string> &ports,
+                       const std::vector<std::array<uint8_t, HISTORY_KEYS>> &values);
+        explicit HistorySegment(const std::string &path);
+        ~HistorySegment();
+
+        HistorySegment(const HistorySegment &) = delete;
+        HistorySegment &operator=(const HistorySegment &) = delete;
+
+        bool append(const HistorySample &sample);
+        std::size_t count() const;
+        int find(const std::string &port) const;
+        const std::string &path() const;
+        std::string port(std::size_t index) const;
+        std::size_t ports() const;
+        const HistorySample &sample(std::size_t number) const;
+        std::vector<uint32_t> samples(std::size_t port) const;
+        void seal();
+        std::chrono::system_clock::time_point start() const;
+        const uint8_t *values(std::size_t port) const;
+
+};
+
+
+/* Records changes of projector state into the history in one directory.
+ *
+ * Feed it every command result with record(); it keeps only those which
+ * change a value.  There must be only one writer per directory.  A segment
+ * which cannot be made or sealed is reported on stderr, and the next change
+ * tries a new one.
+ */
+class HistoryWriter {
+
+    private:
+
+        std::string m_dir;
+        std::vector<std::string> m_ports;
+        std::map<std::string, uint16_t> m_numbers;
+
+        /* The latest value of every key of every port. */
+        std::vector<std::array<uint8_t, HISTORY_KEYS>> m_values;
+
+        std::unique_ptr<HistorySegment> m_segment;
+
+        /* The last change could not be written, and has been reported. */
+        bool m_failing { false };
+
+        void begin(std::chrono::system_clock::time_point now);
+        void change(uint16_t port, Key key, uint8_t value);
+        void fail(const std::system_error &error);
+
+    public:
+
+        HistoryWriter(const std::string &dir, const std::vector<std::string> &ports);
+        ~HistoryWriter();
+
+        HistoryWriter(const HistoryWriter &) = delete;
+        HistoryWriter &operator=(const HistoryWriter &) = delete;
+
+        void offline(const std::string &port);
+        void record(const Result &result);
+
+};
+
+
+/* A change of one key of one port, at `time`. */
+struct HistoryEvent {
+    std::chrono::system_clock::time_point time;
+    Key key;
+    // as HistorySample.value
+    uint8_t value;
+};
+
+/* How long one key held each value over one stretch of time. */
+struct HistoryBucket {
+    std::chrono::system_clock::time_point start;
+    // time held, by value as HistorySample.value, unknown (0) included
+    std::map<uint8_t, std::chrono::milliseconds> held;
+    // changes of value which began within the bucket
+    int changes { 0 };
+};
+
+
+/* The segments of a history directory, mapped for reading. */
+class HistoryReader {
+
+    private:
+
+        std::vector<std::unique_ptr<HistorySegment>> m_segments;
+
+    public:
+
+        explicit HistoryReader(const std::string &dir);
+
+        std::vector<HistoryBucket> aggregate(const std::string &port, Key key,
+                                             std::chrono::system_clock::time_point from,
+                                             std::chrono::system_clock::time_point to,
+                                             std::chrono::milliseconds every) const;
+        std::chrono::system_clock::time_point begins() const;
+        std::vector<std::string> ports() const;
+        void scan(const std::string &port, std::chrono::system_clock::time_point from,
+                  std::chrono::system_clock::time_point to,
+                  const std::function<void(const HistoryEvent &)> &visit) const;
+
+};
+
+
+uint8_t history_value(const Reply &reply);
+std::string history_text(Key key, uint8_t value);
+
+
+#endif
@@ -0,0 +1,387 @@
+/*
+    http.cpp - minimal HTTP/1.1 server for a poll loop
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include "http.h"
+#include "listener.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <unistd.h>
+
+
+/* Returns the reason phrase for an HTTP `status`. */
+static const char *reason(int status) {
+    switch ( status ) {
+        case 200: return "OK";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 409: return "Conflict";
+        case 413: return "Content Too Large";
+        case 429: return "Too Many Requests";
+        case 431: return "Request Header Fields Too Large";
+        case 500: return "Internal Server Error";
+        case 501: return "Not Implemented";
+        case 502: return "Bad Gateway";
+        case 503: return "Service Unavailable";
+        case 504: return "Gateway Timeout";
+        case 505: return "HTTP Version Not Supported";
+    }
+    return "Unknown";
+}
+
+/* Returns `text` in lower case. */
+static std::string lower(std::string text) {
+    std::transform(text.begin(), text.end(), text.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    return text;
+}
+
+/* A server listening on `address` (see listen_on).
+ *
+ * Throws `std::runtime_error` for a malformed address, or
+ * `std::system_error` if it cannot be listened on.
+ */
+HttpServer::HttpServer(const std::string &address, Handler handler)
+    : m_listen { listen_on(address, "HTTP") },
+      m_handler { std::move(handler) }
+{
+}
+
+HttpServer::~HttpServer() {
+    for ( const auto &[fd, _unused] : m_clients ) {
+        ::close(fd);
+    }
+    ::close(m_listen);
+}
+
+/* Accepts every pending connection, while there is room for them. */
+void HttpServer::accept() {
+    while ( m_clients.size() < HTTP_MAX_CLIENTS ) {
+        auto fd { accept4(m_listen, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC) };
+        if ( fd < 0 ) {
+            return;
+        }
+        // Responses are written whole, so never hold them back.
+        int on { 1 };
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        m_clients[fd] = Client { ++m_serial, peer_name(fd) };
+        m_clients[fd].active = std::chrono::steady_clock::now();
+    }
+}
+
+/* Queues `response` for the request in hand on connection `fd`, if it is
+ * still the connection numbered `serial`, and moves on to the next request.
+ */
+void HttpServer::answer(int fd, uint64_t serial, const Response &response, bool keep_alive) {
+    auto it { m_clients.find(fd) };
+    if ( it == m_clients.end() || it->second.serial != serial || ! it->second.waiting ) {
+        return;
+    }
+    auto &client { it->second };
+
+    char head[ 192 ];
+    std::snprintf(head, sizeof(head),
+                  "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\n%s\r\n",
+                  response.status, reason(response.status), response.type.c_str(),
+                  response.body.size(),
+                  keep_alive ? "Connection: keep-alive\r\n" : "Connection: close\r\n");
+    client.out += head;
+    if ( response.retry_after > 0 ) {
+        // Headers end with the blank line just written.
+        client.out.insert(client.out.size() - 2,
+                          "Retry-After: " + std::to_string(response.retry_after) + "\r\n");
+    }
+    client.out += response.body;
+    client.waiting = false;
+    client.closing = ! keep_alive;
+    client.active = std::chrono::steady_clock::now();
+
+    // Write at once rather than after another trip through poll().
+    write(fd, client);
+    if ( m_clients.count(fd) && ! client.serving ) {
+        serve(fd, client);
+    }
+}
+
+/* Returns the number of open connections. */
+std::size_t HttpServer::clients() const {
+    return m_clients.size();
+}
+
+void HttpServer::close(int fd) {
+    ::close(fd);
+    m_clients.erase(fd);
+}
+
+/* Returns the TCP port listened on, or 0 for a Unix socket. */
+uint16_t HttpServer::port() const {
+    sockaddr_storage where {};
+    socklen_t size { sizeof(where) };
+    getsockname(m_listen, reinterpret_cast<sockaddr *>(&where), &size);
+    if ( where.ss_family != AF_INET ) {
+        return 0;
+    }
+    return ntohs(reinterpret_cast<sockaddr_in &>(where).sin_port);
+}
+
+/* Appends the descriptors the server needs watched to `fds`.  Pass the same
+ * `fds`, after poll(), to process().
+ */
+void HttpServer::prepare(std::vector<pollfd> &fds) {
+    if ( m_clients.size() < HTTP_MAX_CLIENTS ) {
+        fds.push_back(pollfd { m_listen, POLLIN, 0 });
+    }
+    for ( const auto &[fd, client] : m_clients ) {
+        short events { 0 };
+        if ( ! client.closing && client.in.size() < HTTP_MAX_BACKLOG ) {
+            events |= POLLIN;
+        }
+        if ( client.sent < client.out.size() ) {
+            events |= POLLOUT;
+        }
+        fds.push_back(pollfd { fd, events, 0 });
+    }
+}
+
+/* Handles the poll() results in `fds` for descriptors added by prepare(),
+ * and closes connections idle for longer than HTTP_IDLE_TIMEOUT.
+ *
+ * Descriptors in `fds` belonging to anyone else are ignored.
+ */
+void HttpServer::process(const std::vector<pollfd> &fds) {
+    for ( const auto &pfd : fds ) {
+        if ( pfd.revents == 0 ) {
+            continue;
+        }
+        if ( pfd.fd == m_listen ) {
+            accept();
+            continue;
+        }
+        auto it { m_clients.find(pfd.fd) };
+        if ( it == m_clients.end() ) {
+            continue;
+        }
+        if ( pfd.revents & POLLOUT ) {
+            write(pfd.fd, it->second);
+            it = m_clients.find(pfd.fd);
+            // Requests held back while responses piled up may now go.
+            if ( it != m_clients.end() && ! it->second.serving ) {
+                serve(pfd.fd, it->second);
+                it = m_clients.find(pfd.fd);
+            }
+        }
+        if ( it != m_clients.end() && (pfd.revents & POLLIN) ) {
+            read(pfd.fd, it->second);
+        } else if ( it != m_clients.end() && (pfd.revents & (POLLHUP | POLLERR)) ) {
+            // Nobody is left to answer.
+            close(pfd.fd);
+        }
+    }
+
+    auto idle { std::chrono::steady_clock::now() - std::chrono::milliseconds(HTTP_IDLE_TIMEOUT) };
+    for ( auto it { m_clients.begin() }; it != m_clients.end(); ) {
+        auto fd { (it++)->first };
+        auto &client { m_clients[fd] };
+        if ( ! client.waiting && client.active < idle ) {
+            close(fd);
+        }
+    }
+}
+
+/* Reads what has arrived on connection `fd`, up to HTTP_MAX_BACKLOG bytes
+ * waiting, and serves any whole requests.
+ */
+void HttpServer::read(int fd, Client &client) {
+    char buffer[ 4096 ];
+    ssize_t ret { 1 };
+    while ( client.in.size() < HTTP_MAX_BACKLOG
+            && (ret = recv(fd, buffer, sizeof(buffer), 0)) > 0 ) {
+        client.in.append(buffer, ret);
+        client.active = std::chrono::steady_clock::now();
+    }
+    if ( ret == 0 || (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) ) {
+        close(fd);
+        return;
+    }
+    serve(fd, client);
+}
+
+/* Passes the next whole request on connection `fd` to the handler, unless
+ * one is already in hand or HTTP_MAX_BACKLOG bytes of responses wait to be
+ * sent, until a request must wait for its response.
+ */
+void HttpServer::serve(int fd, Client &client) {
+    auto serial { client.serial };
+    // Any answer may close the connection, and with it `client`.
+    auto open { [this, fd, serial]() {
+        auto it { m_clients.find(fd) };
+        return it != m_clients.end() && it->second.serial == serial;
+    } };
+
+    client.serving = true;
+    while ( ! client.waiting && ! client.closing
+            && client.out.size() - client.sent < HTTP_MAX_BACKLOG ) {
+        auto end { client.in.find("\r\n\r\n") };
+        // A head over the limit may arrive whole in a single read.
+        if ( end == std::string::npos || end > HTTP_MAX_REQUEST ) {
+            if ( client.in.size() > HTTP_MAX_REQUEST ) {
+                client.waiting = true;
+                answer(fd, serial, Response { 431, "" }, false);
+                if ( ! open() ) {
+                    return;
+                }
+            }
+            break;
+        }
+
+        Request request { "", "", "", client.peer, {} };
+        std::string version;
+        std::size_t length { 0 };
+        bool keep_alive { true }, valid { true };
+        {
+            auto line_end { client.in.find("\r\n") };
+            auto line { client.in.substr(0, line_end) };
+            auto first { line.find(' ') }, second { line.rfind(' ') };
+            if ( first == std::string::npos || second == first ) {
+                valid = false;
+            } else {
+                request.method = line.substr(0, first);
+                request.path = line.substr(first + 1, second - first - 1);
+                version = line.substr(second + 1);
+                request.path = request.path.substr(0, request.path.find('?'));
+            }
+            keep_alive = version == "HTTP/1.1";
+
+            for ( auto start { line_end + 2 }; start < end; ) {
+                auto stop { client.in.find("\r\n", start) };
+                auto header { client.in.substr(start, stop - start) };
+                start = stop + 2;
+                auto colon { header.find(':') };
+                if ( colon == std::string::npos ) {
+                    continue;
+                }
+                auto name { lower(header.substr(0, colon)) };
+                auto &given { request.headers[name] = header.substr(colon + 1) };
+                given.erase(0, given.find_first_not_of(' '));
+                auto value { lower(given) };
+                if ( name == "connection" ) {
+                    if ( value.find("close") != std::string::npos ) {
+                        keep_alive = false;
+                    } else if ( value.find("keep-alive") != std::string::npos ) {
+                        keep_alive = true;
+                    }
+                } else if ( name == "content-length" ) {
+                    try {
+                        length = std::stoul(value);
+                    } catch ( const std::logic_error &e ) {
+                        valid = false;
+                    }
+                } else if ( name == "transfer-encoding" ) {
+                    valid = false;
+                }
+            }
+        }
+
+        if ( length > HTTP_MAX_REQUEST ) {
+            client.waiting = true;
+            answer(fd, serial, Response { 413, "" }, false);
+            if ( ! open() ) {
+                return;
+            }
+            break;
+        }
+        if ( client.in.size() < end + 4 + length ) {
+            break;
+        }
+        request.body = client.in.substr(end + 4, length);
+        client.in.erase(0, end + 4 + length);
+
+        client.waiting = true;
+        if ( ! valid ) {
+            answer(fd, serial, Response { 400, "" }, false);
+        } else if ( version != "HTTP/1.1" && version != "HTTP/1.0" ) {
+            answer(fd, serial, Response { 505, "" }, false);
+        } else {
+            m_handler(request, [this, fd, serial, keep_alive](const Response &response) {
+                answer(fd, serial, response, keep_alive);
+            });
+        }
+        if ( ! open() ) {
+            return;
+        }
+    }
+    client.serving = false;
+}
+
+/* Returns the milliseconds until an idle connection is due to close, or -1
+ * if there are none.
+ */
+int HttpServer::timeout() const {
+    using clock = std::chrono::steady_clock;
+    auto next { clock::time_point::max() };
+    for ( const auto &[_unused, client] : m_clients ) {
+        if ( ! client.waiting ) {
+            next = std::min(next, client.active + std::chrono::milliseconds(HTTP_IDLE_TIMEOUT));
+        }
+    }
+    if ( next == clock::time_point::max() ) {
+        return -1;
+    }
+    auto now { clock::now() };
+    if ( next <= now ) {
+        return 0;
+    }
+    return std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count() + 1;
+}
+
+/* Sends what it can of the output queued on connection `fd`, and closes it
+ * once a closing connection has sent everything.
+ */
+void HttpServer::write(int fd, Client &client) {
+    while ( client.sent < client.out.size() ) {
+        auto ret { send(fd, client.out.data() + client.sent, client.out.size() - client.sent,
+                        MSG_NOSIGNAL) };
+        if ( ret < 0 ) {
+            if ( errno == EAGAIN || errno == EWOULDBLOCK ) {
+                return;
+            }
+            if ( errno == EINTR ) {
+                continue;
+            }
+            close(fd);
+            return;
+        }
+        client.sent += ret;
+    }
+    client.out.clear();
+    client.sent = 0;
+    if ( client.closing ) {
+        close(fd);
+    }
+}
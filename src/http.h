@@ -0,0 +1,133 @@
+/*
+    http.h - minimal HTTP/1.1 server for a poll loop
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#ifndef HTTP_H
+#define HTTP_H true
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <poll.h>
+#include <string>
+#include <vector>
+
+
+/* Milliseconds an idle keep-alive connection is kept open. */
+constexpr int HTTP_IDLE_TIMEOUT { 30000 };
+
+/* Most connections open at once.  Others wait in the listen backlog. */
+constexpr std::size_t HTTP_MAX_CLIENTS { 1024 };
+
+/* Longest request head, and longest body, accepted. */
+constexpr std::size_t HTTP_MAX_REQUEST { 8192 };
+
+/* Most bytes held for one connection, of requests pipelined behind the one
+ * in hand or of responses it has yet to take.  A connection past either is
+ * not read from until it catches up, which holds the client back through
+ * socket flow control instead of buffering without bound.
+ */
+constexpr std::size_t HTTP_MAX_BACKLOG { 65536 };
+
+
+/* An HTTP/1.1 server with keep-alive and pipelining, to embed in a poll loop
+ * with prepare(), timeout() and process().
+ *
+ * Every request goes to one handler, which answers it through the Respond
+ * callback it is given, either at once or later, e.g. once a projector has
+ * replied.  Each connection has one request in hand at a time; requests
+ * pipelined behind it wait their turn, so responses keep their order.
+ */
+class HttpServer {
+
+    public:
+
+        struct Request {
+            std::string method;
+            // path only, query string removed
+            std::string path;
+            std::string body;
+            // who sent it (see peer_name)
+            std::string peer;
+            // header values keyed by lower case name, the last of any repeated
+            std::map<std::string, std::string> headers;
+        };
+
+        struct Response {
+            int status { 200 };
+            std::string body;
+            std::string type { "application/json" };
+            // seconds for a Retry-After header, or 0 for none
+            int retry_after { 0 };
+        };
+
+        using Respond = std::function<void(const Response &response)>;
+        using Handler = std::function<void(const Request &request, Respond respond)>;
+
+    private:
+
+        struct Client {
+            // distinguishes this connection from a later one on the same fd
+            uint64_t serial;
+            std::string peer;
+            std::string in;
+            std::string out;
+            std::size_t sent { 0 };
+            // a request is with the handler
+            bool waiting { false };
+            // close once `out` is sent
+            bool closing { false };
+            // serve() is running for this connection
+            bool serving { false };
+            std::chrono::steady_clock::time_point active;
+        };
+
+        int m_listen { -1 };
+        Handler m_handler;
+        std::map<int, Client> m_clients;
+        uint64_t m_serial { 0 };
+
+        void accept();
+        void answer(int fd, uint64_t serial, const Response &response, bool keep_alive);
+        void close(int fd);
+        void read(int fd, Client &client);
+        void serve(int fd, Client &client);
+        void write(int fd, Client &client);
+
+    public:
+
+        HttpServer(const std::string &address, Handler handler);
+        ~HttpServer();
+
+        HttpServer(const HttpServer &) = delete;
+        HttpServer &operator=(const HttpServer &) = delete;
+
+        std::size_t clients() const;
+        uint16_t port() const;
+        void prepare(std::vector<pollfd> &fds);
+        void process(const std::vector<pollfd> &fds);
+        int timeout() const;
+
+};
+
+
+#endif
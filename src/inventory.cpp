@@ -0,0 +1,193 @@
+/*
+    inventory.cpp - serial ports named by tags and groups
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include "inventory.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+#include <stdexcept>
+
+
+/* Returns where the inventory lives by default:
+ * $XDG_CONFIG_HOME/bewield/inventory, or ~/.config/bewield/inventory.
+ * Returns "" if neither variable is set.
+ */
+std::string default_inventory_path() {
+    if ( auto config { std::getenv("XDG_CONFIG_HOME") }; config != nullptr && *config ) {
+        return std::string(config) + "/bewield/inventory";
+    }
+    if ( auto home { std::getenv("HOME") }; home != nullptr && *home ) {
+        return std::string(home) + "/.config/bewield/inventory";
+    }
+    return "";
+}
+
+/* Returns the ","-separated terms of a target expression, e.g. "lab" and
+ * "building-3&floor-2" for "lab,building-3&floor-2".
+ */
+std::vector<std::string> target_terms(const std::string &expression) {
+    std::vector<std::string> terms;
+    std::istringstream parts { expression };
+    std::string term;
+    while ( std::getline(parts, term, ',') ) {
+        if ( ! term.empty() && std::find(terms.begin(), terms.end(), term) == terms.end() ) {
+            terms.push_back(term);
+        }
+    }
+    return terms;
+}
+
+
+/* The inventory read from `in`.
+ *
+ * Throws `std::runtime_error` for a group which is unknown or contains
+ * itself.
+ */
+Inventory::Inventory(std::istream &in) {
+    std::string line;
+    while ( std::getline(in, line) ) {
+        std::istringstream words { line };
+        std::string first;
+        if ( ! (words >> first) || first.front() == '#' ) {
+            continue;
+        }
+
+        std::vector<std::string> rest;
+        for ( std::string word; words >> word && word.front() != '#'; ) {
+            rest.push_back(word);
+        }
+        if ( first == "group" ) {
+            if ( rest.empty() ) {
+                throw std::runtime_error("Inventory group without a name.");
+            }
+            auto &members { m_groups[rest.front()] };
+            members.insert(members.end(), rest.begin() + 1, rest.end());
+            continue;
+        }
+
+        if ( m_names.count(first) == 0 ) {
+            m_ports.push_back(first);
+        }
+        m_names[first].insert(first);
+        m_names["all"].insert(first);
+        for ( const auto &tag : rest ) {
+            m_names[tag].insert(first);
+        }
+    }
+
+    // Resolving a group removes it, and any groups within it, from m_groups.
+    while ( ! m_groups.empty() ) {
+        auto group { m_groups.begin()->first };
+        std::set<std::string> visiting;
+        resolve(group, visiting);
+    }
+}
+
+/* Returns the ports named `name`.
+ *
+ * Throws `std::runtime_error` if no tag, group or port is called `name`.
+ */
+const std::set<std::string> &Inventory::members(const std::string &name) const {
+    auto it { m_names.find(name) };
+    if ( it == m_names.end() ) {
+        throw std::runtime_error("No port, tag or group called '" + name + "'.");
+    }
+    return it->second;
+}
+
+/* Returns every port, in inventory order. */
+const std::vector<std::string> &Inventory::ports() const {
+    return m_ports;
+}
+
+/* Adds the ports of `group`, and of the groups within it, to its name. */
+void Inventory::resolve(const std::string &group, std::set<std::string> &visiting) {
+    auto it { m_groups.find(group) };
+    if ( it == m_groups.end() ) {
+        return;
+    }
+    if ( ! visiting.insert(group).second ) {
+        throw std::runtime_error("Inventory group '" + group + "' contains itself.");
+    }
+    auto members { std::move(it->second) };
+    m_groups.erase(it);
+    auto &ports { m_names[group] };
+    for ( const auto &member : members ) {
+        resolve(member, visiting);
+        auto found { m_names.find(member) };
+        if ( found == m_names.end() ) {
+            throw std::runtime_error("Inventory group '" + group + "' names unknown '"
+                                     + member + "'.");
+        }
+        ports.insert(found->second.begin(), found->second.end());
+    }
+    visiting.erase(group);
+}
+
+/* Returns the ports picked by a target `expression`, in inventory order.
+ *
+ * Throws `std::runtime_error` for an unknown name or an empty expression.
+ */
+std::vector<std::string> Inventory::select(const std::string &expression) const {
+    std::set<std::string> chosen, term;
+    char op { ',' };
+    std::string name;
+    for ( auto c : expression + ',' ) {
+        if ( c == ' ' ) {
+            continue;
+        }
+        if ( c != ',' && c != '&' && c != '~' ) {
+            name += c;
+            continue;
+        }
+        if ( name.empty() ) {
+            throw std::runtime_error("Bad target expression '" + expression + "'.");
+        }
+
+        const auto &ports { members(name) };
+        if ( op == ',' ) {
+            term = ports;
+        } else if ( op == '&' ) {
+            std::set<std::string> both;
+            std::set_intersection(term.begin(), term.end(), ports.begin(), ports.end(),
+                                  std::inserter(both, both.end()));
+            term = std::move(both);
+        } else {
+            for ( const auto &port : ports ) {
+                term.erase(port);
+            }
+        }
+        if ( c == ',' ) {
+            chosen.insert(term.begin(), term.end());
+        }
+        op = c;
+        name.clear();
+    }
+
+    std::vector<std::string> selected;
+    for ( const auto &port : m_ports ) {
+        if ( chosen.count(port) ) {
+            selected.push_back(port);
+        }
+    }
+    return selected;
+}
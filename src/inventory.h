@@ -0,0 +1,78 @@
+/*
+    inventory.h - serial ports named by tags and groups
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#ifndef INVENTORY_H
+#define INVENTORY_H true
+
+#include <istream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+
+/* Serial ports known by name, read from an inventory file such as:
+ *
+ *   # port             tags
+ *   /dev/ttyUSB0       building-3 floor-2 lecture
+ *   /dev/ttyUSB1       building-3 floor-2 lab
+ *   group teaching     lecture lab
+ *
+ * A "group" line names a set of tags, groups or ports.  Every tag and group
+ * then names the ports it covers, as does "all" and each port's own path.
+ *
+ * A target expression combines names: "," joins sets, "&" keeps only ports
+ * in both, and "~" removes ports, so "building-3&floor-2,lab~/dev/ttyUSB9"
+ * is the ports both in building-3 and on floor-2, plus every lab except
+ * /dev/ttyUSB9.  "&" and "~" bind tighter than ",", and read left to right.
+ */
+class Inventory {
+
+    private:
+
+        /* Ports in inventory order. */
+        std::vector<std::string> m_ports;
+
+        /* Ports keyed by tag, group or port name. */
+        std::map<std::string, std::set<std::string>> m_names;
+
+        /* Group members as written, resolved once the file is read. */
+        std::map<std::string, std::vector<std::string>> m_groups;
+
+        void resolve(const std::string &group, std::set<std::string> &visiting);
+
+    public:
+
+        Inventory() = default;
+        explicit Inventory(std::istream &in);
+
+        const std::set<std::string> &members(const std::string &name) const;
+        const std::vector<std::string> &ports() const;
+        std::vector<std::string> select(const std::string &expression) const;
+
+};
+
+
+std::string default_inventory_path();
+std::vector<std::string> target_terms(const std::string &expression);
+
+
+#endif
@@ -20,12 +20,19 @@
 
 
 #include "lineal.h"
+#include "trace.h"
 
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
 #include <fcntl.h>
 #include <iostream>
+#include <poll.h>
 #include <string>
+#include <sys/ioctl.h>
 #include <system_error>
 #include <termios.h>
+#include <utility>
 
 
 // Wrap unistd to protect against compiler's confusion about Lineal class
@@ -37,26 +44,108 @@ namespace unistd {
 
 /* A wrapper around a Linux serial port.
  *
- * `serial_name` is the serial port path in the file system.
+ * `serial_name` is the serial port path in the file system.  `mode` chooses
+ * whether reads and writes may wait on the port.
  */
-Lineal::Lineal(std::string serial_name)
-    : m_serial { serial_name }
+Lineal::Lineal(std::string serial_name, Mode mode)
+    : m_serial { serial_name },
+      m_mode { mode }
 {
-    m_fd = open(m_serial.c_str(), O_RDWR | O_NOCTTY);
+    begin();
+}
+
+/* Takes over the port of `other`, which is left closed. */
+Lineal::Lineal(Lineal &&other) noexcept
+    : m_fd { std::exchange(other.m_fd, -1) },
+      m_serial { std::move(other.m_serial) },
+      m_mode { other.m_mode },
+      m_lock { std::move(other.m_lock) },
+      m_pacer { other.m_pacer },
+      m_outbox { std::move(other.m_outbox) },
+      m_saved { other.m_saved },
+      m_restore { std::exchange(other.m_restore, false) },
+      m_trace_port { other.m_trace_port },
+      m_skipped { other.m_skipped },
+      m_discards { other.m_discards },
+      m_inbox { other.m_inbox },
+      m_head { std::exchange(other.m_head, 0) },
+      m_tail { std::exchange(other.m_tail, 0) }
+{
+}
+
+/* Closes the serial port, restoring the settings it had before begin(). */
+Lineal::~Lineal() {
+    end();
+}
+
+/* Closes this port, then takes over the port of `other`, which is left
+ * closed.
+ */
+Lineal &Lineal::operator=(Lineal &&other) noexcept {
+    if ( this != &other ) {
+        end();
+        m_fd = std::exchange(other.m_fd, -1);
+        m_serial = std::move(other.m_serial);
+        m_mode = other.m_mode;
+        m_lock = std::move(other.m_lock);
+        m_pacer = other.m_pacer;
+        m_outbox = std::move(other.m_outbox);
+        m_saved = other.m_saved;
+        m_restore = std::exchange(other.m_restore, false);
+        m_trace_port = other.m_trace_port;
+        m_skipped = other.m_skipped;
+        m_discards = other.m_discards;
+        m_inbox = other.m_inbox;
+        m_head = std::exchange(other.m_head, 0);
+        m_tail = std::exchange(other.m_tail, 0);
+    }
+    return *this;
+}
+
+/* Returns the quantity of received bytes held for readUntil() and
+ * readFrame().
+ */
+std::size_t Lineal::available() const {
+    return m_tail - m_head;
+}
+
+/* Opens and configures the serial port.
+ *
+ * Any already open file descriptor is closed first, so begin() also serves
+ * to reopen a port after its device has been unplugged and re-enumerated.
+ *
+ * The port is locked against other processes first (see PortLock).  A
+ * blocking port waits its turn for up to PortLock::patience() milliseconds;
+ * a non-blocking one only takes a free port.
+ *
+ * Throws `std::system_error` if the port is in use, or cannot be opened or
+ * configured.
+ */
+void Lineal::begin() {
+    end();
+
+    m_lock = PortLock { m_serial, m_mode == Mode::Blocking ? PortLock::patience() : 0 };
+
+    auto nonblocking { m_mode == Mode::NonBlocking ? O_NONBLOCK : 0 };
+    m_fd = open(m_serial.c_str(), O_RDWR | O_NOCTTY | nonblocking);
     if ( m_fd < 0 ) {
-        throw std::system_error(std::error_code(errno, std::system_category()),
+        auto err { errno };
+        m_lock = PortLock {};
+        throw std::system_error(std::error_code(err, std::system_category()),
                                 std::string("serial port open failed"));
     }
+    // Keep out programs which ignore the lock, unless they run as root.
+    ioctl(m_fd, TIOCEXCL);
 
     // Configure the serial port via C functions.
     termios flags;
     if ( tcgetattr(m_fd, &flags) != 0 ) {
-        throw std::system_error(std::error_code(errno, std::system_category()),
-                                std::string("serial port configuration failed"));
+        fail("serial port configuration failed");
     }
+    m_saved = flags;
+    m_restore = true;
     if ( cfsetspeed(&flags, SERIAL_SPEED) != 0 ) {
-        throw std::system_error(std::error_code(errno, std::system_category()),
-                                std::string("serial port configuration failed"));
+        fail("serial port configuration failed");
     }
     // Set saint's serial port configuration to match cecil.
     flags.c_cflag |= (flags.c_cflag & SERIAL_DATABITS);
@@ -65,20 +154,154 @@ Lineal::Lineal(std::string serial_name)
     flags.c_cflag &= ~CRTSCTS;
     // Use noncanonical mode to avoid waiting for newline.
     flags.c_lflag &= ~(ICANON | ECHO | ECHOE | ISIG);
-    // Set non-blocking access with 10 decisecond (1 sec) timeout.
-    flags.c_cc[VMIN] = 0;
-    flags.c_cc[VTIME] = 10;
+    if ( m_mode == Mode::NonBlocking ) {
+        // No timeout, since O_NONBLOCK returns at once anyway.  VMIN must
+        // stay 1, or an empty port reads as end of file instead of EAGAIN.
+        flags.c_cc[VMIN] = 1;
+        flags.c_cc[VTIME] = 0;
+    } else {
+        // Set non-blocking access with 10 decisecond (1 sec) timeout.
+        flags.c_cc[VMIN] = 0;
+        flags.c_cc[VTIME] = 10;
+    }
 
     if ( tcsetattr(m_fd, TCSANOW, &flags) != 0 ) {
-        throw std::system_error(std::error_code(errno, std::system_category()),
-                                std::string("serial port configuration failed"));
+        fail("serial port configuration failed");
+    }
+}
+
+/* Drops all input, both held in the receive buffer and still pending in the
+ * port, so nothing already sent to us can pair with a later command.
+ */
+void Lineal::discard() {
+    m_head = m_tail = 0;
+    if ( m_fd > -1 ) {
+        tcflush(m_fd, TCIFLUSH);
+    }
+    ++m_discards;
+}
+
+/* Returns the times discard() has dropped the input. */
+std::size_t Lineal::discards() const {
+    return m_discards;
+}
+
+/* Closes the serial port, dropping any queued output and buffered input, and
+ * puts back the port settings found by begin().  Closing an already closed
+ * port does nothing.
+ */
+void Lineal::end() {
+    m_outbox.clear();
+    m_head = m_tail = 0;
+    if ( m_fd > -1 ) {
+        if ( m_restore ) {
+            tcsetattr(m_fd, TCSANOW, &m_saved);
+            m_restore = false;
+        }
+        unistd::close(m_fd);
+        m_fd = -1;
     }
+    m_lock = PortLock {};
+}
+
+/* Closes the serial port and throws `std::system_error` for the current
+ * `errno` with `what` as the description.
+ */
+void Lineal::fail(const char *what) {
+    auto err { errno };
+    end();
+    throw std::system_error(std::error_code(err, std::system_category()),
+                            std::string(what));
 }
 
 int Lineal::fd() {
     return m_fd;
 }
 
+/* Waits until `deadline` for input, then moves all the port has, up to the
+ * free space, into the receive buffer with a single read(2).  Returns the
+ * quantity of bytes added, which is `0` if none arrived in time.
+ *
+ * Buffered bytes are moved to the front of the buffer only when it has no
+ * room at the back, so views returned earlier stay valid until then.
+ *
+ * Throws `std::system_error` if the port fails or hangs up.
+ */
+std::size_t Lineal::fill(std::chrono::steady_clock::time_point deadline) {
+    if ( m_head == m_tail ) {
+        m_head = m_tail = 0;
+    } else if ( m_tail == m_inbox.size() && m_head > 0 ) {
+        std::memmove(m_inbox.data(), m_inbox.data() + m_head, m_tail - m_head);
+        m_tail -= m_head;
+        m_head = 0;
+    }
+    if ( m_tail == m_inbox.size() ) {
+        return 0;
+    }
+
+    pollfd pfd { m_fd, POLLIN, 0 };
+    int ready;
+    do {
+        // A signal, e.g. one asking for a trace dump, must not cut the wait.
+        auto wait { std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now()).count() };
+        ready = ::poll(&pfd, 1, wait > 0 ? static_cast<int>(wait) : 0);
+    } while ( ready < 0 && errno == EINTR );
+    if ( ready < 0 ) {
+        fail("serial port read failed");
+    }
+    if ( ready == 0 ) {
+        return 0;
+    }
+
+    auto ret { unistd::read(m_fd, m_inbox.data() + m_tail, m_inbox.size() - m_tail) };
+    traced(false, m_inbox.data() + m_tail, ret);
+    if ( ret < 0 ) {
+        if ( errno == EAGAIN || errno == EINTR ) {
+            return 0;
+        }
+        fail("serial port read failed");
+    }
+    if ( ret == 0 ) {
+        // The port polled readable yet had nothing: it has hung up.
+        errno = EIO;
+        fail("serial port read failed");
+    }
+    m_tail += ret;
+    return ret;
+}
+
+/* Writes as much output queued by writeQueued() as the port will take
+ * without waiting and returns the quantity of bytes written.
+ *
+ * The returned quantity `-1` indicates an error.
+ */
+ssize_t Lineal::flush() {
+    if ( m_outbox.empty() ) {
+        return 0;
+    }
+    auto ret { unistd::write(m_fd, m_outbox.data(), m_outbox.size()) };
+    if ( ret < 0 ) {
+        return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+    }
+    traced(true, m_outbox.data(), ret);
+    m_outbox.erase(0, ret);
+    return ret;
+}
+
+Lineal::Mode Lineal::mode() const {
+    return m_mode;
+}
+
+/* Returns the serial port path given at construction. */
+const std::string &Lineal::name() const {
+    return m_serial;
+}
+
+Pacer &Lineal::pacer() {
+    return m_pacer;
+}
+
 /* Returns the quantity of bytes read from the serial port.
  *
  * The returned quantity `-1` indicates an error.
@@ -87,7 +310,160 @@ int Lineal::fd() {
  * bytes expected to be read.
  */
 ssize_t Lineal::readBytes(char *buffer, std::size_t length) {
-    return unistd::read(m_fd, buffer, length);
+    if ( m_head < m_tail ) {
+        return take(buffer, length);
+    }
+    auto ret { unistd::read(m_fd, buffer, length) };
+    traced(false, buffer, ret);
+    return ret;
+}
+
+/* Returns the next frame from `start` through `end`, both included, waiting
+ * until `deadline` for it to arrive.  Bytes before `start` are line noise or
+ * leftovers from an earlier exchange and are dropped.
+ *
+ * The frame is a view into the receive buffer, valid until the next read
+ * from this port.  An empty view means no whole frame arrived in time; any
+ * partial frame stays buffered for the next call.  A `deadline` already
+ * past takes only what the port has without waiting.
+ *
+ * Throws `std::system_error` if the port fails or hangs up.
+ */
+std::string_view Lineal::readFrame(char start, char end,
+                                   std::chrono::steady_clock::time_point deadline) {
+    // bytes after m_head already searched for `end`
+    std::size_t scanned { 0 };
+    while ( true ) {
+        if ( scanned == 0 ) {
+            auto first { std::memchr(m_inbox.data() + m_head, start, available()) };
+            m_head = first ? static_cast<const char *>(first) - m_inbox.data() : m_tail;
+            scanned = m_head < m_tail ? 1 : 0;
+        }
+        auto last { std::memchr(m_inbox.data() + m_head + scanned, end, available() - scanned) };
+        if ( last != nullptr ) {
+            std::string_view frame { m_inbox.data() + m_head,
+                    static_cast<const char *>(last) - m_inbox.data() - m_head + 1 };
+            m_head += frame.size();
+            return frame;
+        }
+        scanned = available();
+        if ( available() == m_inbox.size() ) {
+            // Longer than any frame could be, so it never will be one.
+            m_head = m_tail;
+            scanned = 0;
+        }
+
+        if ( fill(deadline) == 0 ) {
+            return {};
+        }
+    }
+}
+
+/* Returns the received bytes up to and including `terminator`, waiting until
+ * `deadline` for it to arrive.  If the receive buffer fills first, its whole
+ * content is returned instead.
+ *
+ * The bytes are a view into the receive buffer, valid until the next read
+ * from this port.  An empty view means `terminator` did not arrive in time;
+ * the bytes before it stay buffered for the next call.  A `deadline` already
+ * past takes only what the port has without waiting.
+ *
+ * Throws `std::system_error` if the port fails or hangs up.
+ */
+std::string_view Lineal::readUntil(char terminator,
+                                   std::chrono::steady_clock::time_point deadline) {
+    // bytes after m_head already searched for `terminator`
+    std::size_t scanned { 0 };
+    while ( true ) {
+        auto found { std::memchr(m_inbox.data() + m_head + scanned, terminator,
+                                 available() - scanned) };
+        if ( found != nullptr || available() == m_inbox.size() ) {
+            auto stop { found ? static_cast<const char *>(found) - m_inbox.data() + 1 : m_tail };
+            std::string_view bytes { m_inbox.data() + m_head, stop - m_head };
+            m_head = stop;
+            return bytes;
+        }
+        scanned = available();
+
+        if ( fill(deadline) == 0 ) {
+            return {};
+        }
+    }
+}
+
+/* Returns the quantity of bytes read from the serial port without waiting.
+ *
+ * The returned quantity `0` means no bytes are available yet, and `-1`
+ * indicates an error.  A port which has hung up (e.g. an unplugged USB
+ * adapter) is an error with `errno` set to EIO.
+ *
+ * Intended for ports opened with Mode::NonBlocking.
+ */
+ssize_t Lineal::readAvailable(char *buffer, std::size_t length) {
+    if ( m_head < m_tail ) {
+        return take(buffer, length);
+    }
+    auto ret { unistd::read(m_fd, buffer, length) };
+    traced(false, buffer, ret);
+    if ( ret < 0 ) {
+        return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+    }
+    if ( ret == 0 && length > 0 ) {
+        // With O_NONBLOCK an empty port gives EAGAIN, so this is end of file.
+        errno = EIO;
+        return -1;
+    }
+    return ret;
+}
+
+/* Counts `frames` which a reply parser passed over as stale or damaged. */
+void Lineal::skip(int frames) {
+    m_skipped += frames;
+}
+
+/* Returns the frames counted by skip(). */
+std::size_t Lineal::skipped() const {
+    return m_skipped;
+}
+
+/* Copies up to `length` buffered bytes into `buffer`, removes them from the
+ * receive buffer and returns their quantity.
+ */
+ssize_t Lineal::take(char *buffer, std::size_t length) {
+    auto quantity { std::min(length, m_tail - m_head) };
+    std::memcpy(buffer, m_inbox.data() + m_head, quantity);
+    m_head += quantity;
+    return quantity;
+}
+
+/* Records `length` bytes at `bytes`, `sent` to or received from the port,
+ * in the active Trace if there is one.  A failed call, with a negative
+ * `length`, moved nothing and is not recorded.
+ */
+void Lineal::traced(bool sent, const char *bytes, ssize_t length) {
+    auto trace { Trace::active() };
+    if ( trace == nullptr || length <= 0 ) {
+        return;
+    }
+    if ( m_trace_port < 0 ) {
+        m_trace_port = trace->port(m_serial);
+    }
+    trace->record(m_trace_port, sent ? TraceDirection::Write : TraceDirection::Read,
+                  bytes, length);
+}
+
+/* Returns true if the port should be watched for input.
+ *
+ * An open port always should be, even between replies: stray bytes need
+ * draining and a hangup only shows up as readability.
+ */
+bool Lineal::wantRead() const {
+    return m_fd > -1;
+}
+
+/* Returns true if queued output is waiting for the port to accept it. */
+bool Lineal::wantWrite() const {
+    return m_fd > -1 && ! m_outbox.empty();
 }
 
 /* Returns the quantity of bytes written to the serial port.
@@ -101,5 +477,27 @@ ssize_t Lineal::write(const char *str, std::size_t size) {
     if ( str == nullptr ) {
         return 0;
     }
-    return unistd::write(m_fd, str, size);
+    auto ret { unistd::write(m_fd, str, size) };
+    traced(true, str, ret);
+    return ret;
+}
+
+/* Queues bytes for the serial port, writes as many as it will take without
+ * waiting and returns the quantity of bytes accepted.
+ *
+ * The returned quantity `-1` indicates an error.  Otherwise every byte is
+ * accepted and those not yet written go out with later calls to flush().
+ *
+ * The bytes to be written are in `str` and `size` is the number of bytes
+ * to write.
+ */
+ssize_t Lineal::writeQueued(const char *str, std::size_t size) {
+    if ( str == nullptr ) {
+        return 0;
+    }
+    m_outbox.append(str, size);
+    if ( flush() < 0 ) {
+        return -1;
+    }
+    return size;
 }
@@ -22,7 +22,13 @@
 #ifndef LINEAL_H
 #define LINEAL_H true
 
+#include "pacer.h"
+#include "portlock.h"
+
+#include <array>
+#include <chrono>
 #include <string>
+#include <string_view>
 #include <termios.h>
 
 
@@ -33,6 +39,13 @@
  */
 constexpr int POLL_TIMEOUT { 1000 / 5 };
 
+/* Size, in bytes, of the receive buffer behind readUntil() and readFrame().
+ *
+ * Far more than a projector reply, so one read(2) usually takes all that has
+ * arrived.
+ */
+constexpr std::size_t RECEIVE_BUFFER { 512 };
+
 /* The following SERIAL_* values should match the settings for SERIAL_SPEED
  * and SERIAL_CONF in cecil.h.  Match the concepts, not the naive values.
  * For example, B9600 = 15, but means the serial port should run at 9600 bps.
@@ -54,6 +67,18 @@ constexpr auto SERIAL_STOPBITS { ~CSTOPB };
 /* A minimally compatible interface like Arduino Serial, but for Linux. */
 class Lineal {
 
+    public:
+
+        /* How reads and writes wait on the serial port. */
+        enum class Mode {
+            // reads wait up to one second for data, writes until done
+            Blocking,
+            // nothing waits; use readAvailable() or readFrame() with a past
+            // deadline, and writeQueued(), from an event loop watching for
+            // wantRead() and wantWrite()
+            NonBlocking,
+        };
+
     private:
 
         /* Begin with an invalid file descriptor. */
@@ -62,13 +87,76 @@ class Lineal {
         /* Path to the serial port. */
         std::string m_serial;
 
-    public:
+        Mode m_mode { Mode::Blocking };
+
+        /* Held while the port is open, so other processes wait their turn. */
+        PortLock m_lock;
 
-        Lineal(std::string serial_name);
+        /* Pace of commands this link keeps up with, learned as it is used. */
+        Pacer m_pacer;
+
+        /* Bytes accepted by writeQueued() but not yet taken by the port. */
+        std::string m_outbox;
+
+        /* Port settings found at begin(), put back by end(). */
+        termios m_saved {};
+        bool m_restore { false };
+
+        /* Index of this port in the active Trace, or -1 until traced. */
+        int m_trace_port { -1 };
+
+        /* Frames passed over as stale or damaged (see skip()), and times
+         * the input was discarded.
+         */
+        std::size_t m_skipped { 0 };
+        std::size_t m_discards { 0 };
+
+        /* Bytes received but not yet handed out lie in [m_head, m_tail). */
+        std::array<char, RECEIVE_BUFFER> m_inbox;
+        std::size_t m_head { 0 };
+        std::size_t m_tail { 0 };
+
+        std::size_t fill(std::chrono::steady_clock::time_point deadline);
+        ssize_t take(char *buffer, std::size_t length);
+        void traced(bool sent, const char *bytes, ssize_t length);
+
+        [[noreturn]] void fail(const char *what);
+
+    public:
 
+        /* A closed port, to move an open one into later. */
+        Lineal() = default;
+        Lineal(std::string serial_name, Mode mode = Mode::Blocking);
+        ~Lineal();
+
+        /* A Lineal owns its file descriptor, so it may move but not copy. */
+        Lineal(const Lineal &) = delete;
+        Lineal &operator=(const Lineal &) = delete;
+        Lineal(Lineal &&other) noexcept;
+        Lineal &operator=(Lineal &&other) noexcept;
+
+        std::size_t available() const;
+        void begin();
+        void discard();
+        std::size_t discards() const;
+        void end();
         int fd();
+        ssize_t flush();
+        Mode mode() const;
+        const std::string &name() const;
+        Pacer &pacer();
+        ssize_t readAvailable(char *buffer, std::size_t length);
         ssize_t readBytes(char *buffer, std::size_t length);
+        std::string_view readFrame(char start, char end,
+                                   std::chrono::steady_clock::time_point deadline);
+        std::string_view readUntil(char terminator,
+                                   std::chrono::steady_clock::time_point deadline);
+        void skip(int frames);
+        std::size_t skipped() const;
+        bool wantRead() const;
+        bool wantWrite() const;
         ssize_t write(const char *str, std::size_t size);
+        ssize_t writeQueued(const char *str, std::size_t size);
 
         /* Returns true if the internal file descriptor holds a valid value. */
         operator bool() const {
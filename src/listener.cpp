@@ -0,0 +1,191 @@
+/*
+    listener.cpp - sockets for the daemon and its clients
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include "listener.h"
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <netinet/in.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <system_error>
+#include <unistd.h>
+
+
+/* Fills `where` and `size` with the socket address of `address` (see
+ * listen_on) and returns true if it is a Unix socket.
+ *
+ * Throws `std::runtime_error` naming `what` for a malformed address.
+ */
+static bool socket_address(const std::string &address, const std::string &what,
+                           sockaddr_storage &where, socklen_t &size) {
+    auto bad { std::runtime_error("Bad " + what + " address '" + address + "'.") };
+    bool local { address.rfind("unix:", 0) == 0 || address.find('/') != std::string::npos };
+
+    if ( local ) {
+        auto path { address.rfind("unix:", 0) == 0 ? address.substr(5) : address };
+        auto &un { reinterpret_cast<sockaddr_un &>(where) };
+        if ( path.empty() || path.size() >= sizeof(un.sun_path) ) {
+            throw bad;
+        }
+        un.sun_family = AF_UNIX;
+        std::memcpy(un.sun_path, path.c_str(), path.size() + 1);
+        size = sizeof(un);
+        return true;
+    }
+
+    std::string host { "127.0.0.1" }, port { address };
+    if ( auto colon { address.rfind(':') }; colon != std::string::npos ) {
+        host = address.substr(0, colon);
+        port = address.substr(colon + 1);
+    }
+    auto &in { reinterpret_cast<sockaddr_in &>(where) };
+    in.sin_family = AF_INET;
+    try {
+        std::size_t used;
+        auto number { std::stoi(port, &used) };
+        if ( used != port.size() || number < 0 || number > 65535 ) {
+            throw bad;
+        }
+        in.sin_port = htons(number);
+    } catch ( const std::logic_error &e ) {
+        throw bad;
+    }
+    if ( inet_pton(AF_INET, host.c_str(), &in.sin_addr) != 1 ) {
+        throw bad;
+    }
+    size = sizeof(in);
+    return false;
+}
+
+
+/* Returns a blocking socket connected to `address`, given as for
+ * listen_on().  `what` names the connection in errors, e.g. "control".
+ *
+ * Throws `std::runtime_error` for a malformed address, or
+ * `std::system_error` if it cannot be connected to.
+ */
+int connect_to(const std::string &address, const std::string &what) {
+    sockaddr_storage where {};
+    socklen_t size { 0 };
+    socket_address(address, what, where, size);
+
+    auto fd { socket(where.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0) };
+    if ( fd < 0 ) {
+        throw std::system_error(std::error_code(errno, std::system_category()),
+                                what + " socket failed");
+    }
+    if ( connect(fd, reinterpret_cast<sockaddr *>(&where), size) != 0 ) {
+        auto err { errno };
+        close(fd);
+        throw std::system_error(std::error_code(err, std::system_category()),
+                                what + " connect failed");
+    }
+    return fd;
+}
+
+/* Returns a non-blocking socket listening on `address`, which is either a
+ * Unix socket, "unix:PATH" or any path containing '/', or a TCP address,
+ * "port" or "host:port" with a numeric IPv4 host, 127.0.0.1 by default.
+ * TCP port 0 picks a free port.  A Unix socket left behind by an earlier
+ * run is replaced.
+ *
+ * `what` names the listener in errors, e.g. "HTTP".
+ *
+ * Throws `std::runtime_error` for a malformed address, or
+ * `std::system_error` if it cannot be listened on.
+ */
+int listen_on(const std::string &address, const std::string &what) {
+    sockaddr_storage where {};
+    socklen_t size { 0 };
+    bool local { socket_address(address, what, where, size) };
+
+    if ( local ) {
+        const auto *path { reinterpret_cast<sockaddr_un &>(where).sun_path };
+        struct stat st;
+        if ( lstat(path, &st) == 0 && S_ISSOCK(st.st_mode) ) {
+            unlink(path);
+        }
+    }
+
+    auto fd { socket(where.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0) };
+    if ( fd < 0 ) {
+        throw std::system_error(std::error_code(errno, std::system_category()),
+                                what + " socket failed");
+    }
+    int on { 1 };
+    if ( ! local ) {
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    }
+    if ( bind(fd, reinterpret_cast<sockaddr *>(&where), size) != 0
+            || listen(fd, SOMAXCONN) != 0 ) {
+        auto err { errno };
+        close(fd);
+        throw std::system_error(std::error_code(err, std::system_category()),
+                                what + " listen failed");
+    }
+    return fd;
+}
+
+/* Returns who is at the other end of connected socket `fd`: the address and
+ * port of a TCP peer, e.g. "127.0.0.1:40312" or "[::1]:40312", or "uid N
+ * pid P" for the process of a Unix socket peer, or "" if that cannot be
+ * told.
+ */
+std::string peer_name(int fd) {
+    sockaddr_storage where {};
+    socklen_t size { sizeof(where) };
+    if ( getpeername(fd, reinterpret_cast<sockaddr *>(&where), &size) < 0 ) {
+        return "";
+    }
+
+    if ( where.ss_family == AF_UNIX ) {
+        ucred credentials {};
+        socklen_t length { sizeof(credentials) };
+        if ( getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &length) < 0 ) {
+            return "";
+        }
+        return "uid " + std::to_string(credentials.uid)
+             + " pid " + std::to_string(credentials.pid);
+    }
+
+    char text[ INET6_ADDRSTRLEN ] {};
+    const void *address { nullptr };
+    uint16_t port { 0 };
+    if ( where.ss_family == AF_INET ) {
+        address = &reinterpret_cast<sockaddr_in &>(where).sin_addr;
+        port = ntohs(reinterpret_cast<sockaddr_in &>(where).sin_port);
+    } else if ( where.ss_family == AF_INET6 ) {
+        address = &reinterpret_cast<sockaddr_in6 &>(where).sin6_addr;
+        port = ntohs(reinterpret_cast<sockaddr_in6 &>(where).sin6_port);
+    }
+    if ( ! address || ! inet_ntop(where.ss_family, address, text, sizeof(text)) ) {
+        return "";
+    }
+    if ( where.ss_family == AF_INET6 ) {
+        return '[' + std::string(text) + "]:" + std::to_string(port);
+    }
+    return std::string(text) + ':' + std::to_string(port);
+}
@@ -0,0 +1,90 @@
+/*
+    pacer.cpp - adaptive pacing of commands on one serial link
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include "pacer.h"
+
+#include <algorithm>
+#include <thread>
+
+
+/* Returns the exchanges in the window which were not answered. */
+int Pacer::failures() const {
+    auto count { std::min(m_samples, PACE_WINDOW) };
+    return std::count_if(m_window.begin(), m_window.begin() + count, [](const Sample &sample) {
+        return sample.outcome != Outcome::Answered;
+    });
+}
+
+/* Returns the time currently left between exchanges. */
+std::chrono::microseconds Pacer::gap() const {
+    return m_gap;
+}
+
+/* Returns the earliest time the next frame may be sent. */
+std::chrono::steady_clock::time_point Pacer::ready() const {
+    return m_last + m_gap;
+}
+
+/* Records an exchange which just ended with `outcome` after `round_trip`,
+ * and adjusts the gap.
+ */
+void Pacer::record(std::chrono::microseconds round_trip, Outcome outcome) {
+    m_window[ m_samples++ % PACE_WINDOW ] = Sample { round_trip, outcome };
+    m_last = std::chrono::steady_clock::now();
+
+    if ( outcome == Outcome::Lost ) {
+        return;
+    }
+    if ( outcome == Outcome::Refused ) {
+        std::chrono::microseconds least { std::chrono::milliseconds(PACE_MIN_STEP) };
+        std::chrono::microseconds most { std::chrono::milliseconds(PACE_MAX_GAP) };
+        m_gap = std::min(std::max({ m_gap * 2, rtt(), least }), most);
+        return;
+    }
+
+    auto count { static_cast<int>(std::min(m_samples, PACE_WINDOW)) };
+    if ( failures() * 100 <= count * PACE_TOLERANCE ) {
+        std::chrono::microseconds step { std::chrono::milliseconds(1) };
+        m_gap = std::max(m_gap - std::max(rtt() / PACE_DECREASE, step),
+                         std::chrono::microseconds::zero());
+    }
+}
+
+/* Returns the mean round trip of the answered exchanges in the window, or
+ * zero if there are none.
+ */
+std::chrono::microseconds Pacer::rtt() const {
+    std::chrono::microseconds total { 0 };
+    int answered { 0 };
+    auto count { std::min(m_samples, PACE_WINDOW) };
+    for ( std::size_t i { 0 }; i < count; ++i ) {
+        if ( m_window[i].outcome == Outcome::Answered ) {
+            total += m_window[i].rtt;
+            ++answered;
+        }
+    }
+    return answered > 0 ? total / answered : total;
+}
+
+/* Sleeps until the next frame may be sent. */
+void Pacer::wait() const {
+    std::this_thread::sleep_until(ready());
+}
@@ -0,0 +1,106 @@
+/*
+    pacer.h - adaptive pacing of commands on one serial link
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#ifndef PACER_H
+#define PACER_H true
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+
+
+/* Latest exchanges, in number, which the pace is judged on. */
+constexpr std::size_t PACE_WINDOW { 16 };
+
+/* Longest gap, in milliseconds, left between commands on a struggling link. */
+constexpr int PACE_MAX_GAP { 2000 };
+
+/* Gap, in milliseconds, opened by the first refusal on a link measured to
+ * be faster than this.
+ */
+constexpr int PACE_MIN_STEP { 10 };
+
+/* Each answered exchange takes this fraction of the mean round trip, or a
+ * millisecond if that is more, off the gap.
+ */
+constexpr int PACE_DECREASE { 8 };
+
+/* Percentage of failed exchanges in the window above which the gap stops
+ * closing.
+ */
+constexpr int PACE_TOLERANCE { 10 };
+
+
+/* How one exchange on a link ended, as far as pacing is concerned. */
+enum class Outcome {
+    // answered, even if with a refusal which has nothing to do with pace
+    Answered,
+    // no usable answer: lost or garbled on the line, or the port failed
+    Lost,
+    // refused by a projector which was busy, as when sent commands faster
+    // than it takes them; "Illegal format" is not counted, since it is also
+    // the projector's settled answer to a misspelled command or argument,
+    // and one typo must not slow the link
+    Refused,
+};
+
+
+/* Spaces the commands sent on one serial link to the rate it keeps up with.
+ *
+ * Every exchange, from sending a frame to its answer or failure, is
+ * recorded with its Outcome and round trip time.  The gap left after an
+ * exchange before the next frame goes out follows AIMD: a refusal doubles
+ * the gap, at least to the mean round trip, while each answer closes it a
+ * little, as long as few of the recent exchanges failed.  Lost exchanges
+ * only count as failures, since line noise is no reason to slow down.  A
+ * link which is never refused is never slowed.
+ */
+class Pacer {
+
+    private:
+
+        struct Sample {
+            std::chrono::microseconds rtt { 0 };
+            Outcome outcome { Outcome::Answered };
+        };
+
+        /* Ring of the latest samples; m_samples counts every sample taken. */
+        std::array<Sample, PACE_WINDOW> m_window {};
+        std::size_t m_samples { 0 };
+
+        std::chrono::microseconds m_gap { 0 };
+
+        /* When the latest exchange ended. */
+        std::chrono::steady_clock::time_point m_last {};
+
+    public:
+
+        int failures() const;
+        std::chrono::microseconds gap() const;
+        std::chrono::steady_clock::time_point ready() const;
+        void record(std::chrono::microseconds round_trip, Outcome outcome);
+        std::chrono::microseconds rtt() const;
+        void wait() const;
+
+};
+
+
+#endif
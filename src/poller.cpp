@@ -0,0 +1,138 @@
+/*
+    poller.cpp - periodic projector status polling
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include "poller.h"
+#include "bewield.h"
+#include "decode.h"
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <system_error>
+
+
+/* Registers every port on `board` with `ports`.  Changes of state also go
+ * to `history`, if given.
+ */
+Poller::Poller(Board &board, PortManager &ports, int interval_ms, HistoryWriter *history)
+    : m_board { board },
+      m_ports { ports },
+      m_interval { interval_ms },
+      m_history { history },
+      m_states(board.ports())
+{
+    for ( std::size_t i { 0 }; i < m_board.ports(); ++i ) {
+        m_ports.add(m_board.port(i));
+        m_states[i].volume = -1;
+    }
+}
+
+/* Folds the outcome of one poll query into the board record at `index`.
+ *
+ * A projector error (e.g. "Block item" while powered off) marks only that
+ * field unknown.  A serial port error marks the whole port offline.
+ */
+void Poller::record(std::size_t index, const Result &result) {
+    auto &state { m_states[index] };
+    if ( m_history ) {
+        m_history->record(result);
+    }
+
+    if ( result.error ) {
+        try {
+            std::rethrow_exception(result.error);
+        } catch ( const std::system_error &e ) {
+            state.flags &= ~BOARD_ONLINE;
+        } catch ( ... ) {
+            state.flags |= BOARD_ONLINE;
+        }
+    } else {
+        state.flags |= BOARD_ONLINE;
+    }
+
+    // The command names the field even when there is no reply to decode.
+    auto field { decode(commands.at(result.cmd)).key };
+    auto reply { result.decoded() };
+    auto value { result.error ? Value::Unknown : reply.value };
+
+    switch ( field ) {
+        case Key::Power:
+            state.power = static_cast<uint8_t>(value);
+            break;
+        case Key::Source:
+            state.source = static_cast<uint8_t>(value);
+            break;
+        case Key::Blank:
+            state.blank = static_cast<uint8_t>(value);
+            break;
+        case Key::Volume:
+            state.volume = value == Value::Number ? reply.number : -1;
+            break;
+        default:
+            break;
+    }
+
+    auto now { std::chrono::system_clock::now().time_since_epoch() };
+    state.updated = std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+
+    m_board.write(index, state);
+}
+
+/* Polls every `m_interval` until `stop` becomes non-zero. */
+void Poller::run(const volatile std::sig_atomic_t &stop) {
+    auto next { std::chrono::steady_clock::now() };
+    while ( ! stop ) {
+        auto now { std::chrono::steady_clock::now() };
+        if ( now >= next ) {
+            tick();
+            next += m_interval;
+            // Skip, rather than burst through, polls missed while busy.
+            if ( next < now ) {
+                next = now + m_interval;
+            }
+        }
+        auto wait { std::chrono::duration_cast<std::chrono::milliseconds>(next - now) };
+        m_ports.update(std::max<int>(wait.count(), 0));
+    }
+}
+
+/* Queues one round of POLL_QUERIES for every port not still busy with the
+ * previous round.
+ */
+void Poller::tick() {
+    for ( std::size_t i { 0 }; i < m_board.ports(); ++i ) {
+        auto path { m_board.port(i) };
+        if ( ! m_ports.connected(path) && (m_states[i].flags & BOARD_ONLINE) ) {
+            m_states[i].flags &= ~BOARD_ONLINE;
+            m_board.write(i, m_states[i]);
+            if ( m_history ) {
+                m_history->offline(path);
+            }
+        }
+        if ( m_ports.pending(path) > 0 ) {
+            continue;
+        }
+        for ( const auto &cmd : POLL_QUERIES ) {
+            m_ports.submit(path, cmd,
+                [this, i](const Result &result) { record(i, result); });
+        }
+    }
+}
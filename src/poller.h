@@ -0,0 +1,75 @@
+/*
+    poller.h - periodic projector status polling
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#ifndef POLLER_H
+#define POLLER_H true
+
+#include "board.h"
+#include "history.h"
+#include "portman.h"
+
+#include <chrono>
+#include <csignal>
+#include <string>
+#include <vector>
+
+
+/* Default interval, in milliseconds, between polls of each projector. */
+constexpr int POLL_INTERVAL { 5000 };
+
+/* Commands sent on every poll.  Each fills one BoardState field. */
+inline const std::vector<std::string> POLL_QUERIES {
+    "query_power",
+    "query_source",
+    "query_audio_volume",
+    "query_blank",
+};
+
+
+/* Keeps a status board current by periodically querying every port on it. */
+class Poller {
+
+    private:
+
+        Board &m_board;
+        PortManager &m_ports;
+        std::chrono::milliseconds m_interval;
+
+        /* Where changes of state are kept, if anywhere. */
+        HistoryWriter *m_history;
+
+        /* Working copy of each board record, indexed like the board. */
+        std::vector<BoardState> m_states;
+
+        void record(std::size_t index, const Result &result);
+
+    public:
+
+        Poller(Board &board, PortManager &ports, int interval_ms,
+               HistoryWriter *history = nullptr);
+
+        void run(const volatile std::sig_atomic_t &stop);
+        void tick();
+
+};
+
+
+#endif
@@ -0,0 +1,264 @@
+/*
+    portlock.cpp - first come, first served serial port locks between processes
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include "portlock.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <set>
+#include <sys/file.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+#include <utility>
+
+
+int PortLock::s_patience { LOCK_WAIT };
+
+
+[[noreturn]] static void fail(const char *what) {
+    throw std::system_error(std::error_code(errno, std::system_category()), what);
+}
+
+/* Makes directory `path`, if missing, for every user to share. */
+static bool shared_dir(const std::string &path) {
+    if ( mkdir(path.c_str(), 0777) == 0 ) {
+        // Sticky, as /tmp is, so users only remove their own tickets.
+        chmod(path.c_str(), 01777);
+    } else if ( errno != EEXIST ) {
+        return false;
+    }
+    return access(path.c_str(), W_OK | X_OK) == 0;
+}
+
+/* Returns the queue directory for `device`, making it if needed.
+ *
+ * Throws `std::system_error` if no LOCK_DIRS entry is usable.
+ */
+static std::string queue_dir(const std::string &device) {
+    std::string key { device };
+    if ( char resolved[ PATH_MAX ]; realpath(device.c_str(), resolved) ) {
+        key = resolved;
+    }
+    std::replace(key.begin(), key.end(), '/', '_');
+
+    for ( const auto &base : LOCK_DIRS ) {
+        auto top { base + "/bewield" };
+        if ( shared_dir(top) && shared_dir(top + "/" + key) ) {
+            return top + "/" + key;
+        }
+    }
+    fail("serial port lock directory unavailable");
+}
+
+/* Returns the tickets in `dir` numbered below `ticket`, in order. */
+static std::vector<std::string> ahead_of(const std::string &dir, const std::string &ticket) {
+    std::vector<std::string> names;
+    auto *listing { opendir(dir.c_str()) };
+    if ( ! listing ) {
+        fail("serial port lock failed");
+    }
+    while ( auto *entry { readdir(listing) } ) {
+        std::string name { entry->d_name };
+        if ( name.size() == ticket.size() && name < ticket
+                && name.find_first_not_of("0123456789") == std::string::npos ) {
+            names.push_back(name);
+        }
+    }
+    closedir(listing);
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+/* Joins the queue in `dir`, setting `ticket` to the name of the ticket
+ * taken and returning its descriptor, locked.
+ *
+ * The counter stays locked until the ticket exists, so a later ticket never
+ * looks for those ahead of it before this one is there to be found.
+ */
+static int take_ticket(const std::string &dir, std::string &ticket) {
+    auto counter { open((dir + "/next").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666) };
+    if ( counter < 0 ) {
+        fail("serial port lock failed");
+    }
+    fchmod(counter, 0666);
+
+    int fd { -1 };
+    if ( flock(counter, LOCK_EX) == 0 ) {
+        char text[ 32 ] {};
+        auto length { pread(counter, text, sizeof(text) - 1, 0) };
+        unsigned long long number { length > 0 ? std::strtoull(text, nullptr, 10) : 0 };
+        std::snprintf(text, sizeof(text), "%020llu", number + 1);
+        ticket = text;
+
+        // The ticket appears only once locked, so nobody takes it for stale.
+        auto draft { dir + "/" + ticket + ".new" };
+        fd = open(draft.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        if ( fd > -1 && (pwrite(counter, text, 20, 0) != 20 || flock(fd, LOCK_EX) != 0
+                         || rename(draft.c_str(), (dir + "/" + ticket).c_str()) != 0) ) {
+            auto err { errno };
+            unlink(draft.c_str());
+            close(fd);
+            fd = -1;
+            errno = err;
+        }
+        if ( fd > -1 ) {
+            fchmod(fd, 0666);
+        }
+    }
+    auto err { errno };
+    // Closing drops the flock.
+    close(counter);
+    if ( fd < 0 ) {
+        errno = err;
+        fail("serial port lock failed");
+    }
+    return fd;
+}
+
+
+/* Takes the lock for `device`, waiting up to `wait_ms` milliseconds for the
+ * processes queued ahead to finish with it.  A `wait_ms` of 0 only takes a
+ * free lock.
+ *
+ * Throws `std::system_error` with `std::errc::device_or_resource_busy` if
+ * the wait runs out, or for any other failure.
+ */
+PortLock::PortLock(const std::string &device, int wait_ms) {
+    auto dir { queue_dir(device) };
+    std::string ticket;
+    m_ticket = take_ticket(dir, ticket);
+    m_path = dir + "/" + ticket;
+
+    auto watcher { inotify_init1(IN_NONBLOCK | IN_CLOEXEC) };
+    if ( watcher > -1 ) {
+        inotify_add_watch(watcher, dir.c_str(), IN_DELETE | IN_MOVED_FROM);
+    }
+    auto deadline { std::chrono::steady_clock::now() + std::chrono::milliseconds(wait_ms) };
+
+    // Stale tickets which could not be removed, such as another user's in
+    // the sticky queue directory, and so count as gone.
+    std::set<std::string> cleared;
+    while ( true ) {
+        std::vector<std::string> ahead;
+        try {
+            ahead = ahead_of(dir, ticket);
+        } catch ( ... ) {
+            if ( watcher > -1 ) {
+                close(watcher);
+            }
+            release();
+            throw;
+        }
+        ahead.erase(std::remove_if(ahead.begin(), ahead.end(), [&](const std::string &name) {
+            return cleared.count(name) > 0;
+        }), ahead.end());
+        if ( ahead.empty() ) {
+            break;
+        }
+
+        // A ticket nobody holds was left by a process which died.  Each pass
+        // through here removes or clears one, so this ends.
+        auto path { dir + "/" + ahead.back() };
+        auto other { open(path.c_str(), O_RDONLY | O_CLOEXEC) };
+        if ( other > -1 && flock(other, LOCK_EX | LOCK_NB) == 0 ) {
+            if ( unlink(path.c_str()) != 0 ) {
+                cleared.insert(ahead.back());
+            }
+            close(other);
+            continue;
+        }
+        if ( other > -1 ) {
+            close(other);
+        }
+
+        auto left { std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now()).count() };
+        if ( left <= 0 ) {
+            if ( watcher > -1 ) {
+                close(watcher);
+            }
+            release();
+            throw std::system_error(std::make_error_code(std::errc::device_or_resource_busy),
+                                    "serial port in use by another process");
+        }
+
+        pollfd pfd { watcher, POLLIN, 0 };
+        poll(&pfd, watcher > -1 ? 1 : 0, std::min<long long>(left, LOCK_CHECK_INTERVAL));
+        char events[ 4096 ];
+        while ( watcher > -1 && read(watcher, events, sizeof(events)) > 0 ) {
+        }
+    }
+
+    if ( watcher > -1 ) {
+        close(watcher);
+    }
+}
+
+PortLock::~PortLock() {
+    release();
+}
+
+/* Takes over the lock of `other`, which is left holding nothing. */
+PortLock::PortLock(PortLock &&other) noexcept
+    : m_ticket { std::exchange(other.m_ticket, -1) },
+      m_path { std::move(other.m_path) }
+{
+}
+
+/* Releases this lock, then takes over the lock of `other`. */
+PortLock &PortLock::operator=(PortLock &&other) noexcept {
+    if ( this != &other ) {
+        release();
+        m_ticket = std::exchange(other.m_ticket, -1);
+        m_path = std::move(other.m_path);
+    }
+    return *this;
+}
+
+/* Returns the milliseconds a blocking port open waits for the port. */
+int PortLock::patience() {
+    return s_patience;
+}
+
+/* Sets the milliseconds a blocking port open waits for the port. */
+void PortLock::patience(int wait_ms) {
+    s_patience = std::max(wait_ms, 0);
+}
+
+/* Leaves the queue, waking the process next in line. */
+void PortLock::release() {
+    if ( m_ticket > -1 ) {
+        // Remove the ticket while it is still locked, so no one takes it
+        // for stale and no one new waits on it.
+        unlink(m_path.c_str());
+        close(m_ticket);
+        m_ticket = -1;
+    }
+}
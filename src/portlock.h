@@ -0,0 +1,92 @@
+/*
+    portlock.h - first come, first served serial port locks between processes
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#ifndef PORTLOCK_H
+#define PORTLOCK_H true
+
+#include <string>
+#include <vector>
+
+
+/* Milliseconds a port open waits, by default, for other processes to finish
+ * with the port.
+ */
+constexpr int LOCK_WAIT { 30000 };
+
+/* Longest wait, in milliseconds, between checks that the holder of a lock
+ * is still alive.  Releases wake waiters at once; this only bounds how long
+ * a lock left by a crashed process lingers.
+ */
+constexpr int LOCK_CHECK_INTERVAL { 100 };
+
+/* Directories for lock queues, the first writable one is used. */
+inline const std::vector<std::string> LOCK_DIRS { "/run/lock", "/var/lock", "/tmp" };
+
+
+/* Exclusive use of a serial port among processes, granted first come,
+ * first served.
+ *
+ * Each device has a queue directory, e.g. /run/lock/bewield/_dev_ttyUSB0,
+ * named after the device's real path so every alias of it shares one queue.
+ * A process joins the queue by taking the next numbered ticket, a file it
+ * holds flock(2) on for as long as it waits or owns the port, and owns the
+ * port once no ticket below its own remains.  A waiter watches the ticket
+ * ahead of it with inotify, so it wakes as soon as that ticket is released;
+ * a ticket whose flock is free was left by a process which died, and is
+ * cleared away by whoever finds it.
+ */
+class PortLock {
+
+    private:
+
+        /* Milliseconds blocking opens wait, see patience(). */
+        static int s_patience;
+
+        /* Our ticket, locked, or -1 when holding nothing. */
+        int m_ticket { -1 };
+        std::string m_path;
+
+        void release();
+
+    public:
+
+        /* Holds no lock. */
+        PortLock() = default;
+        PortLock(const std::string &device, int wait_ms);
+        ~PortLock();
+
+        PortLock(const PortLock &) = delete;
+        PortLock &operator=(const PortLock &) = delete;
+        PortLock(PortLock &&other) noexcept;
+        PortLock &operator=(PortLock &&other) noexcept;
+
+        static int patience();
+        static void patience(int wait_ms);
+
+        /* Returns true while the lock is held. */
+        operator bool() const {
+            return m_ticket > -1;
+        }
+
+};
+
+
+#endif
@@ -0,0 +1,585 @@
+/*
+    portman.cpp - hot-plug aware management of serial ports
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include "portman.h"
+#include "exchange.h"
+#include "bewield.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <poll.h>
+#include <stdexcept>
+#include <string>
+#include <sys/inotify.h>
+#include <system_error>
+#include <termios.h>
+#include <unistd.h>
+
+
+/* inotify events which may change whether a device node can be opened. */
+constexpr uint32_t WATCH_EVENTS {
+    IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB
+    | IN_DELETE_SELF | IN_MOVE_SELF
+};
+
+
+/* Returns the directory part of `path`, or "." for a bare file name. */
+static std::string dirname_of(const std::string &path) {
+    auto slash { path.rfind('/') };
+    if ( slash == std::string::npos ) {
+        return ".";
+    }
+    return slash == 0 ? "/" : path.substr(0, slash);
+}
+
+/* Returns the file name part of `path`. */
+static std::string basename_of(const std::string &path) {
+    auto slash { path.rfind('/') };
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+/* Returns a serial port failure for the current `errno`, ready to conclude
+ * a job with.
+ */
+static std::exception_ptr port_failure(const char *what) {
+    return std::make_exception_ptr(std::system_error(
+            std::error_code(errno, std::system_category()), what));
+}
+
+
+/* Throws `std::system_error` if inotify is not available. */
+PortManager::PortManager()
+    : m_next_rescan { std::chrono::steady_clock::now() }
+{
+    m_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if ( m_inotify < 0 ) {
+        throw std::system_error(std::error_code(errno, std::system_category()),
+                                std::string("inotify setup failed"));
+    }
+}
+
+PortManager::~PortManager() {
+    close(m_inotify);
+}
+
+/* Completes every command waiting on the closed port at `path` with
+ * `error`, rather than waiting for its device to return.  An open port is
+ * left alone.
+ */
+void PortManager::abandon(const std::string &path, std::exception_ptr error) {
+    auto it { m_ports.find(path) };
+    if ( it == m_ports.end() || it->second.serial ) {
+        return;
+    }
+
+    // Completions may queue more commands, which stay queued.
+    auto jobs { std::move(it->second.queue) };
+    it->second.queue.clear();
+    auto now { std::chrono::steady_clock::now() };
+    for ( auto &job : jobs ) {
+        Result result { path, job.cmd, "", error, job.attempts };
+        if ( job.attempts > 0 ) {
+            result.latency = std::chrono::duration_cast<std::chrono::microseconds>(
+                    now - job.start);
+        }
+        if ( job.done ) {
+            job.done(result);
+        }
+    }
+}
+
+/* Registers the serial port at `path` and opens it if its device is present.
+ *
+ * Registering an already registered port does nothing.
+ */
+void PortManager::add(const std::string &path) {
+    if ( m_ports.count(path) ) {
+        return;
+    }
+    auto &port { m_ports[path] };
+    watch(path, port);
+    connect(path, port);
+}
+
+/* Finishes the front job of `port` with `reply` or `error`.
+ *
+ * A job whose open port failed underneath it is put back at the head of the
+ * queue, up to MAX_REQUEUE times and while its deadline has not passed, and
+ * the port is closed until its device returns.  A retryable() failure is
+ * sent again while the job has retries left.  Every other outcome completes
+ * the job.
+ */
+void PortManager::conclude(const std::string &path, Port &port,
+                           const std::string &reply, std::exception_ptr error) {
+    auto &job { port.queue.front() };
+    if ( port.busy && port.serial ) {
+        port.serial->pacer().record(std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - port.sent), outcome(error));
+    }
+    if ( port.matcher && port.serial ) {
+        resynchronize(*port.serial, *port.matcher, error != nullptr);
+    }
+    port.busy = false;
+    port.matcher.reset();
+
+    if ( error ) {
+        try {
+            std::rethrow_exception(error);
+        } catch ( const std::system_error &e ) {
+            // Silence from a port whose device still exists is the
+            // projector's doing, not a lost adapter, and so is silence cut
+            // short by a deadline.
+            bool silent { e.code() == std::errc::timed_out
+                          || e.code() == std::errc::stream_timeout };
+            bool lost { ! silent || access(path.c_str(), F_OK) != 0 };
+            if ( lost && port.serial ) {
+                ++job.requeues;
+                job.lost = std::chrono::steady_clock::now();
+                disconnect(port);
+                if ( job.requeues < MAX_REQUEUE && job.lost < job.deadline ) {
+                    return;
+                }
+            }
+        } catch ( ... ) {
+        }
+
+        if ( ! job.ramp && port.serial && job.attempts <= job.retries && retryable(error) ) {
+            // Any late reply to this attempt is skipped by the next one.
+            return;
+        }
+    }
+
+    Result result { path, job.cmd, reply, error, job.attempts };
+    if ( job.ramp ) {
+        job.ramp->feed(reply, error);
+        if ( ! job.ramp->done() ) {
+            // The ramp keeps the port until its last frame is answered.
+            return;
+        }
+        result.reply = job.ramp->reply();
+        result.error = job.ramp->error();
+        result.attempts = job.ramp->sent();
+    }
+    result.latency = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - job.start);
+    auto done { std::move(job.done) };
+    port.queue.pop_front();
+    if ( done ) {
+        done(result);
+    }
+}
+
+/* Returns true if the port at `path` is registered and open. */
+bool PortManager::connected(const std::string &path) const {
+    auto it { m_ports.find(path) };
+    return it != m_ports.end() && it->second.serial;
+}
+
+/* Tries to open `port`, leaving it closed if its device is not usable yet. */
+void PortManager::connect(const std::string &path, Port &port) {
+    if ( port.serial ) {
+        return;
+    }
+    try {
+        port.serial = std::make_unique<Lineal>(path, Lineal::Mode::NonBlocking);
+    } catch ( const std::system_error &e ) {
+        return;
+    }
+    // A fresh device may hold line noise from being plugged in.
+    tcflush(port.serial->fd(), TCIOFLUSH);
+}
+
+/* Closes `port`.  An in-flight job stays at the head of the queue, to be
+ * sent again if the port returns within REQUEUE_WAIT.
+ */
+void PortManager::disconnect(Port &port) {
+    if ( port.busy ) {
+        auto &job { port.queue.front() };
+        ++job.requeues;
+        job.lost = std::chrono::steady_clock::now();
+    }
+    port.serial.reset();
+    port.busy = false;
+    port.matcher.reset();
+}
+
+/* Starts the front job on every open, idle port with queued jobs whose pace
+ * allows another command, or whose deadline has passed.
+ */
+void PortManager::dispatch() {
+    auto now { std::chrono::steady_clock::now() };
+    for ( auto &[path, port] : m_ports ) {
+        if ( port.serial && ! port.busy && ! port.queue.empty()
+                && std::min(port.serial->pacer().ready(), port.queue.front().deadline) <= now ) {
+            start(path, port);
+        }
+    }
+}
+
+/* Returns the open Lineal for `path`, or nullptr if it is not open. */
+Lineal *PortManager::get(const std::string &path) {
+    auto it { m_ports.find(path) };
+    if ( it == m_ports.end() ) {
+        return nullptr;
+    }
+    return it->second.serial.get();
+}
+
+/* Reads the inotify queue and opens or closes ports to match. */
+void PortManager::notice() {
+    alignas(inotify_event) char buffer[ 4096 ];
+    ssize_t ret;
+    while ( (ret = read(m_inotify, buffer, sizeof(buffer))) > 0 ) {
+        for ( auto *cursor { buffer }; cursor < buffer + ret; ) {
+            auto *event { reinterpret_cast<const inotify_event *>(cursor) };
+            cursor += sizeof(inotify_event) + event->len;
+
+            auto watched { m_watches.find(event->wd) };
+            if ( watched == m_watches.end() ) {
+                continue;
+            }
+
+            if ( event->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF) ) {
+                // The directory itself went away along with its devices.
+                inotify_rm_watch(m_inotify, event->wd);
+                m_watches.erase(watched);
+                for ( auto &[_unused, port] : m_ports ) {
+                    if ( port.wd == event->wd ) {
+                        port.wd = -1;
+                        disconnect(port);
+                    }
+                }
+                continue;
+            }
+
+            std::string name { event->len ? event->name : "" };
+            for ( auto &[path, port] : m_ports ) {
+                if ( port.wd != event->wd || basename_of(path) != name ) {
+                    continue;
+                }
+                if ( event->mask & (IN_DELETE | IN_MOVED_FROM) ) {
+                    disconnect(port);
+                } else {
+                    connect(path, port);
+                }
+            }
+        }
+    }
+}
+
+/* Returns the quantity of commands waiting on all ports. */
+std::size_t PortManager::pending() const {
+    std::size_t total { 0 };
+    for ( const auto &[_unused, port] : m_ports ) {
+        total += port.queue.size();
+    }
+    return total;
+}
+
+/* Returns the quantity of commands waiting on the port at `path`. */
+std::size_t PortManager::pending(const std::string &path) const {
+    auto it { m_ports.find(path) };
+    return it == m_ports.end() ? 0 : it->second.queue.size();
+}
+
+/* Starts queued jobs, then appends the descriptors the manager needs watched
+ * to `fds`.  Pass the same `fds`, after poll(), to process().
+ */
+void PortManager::prepare(std::vector<pollfd> &fds) {
+    dispatch();
+
+    fds.push_back(pollfd { m_inotify, POLLIN, 0 });
+    for ( auto &[_unused, port] : m_ports ) {
+        if ( ! port.serial ) {
+            continue;
+        }
+        short events { 0 };
+        if ( port.serial->wantRead() ) {
+            events |= POLLIN;
+        }
+        if ( port.serial->wantWrite() ) {
+            events |= POLLOUT;
+        }
+        fds.push_back(pollfd { port.serial->fd(), events, 0 });
+    }
+}
+
+/* Handles the poll() results in `fds` for descriptors added by prepare(),
+ * expires overdue replies and jobs on closed ports whose deadline has
+ * passed or which have waited REQUEUE_WAIT for the port to return, and
+ * starts the next queued jobs.
+ *
+ * Descriptors in `fds` belonging to anyone else are ignored.
+ */
+void PortManager::process(const std::vector<pollfd> &fds) {
+    for ( const auto &pfd : fds ) {
+        if ( pfd.revents == 0 ) {
+            continue;
+        }
+        if ( pfd.fd == m_inotify ) {
+            notice();
+            continue;
+        }
+        for ( auto &[path, port] : m_ports ) {
+            if ( ! port.serial || port.serial->fd() != pfd.fd ) {
+                continue;
+            }
+            if ( (pfd.revents & POLLOUT) && port.serial->flush() < 0 ) {
+                if ( port.busy ) {
+                    conclude(path, port, "",
+                             port_failure("Fatal error while writing to projector."));
+                } else {
+                    disconnect(port);
+                }
+            } else if ( pfd.revents & (POLLIN | POLLHUP | POLLERR) ) {
+                receive(path, port);
+            }
+            break;
+        }
+    }
+
+    auto now { std::chrono::steady_clock::now() };
+    for ( auto &[path, port] : m_ports ) {
+        if ( port.busy && now > port.deadline ) {
+            if ( now > port.queue.front().deadline ) {
+                conclude(path, port, "", std::make_exception_ptr(deadline_error()));
+            } else {
+                conclude(path, port, "", std::make_exception_ptr(
+                        silence_error(*port.matcher)));
+            }
+        }
+        // A closed port starts nothing, so without this its jobs would wait
+        // out their deadlines, and hold their places, until it reopens.
+        while ( ! port.serial && ! port.queue.empty() ) {
+            const auto &job { port.queue.front() };
+            if ( now >= job.deadline ) {
+                conclude(path, port, "", std::make_exception_ptr(deadline_error()));
+            } else if ( job.requeues > 0
+                        && now >= job.lost + std::chrono::milliseconds(REQUEUE_WAIT) ) {
+                conclude(path, port, "", open_error(path));
+            } else {
+                break;
+            }
+        }
+    }
+
+    if ( now >= m_next_rescan ) {
+        rescan();
+    }
+
+    dispatch();
+}
+
+/* Reads whatever `port` has available and concludes its front job once the
+ * reply is complete.  Bytes arriving while no job is in flight are stale and
+ * dropped.
+ */
+void PortManager::receive(const std::string &path, Port &port) {
+    if ( ! port.busy ) {
+        char buffer[ 256 ];
+        ssize_t ret;
+        while ( (ret = port.serial->readAvailable(buffer, sizeof(buffer))) > 0 ) {
+        }
+        if ( ret < 0 ) {
+            disconnect(port);
+        }
+        return;
+    }
+
+    // A deadline already past takes what has arrived without waiting.
+    auto now { std::chrono::steady_clock::now() };
+    std::string_view frame;
+    try {
+        std::string_view line;
+        while ( frame.empty() && ! (line = port.serial->readUntil(CR, now)).empty() ) {
+            frame = port.matcher->feed(line);
+        }
+    } catch ( const std::system_error &e ) {
+        conclude(path, port, "", std::make_exception_ptr(std::system_error(
+                e.code(), "Fatal error while reading from projector.")));
+        return;
+    }
+
+    if ( ! frame.empty() ) {
+        std::string reply;
+        std::exception_ptr error;
+        try {
+            reply = unframe(frame);
+        } catch ( ... ) {
+            error = std::current_exception();
+        }
+        conclude(path, port, reply, error);
+    }
+}
+
+/* Retries watching and opening every closed port. */
+void PortManager::rescan() {
+    for ( auto &[path, port] : m_ports ) {
+        if ( port.wd < 0 ) {
+            watch(path, port);
+        }
+        connect(path, port);
+    }
+    m_next_rescan = std::chrono::steady_clock::now()
+                    + std::chrono::milliseconds(RESCAN_INTERVAL);
+}
+
+/* Sends the front job of `port` and starts waiting for its reply, or drops
+ * it if its deadline has passed.
+ */
+void PortManager::start(const std::string &path, Port &port) {
+    auto &job { port.queue.front() };
+    auto now { std::chrono::steady_clock::now() };
+    if ( job.attempts == 0 ) {
+        job.start = now;
+    }
+    if ( now >= job.deadline ) {
+        conclude(path, port, "", std::make_exception_ptr(deadline_error()));
+        return;
+    }
+    ++job.attempts;
+
+    auto cmd { job.ramp ? job.ramp->next() : job.cmd };
+    std::string msg;
+    try {
+        msg = frame(cmd);
+        port.matcher.emplace(command_message(cmd));
+    } catch ( ... ) {
+        conclude(path, port, "", std::current_exception());
+        return;
+    }
+
+    port.busy = true;
+    port.sent = std::chrono::steady_clock::now();
+    port.deadline = std::min(port.sent + std::chrono::milliseconds(RESPONSE_TIMEOUT),
+                             job.deadline);
+
+    if ( port.serial->writeQueued(msg.c_str(), msg.length()) < 0 ) {
+        conclude(path, port, "",
+                 port_failure("Fatal error while writing to projector."));
+    }
+}
+
+/* Queues `cmd` for the port at `path`, registering the port if needed.
+ *
+ * `done` is called from process() once the command finishes.  The command is
+ * sent up to `retries` more times while it fails in a retryable() way, and
+ * not at all once `deadline` has passed (see Deadline).  A volume set holds
+ * the port for every frame it sends (see VolumeRamp).
+ */
+void PortManager::submit(const std::string &path, const std::string &cmd,
+                         Completion done, int retries, Deadline deadline) {
+    add(path);
+    Job job { cmd, std::move(done), retries, deadline };
+    if ( auto level { volume_level(cmd) } ) {
+        job.ramp.emplace(*level, retries);
+    }
+    m_ports[path].queue.push_back(std::move(job));
+}
+
+/* Returns the milliseconds until the manager has work due without any
+ * descriptor becoming ready, or -1 if it has none.
+ */
+int PortManager::timeout() const {
+    using clock = std::chrono::steady_clock;
+    auto now { clock::now() };
+    auto next { clock::time_point::max() };
+
+    for ( const auto &[_unused, port] : m_ports ) {
+        if ( ! port.serial ) {
+            next = std::min(next, m_next_rescan);
+            if ( ! port.queue.empty() ) {
+                const auto &job { port.queue.front() };
+                next = std::min(next, job.deadline);
+                if ( job.requeues > 0 ) {
+                    next = std::min(next, job.lost + std::chrono::milliseconds(REQUEUE_WAIT));
+                }
+            }
+        } else if ( port.busy ) {
+            next = std::min(next, port.deadline);
+        } else if ( ! port.queue.empty() ) {
+            next = std::min({ next, port.serial->pacer().ready(), port.queue.front().deadline });
+        }
+    }
+
+    if ( next == clock::time_point::max() ) {
+        return -1;
+    }
+    if ( next <= now ) {
+        return 0;
+    }
+    // Round up so the wake-up never comes just before the deadline.
+    return std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count() + 1;
+}
+
+/* Waits up to `timeout_ms` milliseconds for serial or device activity and
+ * handles it.
+ *
+ * A negative `timeout_ms` waits for as long as the manager has nothing due.
+ */
+void PortManager::update(int timeout_ms) {
+    std::vector<pollfd> fds;
+    prepare(fds);
+
+    auto due { timeout() };
+    if ( due > -1 && (timeout_ms < 0 || due < timeout_ms) ) {
+        timeout_ms = due;
+    }
+
+    if ( poll(fds.data(), fds.size(), timeout_ms) < 0 ) {
+        if ( errno != EINTR ) {
+            throw std::system_error(std::error_code(errno, std::system_category()),
+                                    std::string("serial poll failed"));
+        }
+        for ( auto &pfd : fds ) {
+            pfd.revents = 0;
+        }
+    }
+
+    process(fds);
+}
+
+/* Starts watching the directory which holds the device node for `port`.
+ *
+ * On failure the port is left unwatched and rescan() tries again later.
+ */
+void PortManager::watch(const std::string &path, Port &port) {
+    auto dir { dirname_of(path) };
+    port.wd = inotify_add_watch(m_inotify, dir.c_str(), WATCH_EVENTS);
+    if ( port.wd > -1 ) {
+        m_watches[port.wd] = dir;
+    }
+}
+
+
+/* Returns the error opening the port at `path` gives, or a generic one if
+ * it opens after all.
+ */
+std::exception_ptr open_error(const std::string &path) {
+    try {
+        Lineal probe { path, Lineal::Mode::NonBlocking };
+    } catch ( ... ) {
+        return std::current_exception();
+    }
+    return std::make_exception_ptr(std::system_error(
+            std::make_error_code(std::errc::no_such_device), "serial port unavailable"));
+}
@@ -0,0 +1,160 @@
+/*
+    portman.h - hot-plug aware management of serial ports
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#ifndef PORTMAN_H
+#define PORTMAN_H true
+
+#include "exchange.h"
+#include "lineal.h"
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <poll.h>
+#include <string>
+#include <vector>
+
+
+/* Times a queued command is retried after its port dropped out from under it.
+ *
+ * A command which keeps failing on freshly reopened ports is more likely to
+ * be the problem than the port is.
+ */
+constexpr int MAX_REQUEUE { 3 };
+
+/* Milliseconds a requeued command waits for its port to come back before it
+ * fails, so that whoever is waiting on it is not held for good.
+ */
+constexpr int REQUEUE_WAIT { 10000 };
+
+/* Interval, in milliseconds, to retry ports which cannot be watched.
+ *
+ * Directories like /dev/serial/by-id vanish with their last device, so there
+ * is nothing for inotify to watch until they return.
+ */
+constexpr int RESCAN_INTERVAL { 1000 };
+
+
+/* Keeps a Lineal open for each registered serial port while its device is
+ * present.
+ *
+ * Devices are watched with inotify, so an unplugged port is closed as soon as
+ * its device node disappears and reopened as soon as it reappears.  Commands
+ * are queued per port and a command interrupted by an unplug is requeued to
+ * run again once the port is back, if that is within REQUEUE_WAIT.
+ *
+ * Ports are non-blocking, so commands on different ports overlap.  Commands
+ * on one port follow one another at the pace of its Pacer.  Either
+ * call update(), or embed the manager in another poll loop with prepare(),
+ * timeout() and process().
+ */
+class PortManager {
+
+    public:
+
+        /* Called once for each submitted command with its outcome. */
+        using Completion = std::function<void(const Result &result)>;
+
+    private:
+
+        struct Job {
+            std::string cmd;
+            Completion done;
+            int retries { 0 };
+            Deadline deadline { NO_DEADLINE };
+            int attempts { 0 };
+            // times the job's port dropped out from under it, and when it
+            // last did
+            int requeues { 0 };
+            std::chrono::steady_clock::time_point lost;
+            std::chrono::steady_clock::time_point start;
+            // picks the frames of a volume set, which runs as one job
+            std::optional<VolumeRamp> ramp;
+        };
+
+        struct Port {
+            std::unique_ptr<Lineal> serial;
+            std::deque<Job> queue;
+            // inotify watch descriptor of the containing directory
+            int wd { -1 };
+            // the front job has been sent and awaits its reply
+            bool busy { false };
+            // picks the front job's answer out of what arrives while busy
+            std::optional<ReplyMatcher> matcher;
+            // when the frame in flight was sent, and when it times out or
+            // its job's deadline passes, whichever comes first
+            std::chrono::steady_clock::time_point sent;
+            std::chrono::steady_clock::time_point deadline;
+        };
+
+        /* inotify instance, or -1 before construction completes */
+        int m_inotify { -1 };
+
+        /* Ports keyed by their path as registered. */
+        std::map<std::string, Port> m_ports;
+
+        /* Watched directories keyed by inotify watch descriptor. */
+        std::map<int, std::string> m_watches;
+
+        std::chrono::steady_clock::time_point m_next_rescan;
+
+        void conclude(const std::string &path, Port &port,
+                      const std::string &reply, std::exception_ptr error);
+        void connect(const std::string &path, Port &port);
+        void disconnect(Port &port);
+        void dispatch();
+        void notice();
+        void receive(const std::string &path, Port &port);
+        void rescan();
+        void start(const std::string &path, Port &port);
+        void watch(const std::string &path, Port &port);
+
+    public:
+
+        PortManager();
+        ~PortManager();
+
+        PortManager(const PortManager &) = delete;
+        PortManager &operator=(const PortManager &) = delete;
+
+        void abandon(const std::string &path, std::exception_ptr error);
+        void add(const std::string &path);
+        bool connected(const std::string &path) const;
+        Lineal *get(const std::string &path);
+        std::size_t pending() const;
+        std::size_t pending(const std::string &path) const;
+        void prepare(std::vector<pollfd> &fds);
+        void process(const std::vector<pollfd> &fds);
+        void submit(const std::string &path, const std::string &cmd,
+                    Completion done, int retries = 0, Deadline deadline = NO_DEADLINE);
+        int timeout() const;
+        void update(int timeout_ms);
+
+};
+
+
+std::exception_ptr open_error(const std::string &path);
+
+
+#endif
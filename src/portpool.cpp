@@ -0,0 +1,136 @@
+/*
+    portpool.cpp - reusable, already configured serial ports
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include "portpool.h"
+
+#include <poll.h>
+#include <termios.h>
+#include <utility>
+
+
+/* Returns true if `port` can no longer be used, e.g. because its adapter was
+ * unplugged while the port sat idle.
+ */
+static bool stale(Lineal &port) {
+    pollfd pfd { port.fd(), POLLIN, 0 };
+    if ( poll(&pfd, 1, 0) < 0 ) {
+        return true;
+    }
+    return pfd.revents & (POLLHUP | POLLERR | POLLNVAL);
+}
+
+
+PortPool::Lease::Lease(PortPool &pool, Lineal port)
+    : m_pool { &pool },
+      m_port { std::move(port) }
+{
+}
+
+PortPool::Lease::Lease(Lease &&other) noexcept
+    : m_pool { std::exchange(other.m_pool, nullptr) },
+      m_port { std::move(other.m_port) }
+{
+}
+
+PortPool::Lease::~Lease() {
+    release();
+}
+
+PortPool::Lease &PortPool::Lease::operator=(Lease &&other) noexcept {
+    if ( this != &other ) {
+        release();
+        m_pool = std::exchange(other.m_pool, nullptr);
+        m_port = std::move(other.m_port);
+    }
+    return *this;
+}
+
+/* Returns the port to its pool early, leaving the Lease empty. */
+void PortPool::Lease::release() {
+    if ( m_pool != nullptr ) {
+        std::exchange(m_pool, nullptr)->checkin(std::move(m_port));
+    }
+}
+
+
+/* A pool whose ports are opened in `mode`. */
+PortPool::PortPool(Lineal::Mode mode)
+    : m_mode { mode }
+{
+}
+
+/* Keeps `port` for reuse if it is still open and there is room for it, or
+ * else closes it.  Input still pending is kept; a late reply meant for the
+ * previous user is skipped by the next user's ReplyMatcher.
+ */
+void PortPool::checkin(Lineal port) {
+    // Half sent output cannot be handed on; the next user would garble it.
+    if ( ! port || port.wantWrite() ) {
+        return;
+    }
+    auto &idle { m_idle[port.name()] };
+    if ( idle.size() < POOL_IDLE_PER_PORT ) {
+        idle.push_back(std::move(port));
+    }
+}
+
+/* Returns a Lease on an open, configured port at `path`, reusing an idle one
+ * when possible.
+ *
+ * Throws `std::system_error` if a new port cannot be opened or configured.
+ */
+PortPool::Lease PortPool::checkout(const std::string &path) {
+    auto it { m_idle.find(path) };
+    if ( it != m_idle.end() ) {
+        auto &idle { it->second };
+        while ( ! idle.empty() ) {
+            Lineal port { std::move(idle.back()) };
+            idle.pop_back();
+            if ( ! stale(port) ) {
+                return Lease(*this, std::move(port));
+            }
+        }
+    }
+
+    Lineal port { path, m_mode };
+    // Flush erroneous, pending IO before first use.
+    tcflush(port.fd(), TCIOFLUSH);
+    return Lease(*this, std::move(port));
+}
+
+/* Closes every idle port. */
+void PortPool::clear() {
+    m_idle.clear();
+}
+
+/* Closes the idle ports at `path`, releasing their locks. */
+void PortPool::clear(const std::string &path) {
+    m_idle.erase(path);
+}
+
+/* Returns the quantity of idle ports held open. */
+std::size_t PortPool::idle() const {
+    std::size_t quantity { 0 };
+    for ( const auto &[path, ports] : m_idle ) {
+        quantity += ports.size();
+    }
+    return quantity;
+}
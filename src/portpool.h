@@ -0,0 +1,109 @@
+/*
+    portpool.h - reusable, already configured serial ports
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#ifndef PORTPOOL_H
+#define PORTPOOL_H true
+
+#include "lineal.h"
+
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+/* Most idle ports kept open for any one path. */
+constexpr std::size_t POOL_IDLE_PER_PORT { 1 };
+
+
+/* Open, configured serial ports kept for reuse, keyed by path.
+ *
+ * checkout() hands out an idle port when there is one, so a port is opened
+ * and configured once however many operations use it.  A port comes back to
+ * the pool when its Lease ends.
+ */
+class PortPool {
+
+    public:
+
+        /* Exclusive use of one pooled port, returned to the pool on
+         * destruction.  An empty Lease holds no port.
+         */
+        class Lease {
+
+            private:
+
+                PortPool *m_pool { nullptr };
+                Lineal m_port;
+
+            public:
+
+                Lease() = default;
+                Lease(PortPool &pool, Lineal port);
+                ~Lease();
+
+                Lease(const Lease &) = delete;
+                Lease &operator=(const Lease &) = delete;
+                Lease(Lease &&other) noexcept;
+                Lease &operator=(Lease &&other) noexcept;
+
+                void release();
+
+                Lineal &operator*() {
+                    return m_port;
+                }
+
+                Lineal *operator->() {
+                    return &m_port;
+                }
+
+                /* Returns true if the Lease holds an open port. */
+                operator bool() const {
+                    return m_pool != nullptr && m_port;
+                }
+
+        };
+
+    private:
+
+        Lineal::Mode m_mode;
+
+        /* Idle ports keyed by path. */
+        std::unordered_map<std::string, std::vector<Lineal>> m_idle;
+
+        void checkin(Lineal port);
+
+    public:
+
+        explicit PortPool(Lineal::Mode mode = Lineal::Mode::Blocking);
+
+        PortPool(const PortPool &) = delete;
+        PortPool &operator=(const PortPool &) = delete;
+
+        Lease checkout(const std::string &path);
+        void clear();
+        void clear(const std::string &path);
+        std::size_t idle() const;
+
+};
+
+
+#endif
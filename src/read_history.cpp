@@ -0,0 +1,271 @@
+/*
+    read_history.cpp - print projector state history recorded by bewield
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include "history.h"
+
+#include "argparse.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+
+/* Name of Key::Unknown, which holds whether a port answers at all. */
+constexpr std::string_view ONLINE_KEY { "online" };
+
+
+/* Returns `time` as local time text, e.g. "2021-10-18 07:30:00.250". */
+std::string time_text(std::chrono::system_clock::time_point time) {
+    auto ms { std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()) };
+    auto seconds { static_cast<std::time_t>(ms.count() / 1000) };
+    std::tm local;
+    localtime_r(&seconds, &local);
+    char text[ 40 ];
+    auto length { std::strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", &local) };
+    std::snprintf(text + length, sizeof(text) - length, ".%03d",
+                  static_cast<int>(ms.count() % 1000));
+    return text;
+}
+
+/* Returns the time given by `text`, as local "YYYY-MM-DD", "YYYY-MM-DDTHH:MM"
+ * or "YYYY-MM-DDTHH:MM:SS", or as milliseconds since the epoch.
+ *
+ * Throws `std::runtime_error` for anything else.
+ */
+std::chrono::system_clock::time_point parse_time(const std::string &text) {
+    if ( ! text.empty() && text.find_first_not_of("0123456789") == std::string::npos ) {
+        return std::chrono::system_clock::time_point(std::chrono::milliseconds(std::stoll(text)));
+    }
+    for ( const char *format : { "%Y-%m-%dT%H:%M:%S", "%Y-%m-%dT%H:%M", "%Y-%m-%d" } ) {
+        std::tm local {};
+        local.tm_isdst = -1;
+        const char *end { strptime(text.c_str(), format, &local) };
+        if ( end && *end == '\0' ) {
+            return std::chrono::system_clock::from_time_t(std::mktime(&local));
+        }
+    }
+    throw std::runtime_error("Unknown time '" + text + "', give YYYY-MM-DD[THH:MM[:SS]] or "
+                             "milliseconds since the epoch.");
+}
+
+/* Returns the length of time given by `text`, a whole number followed by s,
+ * m, h or d, e.g. "15m", or 0 for "all".
+ *
+ * Throws `std::runtime_error` for anything else.
+ */
+std::chrono::milliseconds parse_every(const std::string &text) {
+    if ( text == "all" ) {
+        return std::chrono::milliseconds(0);
+    }
+    std::size_t end { 0 };
+    long long count { 0 };
+    try {
+        count = std::stoll(text, &end);
+    } catch ( const std::logic_error &e ) {
+    }
+    if ( count > 0 && end + 1 == text.size() ) {
+        switch ( text.back() ) {
+            case 's':
+                return std::chrono::seconds(count);
+            case 'm':
+                return std::chrono::minutes(count);
+            case 'h':
+                return std::chrono::hours(count);
+            case 'd':
+                return std::chrono::hours(24 * count);
+        }
+    }
+    throw std::runtime_error("Unknown length of time '" + text + "', give e.g. 90s, 15m, 1h, "
+                             "1d or all.");
+}
+
+/* Returns the keys named by `text`, "all" or a comma separated list such as
+ * "pow,vol,online".
+ *
+ * Throws `std::runtime_error` for an unknown key.
+ */
+std::vector<Key> parse_keys(const std::string &text) {
+    std::vector<Key> keys;
+    if ( text == "all" ) {
+        keys.push_back(Key::Unknown);
+        for ( const auto &[_unused, key] : KEY_WORDS ) {
+            keys.push_back(key);
+        }
+        return keys;
+    }
+    std::istringstream words { text };
+    std::string word;
+    while ( std::getline(words, word, ',') ) {
+        auto key { lookup(KEY_WORDS, word, Key::Unknown) };
+        if ( key == Key::Unknown && word != ONLINE_KEY ) {
+            throw std::runtime_error("Unknown key '" + word + "'.");
+        }
+        keys.push_back(key);
+    }
+    return keys;
+}
+
+/* Returns the name of `key` as parse_keys() takes it. */
+std::string_view key_name(Key key) {
+    return key == Key::Unknown ? ONLINE_KEY : spelling(KEY_WORDS, key);
+}
+
+/* Returns the ports of `history` named by `names`, either whole paths or
+ * file names, or every port if there are no names.
+ *
+ * Throws `std::runtime_error` for a name no port has.
+ */
+std::vector<std::string> select_ports(const HistoryReader &history,
+                                      const std::vector<std::string> &names) {
+    auto ports { history.ports() };
+    if ( names.empty() ) {
+        return ports;
+    }
+    std::vector<std::string> chosen;
+    for ( const auto &name : names ) {
+        auto found { std::find_if(ports.begin(), ports.end(), [&](const std::string &port) {
+            return port == name || port.substr(port.rfind('/') + 1) == name;
+        }) };
+        if ( found == ports.end() ) {
+            throw std::runtime_error("No port named '" + name + "' in the history.");
+        }
+        chosen.push_back(*found);
+    }
+    return chosen;
+}
+
+
+/* Prints every change of `keys` of `ports` between `from` and `to`, one line
+ * each of the time, port, key and value, starting with the values held at
+ * `from`.
+ */
+void print_changes(const HistoryReader &history, const std::vector<std::string> &ports,
+                   const std::vector<Key> &keys, std::chrono::system_clock::time_point from,
+                   std::chrono::system_clock::time_point to) {
+    for ( const auto &port : ports ) {
+        history.scan(port, from, to, [&](const HistoryEvent &event) {
+            if ( std::find(keys.begin(), keys.end(), event.key) == keys.end() ) {
+                return;
+            }
+            std::cout << time_text(event.time) << '\t' << port << '\t' << key_name(event.key)
+                      << '\t' << history_text(event.key, event.value) << '\n';
+        });
+    }
+    std::cout.flush();
+}
+
+/* Prints how long each of `keys` of `ports` held each value between `from`
+ * and `to`, in buckets of `every`, one line each of the bucket start, port,
+ * key, value, seconds held and changes within the bucket.
+ */
+void print_buckets(const HistoryReader &history, const std::vector<std::string> &ports,
+                   const std::vector<Key> &keys, std::chrono::system_clock::time_point from,
+                   std::chrono::system_clock::time_point to, std::chrono::milliseconds every) {
+    char seconds[ 32 ];
+    for ( const auto &port : ports ) {
+        for ( auto key : keys ) {
+            for ( const auto &bucket : history.aggregate(port, key, from, to, every) ) {
+                for ( const auto &[value, held] : bucket.held ) {
+                    std::snprintf(seconds, sizeof(seconds), "%.3f", held.count() / 1e3);
+                    std::cout << time_text(bucket.start) << '\t' << port << '\t'
+                              << key_name(key) << '\t' << history_text(key, value) << '\t'
+                              << seconds << '\t' << bucket.changes << '\n';
+                }
+            }
+        }
+    }
+    std::cout.flush();
+}
+
+
+/* Returns an ArgumentParser object created from command line arguments. */
+argparse::ArgumentParser read_args(const std::vector<std::string> arguments) {
+    argparse::ArgumentParser program { "read_history" };
+
+    program.add_argument("history")
+        .help("history directory written by bewield --history");
+
+    program.add_argument("-p", "--port")
+        .help("port to show, by path or file name, repeat for several ports (default all)")
+        .default_value(std::vector<std::string> {})
+        .append();
+
+    program.add_argument("-k", "--key")
+        .help("keys to show, e.g. pow,sour,vol,online")
+        .default_value(std::string { "all" });
+
+    program.add_argument("--from")
+        .help("start, as local YYYY-MM-DD[THH:MM[:SS]] or milliseconds since the epoch")
+        .default_value(std::string {});
+
+    program.add_argument("--to")
+        .help("end, as --from (default now)")
+        .default_value(std::string {});
+
+    program.add_argument("-e", "--every")
+        .help("print time held by each value per period, e.g. 15m, 1h, 1d or all")
+        .default_value(std::string {});
+
+    program.parse_args(arguments);
+
+    return program;
+}
+
+
+int main(int argc, const char* argv[]) {
+    argparse::ArgumentParser program;
+    try {
+        std::vector<std::string> args;
+        std::copy(argv, argv + argc, std::back_inserter(args));
+
+        program = read_args(args);
+    } catch ( const std::runtime_error &e ) {
+        std::cout << e.what() << std::endl;
+        return EINVAL;
+    }
+
+    try {
+        HistoryReader history { program.get("history") };
+        auto ports { select_ports(history, program.get<std::vector<std::string>>("--port")) };
+        auto keys { parse_keys(program.get("--key")) };
+        auto arg_from { program.get("--from") };
+        auto arg_to { program.get("--to") };
+        auto from { arg_from.empty() ? history.begins() : parse_time(arg_from) };
+        auto to { arg_to.empty() ? std::chrono::system_clock::now() : parse_time(arg_to) };
+
+        if ( auto arg_every { program.get("--every") }; ! arg_every.empty() ) {
+            print_buckets(history, ports, keys, from, to, parse_every(arg_every));
+        } else {
+            print_changes(history, ports, keys, from, to);
+        }
+    } catch ( const std::runtime_error &e ) {
+        std::cout << e.what() << std::endl;
+        return EINVAL;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,147 @@
+/*
+    read_trace.cpp - print a serial traffic trace
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include "trace.h"
+
+// argparse.hpp uses std::as_const without including <utility> itself.
+#include <utility>
+
+#include "argparse.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <vector>
+
+
+/* Returns `c` as printable text, e.g. "a", "\\r" or "\\x02". */
+std::string byte_text(char c) {
+    switch ( c ) {
+        case '\r':
+            return "\\r";
+        case '\n':
+            return "\\n";
+        case '\\':
+            return "\\\\";
+    }
+    if ( c < ' ' || c > '~' ) {
+        char escaped[ 8 ];
+        std::snprintf(escaped, sizeof(escaped), "\\x%02x", static_cast<unsigned char>(c));
+        return escaped;
+    }
+    return std::string(1, c);
+}
+
+
+/* Prints every record of `trace`, one line per byte or, with `chunks`, one
+ * line per record.
+ *
+ * Columns are the milliseconds since tracing began, '>' for bytes sent or
+ * '<' for bytes received, the microseconds since the previous byte in the
+ * same port and direction, the port, and the bytes.  The port comes after
+ * the fixed width columns so they line up whatever its length.
+ */
+void print(const TraceReader &trace, bool chunks) {
+    auto &header { trace.header() };
+    if ( header.lost > 0 ) {
+        std::cout << "# " << header.lost << " older records were overwritten" << std::endl;
+    }
+
+    // time of the previous byte, keyed by port and direction
+    std::map<std::pair<uint16_t, TraceDirection>, uint64_t> previous;
+
+    char line[ 80 ];
+    for ( std::size_t i { 0 }; i < trace.size(); ++i ) {
+        const auto &record { trace.records()[i] };
+        auto since { (record.time - header.start) / 1e6 };
+        auto port { trace.port(record.port) };
+        auto arrow { record.direction == TraceDirection::Write ? '>' : '<' };
+
+        std::string gap { "-" };
+        auto key { std::make_pair(record.port, record.direction) };
+        if ( auto it { previous.find(key) }; it != previous.end() ) {
+            gap = std::to_string((record.time - it->second) / 1000);
+        }
+        previous[key] = record.time;
+
+        auto length { std::min<std::size_t>(record.length, TRACE_CHUNK) };
+        if ( chunks ) {
+            std::string bytes;
+            for ( std::size_t b { 0 }; b < length; ++b ) {
+                bytes += byte_text(record.bytes[b]);
+            }
+            std::snprintf(line, sizeof(line), "%12.3f %c %10s  ", since, arrow, gap.c_str());
+            std::cout << line << port << "  " << bytes << '\n';
+            continue;
+        }
+        for ( std::size_t b { 0 }; b < length; ++b ) {
+            std::snprintf(line, sizeof(line), "%12.3f %c %10s  ",
+                          since, arrow, b == 0 ? gap.c_str() : "0");
+            std::cout << line << port << "  " << byte_text(record.bytes[b]) << '\n';
+        }
+    }
+    std::cout.flush();
+}
+
+
+/* Returns an ArgumentParser object created from command line arguments. */
+argparse::ArgumentParser read_args(const std::vector<std::string> arguments) {
+    argparse::ArgumentParser program { "read_trace" };
+
+    program.add_argument("trace")
+        .help("trace file written by bewield --trace");
+
+    program.add_argument("-c", "--chunks")
+        .help("print one line per read or write instead of per byte")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.parse_args(arguments);
+
+    return program;
+}
+
+
+int main(int argc, const char* argv[]) {
+    argparse::ArgumentParser program;
+    try {
+        std::vector<std::string> args;
+        std::copy(argv, argv + argc, std::back_inserter(args));
+
+        program = read_args(args);
+    } catch ( const std::runtime_error &e ) {
+        std::cout << e.what() << std::endl;
+        return EINVAL;
+    }
+
+    try {
+        TraceReader trace { program.get("trace") };
+        print(trace, program.get<bool>("--chunks"));
+    } catch ( const std::runtime_error &e ) {
+        std::cout << e.what() << std::endl;
+        return EINVAL;
+    }
+
+    return EXIT_SUCCESS;
+}
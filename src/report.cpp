@@ -0,0 +1,212 @@
+/*
+    report.cpp - human and machine readable command results
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include "report.h"
+#include "bewield.h"
+
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+
+
+/* Writes `field` to `out` with TSV separators and line breaks escaped. */
+static void tsv_field(std::ostream &out, const std::string &field) {
+    for ( auto c : field ) {
+        switch ( c ) {
+            case '\\':
+                out << "\\\\";
+                break;
+            case '\n':
+                out << "\\n";
+                break;
+            case '\r':
+                out << "\\r";
+                break;
+            case '\t':
+                out << "\\t";
+                break;
+            default:
+                out << c;
+        }
+    }
+}
+
+/* Returns the description of `error`, or an empty string if it is null. */
+static std::string error_text(const std::exception_ptr &error) {
+    if ( ! error ) {
+        return "";
+    }
+    try {
+        std::rethrow_exception(error);
+    } catch ( const std::out_of_range &e ) {
+        return "Unrecognized command.";
+    } catch ( const std::exception &e ) {
+        return e.what();
+    } catch ( ... ) {
+    }
+    return "Unknown error.";
+}
+
+
+/* Writes `field` to `out` as a JSON string, quotes included. */
+void json_string(std::ostream &out, const std::string &field) {
+    out << '"';
+    for ( auto c : field ) {
+        switch ( c ) {
+            case '"':
+                out << "\\\"";
+                break;
+            case '\\':
+                out << "\\\\";
+                break;
+            case '\n':
+                out << "\\n";
+                break;
+            case '\r':
+                out << "\\r";
+                break;
+            case '\t':
+                out << "\\t";
+                break;
+            default:
+                if ( static_cast<unsigned char>(c) < 0x20 ) {
+                    char escaped[ 8 ];
+                    std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                    out << escaped;
+                } else {
+                    out << c;
+                }
+        }
+    }
+    out << '"';
+}
+
+/* Returns the Format named `name` ("text", "jsonl" or "tsv").
+ *
+ * Throws `std::runtime_error` for any other name.
+ */
+Format parse_format(const std::string &name) {
+    if ( name == "text" ) {
+        return Format::Text;
+    } else if ( name == "jsonl" ) {
+        return Format::JsonLines;
+    } else if ( name == "tsv" ) {
+        return Format::Tsv;
+    }
+    throw std::runtime_error("Unknown output format '" + name + "'.");
+}
+
+/* Returns the value of a decoded reply as text, e.g. "on" for "POW=ON",
+ * "12" for "VOL=12" or "MW632ST" for "MODELNAME=MW632ST".
+ */
+std::string value_text(const Reply &reply) {
+    switch ( reply.value ) {
+        case Value::Number:
+            return std::to_string(reply.number);
+        case Value::Text:
+            return std::string(reply.text);
+        default:
+            return std::string(spelling(VALUE_WORDS, reply.value));
+    }
+}
+
+
+Report::Report(std::ostream &out, Format format, bool show_port)
+    : m_out { out },
+      m_format { format },
+      m_show_port { show_port }
+{
+}
+
+Format Report::format() const {
+    return m_format;
+}
+
+/* Writes the column names, for formats which have them. */
+void Report::header() {
+    if ( m_format == Format::Tsv ) {
+        m_out << "port\tcommand\treply\tkey\tvalue\terror\tattempts\tlatency_us\n";
+    }
+}
+
+void Report::json(const Result &result) {
+    m_out << "{\"port\":";
+    json_string(m_out, result.port);
+    m_out << ",\"command\":";
+    json_string(m_out, result.cmd);
+    auto decoded { result.decoded() };
+    m_out << ",\"reply\":";
+    json_string(m_out, result.reply);
+    m_out << ",\"key\":\"" << spelling(KEY_WORDS, decoded.key) << '"';
+    m_out << ",\"value\":";
+    json_string(m_out, value_text(decoded));
+    m_out << ",\"error\":\"" << error_class(result.error) << '"';
+    if ( result.error ) {
+        m_out << ",\"message\":";
+        json_string(m_out, error_text(result.error));
+    }
+    m_out << ",\"attempts\":" << result.attempts
+          << ",\"latency_us\":" << result.latency.count() << "}\n";
+}
+
+void Report::text(const Result &result) {
+    std::string prefix { m_show_port ? result.port + ": " : "" };
+    std::string kind { error_class(result.error) };
+
+    // Nothing was sent for a port which failed to open or a bad command.
+    if ( result.attempts > 0 && kind != "unknown_command" ) {
+        m_out << prefix << "sent '" << result.cmd << "'\n";
+    }
+    if ( result.error ) {
+        m_out << prefix << error_text(result.error) << '\n';
+    } else {
+        m_out << prefix << "reply: " << cook(result.reply) << '\n';
+    }
+}
+
+void Report::tsv(const Result &result) {
+    tsv_field(m_out, result.port);
+    m_out << '\t';
+    tsv_field(m_out, result.cmd);
+    m_out << '\t';
+    auto decoded { result.decoded() };
+    tsv_field(m_out, result.reply);
+    m_out << '\t' << spelling(KEY_WORDS, decoded.key) << '\t';
+    tsv_field(m_out, value_text(decoded));
+    m_out << '\t' << error_class(result.error)
+          << '\t' << result.attempts
+          << '\t' << result.latency.count() << '\n';
+}
+
+/* Writes one record for `result`. */
+void Report::write(const Result &result) {
+    switch ( m_format ) {
+        case Format::Text:
+            text(result);
+            break;
+        case Format::JsonLines:
+            json(result);
+            break;
+        case Format::Tsv:
+            tsv(result);
+            break;
+    }
+}
@@ -0,0 +1,84 @@
+/*
+    report.h - human and machine readable command results
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#ifndef REPORT_H
+#define REPORT_H true
+
+#include "exchange.h"
+
+#include <ostream>
+#include <string>
+
+
+/* Output styles for command results.
+ *
+ * Text is the historical, human oriented output.  JSON Lines and TSV emit
+ * exactly one record per command, with the fields (in TSV column order):
+ *
+ *   port, command, reply, key, value, error, attempts, latency_us
+ *
+ * `key` and `value` are the decoded reply, spelled as in decode.h with
+ * numbers and free text passed through, e.g. "pow" and "on" for "POW=ON".
+ */
+enum class Format {
+    Text,
+    JsonLines,
+    Tsv,
+};
+
+
+/* Writes command results to a stream in one of the output Formats.
+ *
+ * Records are newline terminated but never flushed here, as std::endl would;
+ * callers flush after each record they write, so a pipeline sees every
+ * result whole as soon as it is known.
+ */
+class Report {
+
+    private:
+
+        std::ostream &m_out;
+        Format m_format;
+
+        /* Prefix text output with the port, for runs on several ports. */
+        bool m_show_port;
+
+        void text(const Result &result);
+        void json(const Result &result);
+        void tsv(const Result &result);
+
+    public:
+
+        Report(std::ostream &out, Format format, bool show_port = false);
+
+        Format format() const;
+        void header();
+        void write(const Result &result);
+
+};
+
+
+void json_string(std::ostream &out, const std::string &field);
+Format parse_format(const std::string &name);
+std::string value_text(const Reply &reply);
+
+
+#endif
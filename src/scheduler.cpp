@@ -0,0 +1,489 @@
+/*
+    scheduler.cpp - cron-style scheduled commands
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include "scheduler.h"
+#include "bewield.h"
+#include "exchange.h"
+
+#include <algorithm>
+#include <limits>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+#include <tuple>
+#include <utility>
+
+
+/* Returns the failure of a command refused for want of room. */
+static std::exception_ptr overload() {
+    return std::make_exception_ptr(std::system_error(
+            std::make_error_code(std::errc::resource_unavailable_try_again),
+            "Too many commands waiting."));
+}
+
+/* Tells `done` that `cmd` on `port` was given up on unanswered with `error`. */
+static void refuse(const std::string &port, const std::string &cmd,
+                   const PortManager::Completion &done, std::exception_ptr error) {
+    if ( done ) {
+        done(Result { port, cmd, "", error });
+    }
+}
+
+/* Returns the bits of one crontab field, numbered from `low` to `high`.
+ *
+ * Throws `std::runtime_error` if `field` is not valid.
+ */
+template <std::size_t N>
+static std::bitset<N> parse_field(const std::string &field, int low, int high) {
+    std::bitset<N> bits;
+    std::istringstream items { field };
+    std::string item;
+    while ( std::getline(items, item, ',') ) {
+        int first { low }, last { high }, step { 1 };
+        try {
+            auto slash { item.find('/') };
+            if ( slash != std::string::npos ) {
+                std::size_t used;
+                step = std::stoi(item.substr(slash + 1), &used);
+                if ( used != item.size() - slash - 1 || step < 1 ) {
+                    throw std::invalid_argument("step");
+                }
+                item.erase(slash);
+            }
+            if ( item != "*" ) {
+                std::size_t used;
+                first = last = std::stoi(item, &used);
+                if ( used < item.size() ) {
+                    if ( item[used] != '-' ) {
+                        throw std::invalid_argument("range");
+                    }
+                    auto rest { item.substr(used + 1) };
+                    last = std::stoi(rest, &used);
+                    if ( used != rest.size() ) {
+                        throw std::invalid_argument("range");
+                    }
+                } else if ( slash != std::string::npos ) {
+                    // "a/n" runs from a to the end of the field.
+                    last = high;
+                }
+            }
+        } catch ( const std::logic_error &e ) {
+            throw std::runtime_error("Bad schedule field '" + field + "'.");
+        }
+        if ( first < low || last > high || first > last ) {
+            throw std::runtime_error("Schedule field '" + field + "' out of range.");
+        }
+        for ( auto i { first }; i <= last; i += step ) {
+            bits.set(i);
+        }
+    }
+    if ( bits.none() ) {
+        throw std::runtime_error("Bad schedule field '" + field + "'.");
+    }
+    return bits;
+}
+
+
+/* The schedule given by five crontab `fields`.
+ *
+ * Throws `std::runtime_error` if the fields are not valid.
+ */
+CronSpec::CronSpec(const std::string &fields) {
+    std::istringstream words { fields };
+    std::string minute, hour, day, month, weekday, extra;
+    if ( ! (words >> minute >> hour >> day >> month >> weekday) || words >> extra ) {
+        throw std::runtime_error("A schedule needs five fields, not '" + fields + "'.");
+    }
+    m_minutes = parse_field<60>(minute, 0, 59);
+    m_hours = parse_field<24>(hour, 0, 23);
+    m_days = parse_field<32>(day, 1, 31);
+    m_months = parse_field<13>(month, 1, 12);
+    auto weekdays { parse_field<8>(weekday, 0, 7) };
+    for ( std::size_t i { 0 }; i < 7; ++i ) {
+        m_weekdays[i] = weekdays[i];
+    }
+    m_weekdays[0] = m_weekdays[0] || weekdays[7];
+    m_any_day = day.front() != '*';
+    m_any_weekday = weekday.front() != '*';
+}
+
+/* Returns true if `when` falls on a day the schedule runs. */
+bool CronSpec::matchesDay(const std::tm &when) const {
+    bool day { m_days[when.tm_mday] };
+    bool weekday { m_weekdays[when.tm_wday] };
+    if ( m_any_day && m_any_weekday ) {
+        return day || weekday;
+    }
+    return day && weekday;
+}
+
+/* Returns the first local time strictly after `after` when the schedule
+ * runs, to the minute.
+ *
+ * Throws `std::runtime_error` if it never runs, e.g. on February 30.
+ */
+std::time_t CronSpec::next(std::time_t after) const {
+    std::tm when {};
+    localtime_r(&after, &when);
+    when.tm_sec = 0;
+    ++when.tm_min;
+
+    // Search a few years, enough to reach any February 29.
+    for ( int steps { 0 }; steps < 5 * 366; ++steps ) {
+        when.tm_isdst = -1;
+        std::mktime(&when);
+        if ( ! m_months[when.tm_mon + 1] ) {
+            ++when.tm_mon;
+            when.tm_mday = 1;
+            when.tm_hour = when.tm_min = 0;
+            continue;
+        }
+        if ( ! matchesDay(when) ) {
+            ++when.tm_mday;
+            when.tm_hour = when.tm_min = 0;
+            continue;
+        }
+
+        // Take the first hour and minute left in the day, if any.
+        for ( ; when.tm_hour < 24; ++when.tm_hour, when.tm_min = 0 ) {
+            if ( ! m_hours[when.tm_hour] ) {
+                continue;
+            }
+            while ( when.tm_min < 60 && ! m_minutes[when.tm_min] ) {
+                ++when.tm_min;
+            }
+            if ( when.tm_min == 60 ) {
+                continue;
+            }
+            when.tm_isdst = -1;
+            auto found { when };
+            auto time { std::mktime(&found) };
+            // A time skipped by a daylight saving change comes out later.
+            if ( time > after ) {
+                return time;
+            }
+        }
+        ++when.tm_mday;
+        when.tm_hour = when.tm_min = 0;
+    }
+    throw std::runtime_error("Schedule never runs.");
+}
+
+
+/* Returns the Actions in a schedule, one per line as five crontab fields
+ * (see CronSpec) followed by either "command", which runs on every port in
+ * `ports`, or "port command".
+ *
+ * Blank lines and lines starting with '#' are skipped.
+ *
+ * Throws `std::runtime_error` for a malformed line or an unknown command.
+ */
+std::vector<Action> read_schedule(std::istream &in, const std::vector<std::string> &ports) {
+    std::vector<Action> actions;
+    std::string line;
+    for ( int number { 1 }; std::getline(in, line); ++number ) {
+        std::istringstream words { line };
+        std::vector<std::string> fields;
+        for ( std::string word; words >> word; ) {
+            fields.push_back(word);
+        }
+        if ( fields.empty() || fields.front().front() == '#' ) {
+            continue;
+        }
+        auto where { "Schedule line " + std::to_string(number) + ": " };
+        if ( fields.size() < 6 || fields.size() > 7 ) {
+            throw std::runtime_error(where + "expected \"m h dom mon dow [port] command\".");
+        }
+
+        auto cmd { fields.back() };
+        if ( commands.count(cmd) == 0 && ! is_volume_set(cmd) ) {
+            throw std::runtime_error(where + "unknown command '" + cmd + "'.");
+        }
+        if ( is_volume_set(cmd) && ! volume_level(cmd) ) {
+            throw std::runtime_error(where + volume_error().what());
+        }
+        std::string spec;
+        for ( int i { 0 }; i < 5; ++i ) {
+            spec += fields[i] + ' ';
+        }
+        std::optional<CronSpec> when;
+        try {
+            when.emplace(spec);
+            when->next(std::time(nullptr));
+        } catch ( const std::runtime_error &e ) {
+            throw std::runtime_error(where + e.what());
+        }
+
+        if ( fields.size() == 7 ) {
+            actions.push_back(Action { *when, fields[5], cmd });
+        } else {
+            for ( const auto &port : ports ) {
+                actions.push_back(Action { *when, port, cmd });
+            }
+        }
+    }
+    return actions;
+}
+
+
+/* Schedules `actions` to run through `ports`, calling `done` with each
+ * result as it completes.
+ */
+Scheduler::Scheduler(PortManager &ports, std::vector<Action> actions,
+                     PortManager::Completion done, int concurrency, int retries)
+    : m_ports { ports },
+      m_actions { std::move(actions) },
+      m_done { std::move(done) },
+      m_concurrency { std::max(concurrency, 1) },
+      m_retries { retries },
+      m_epoch { std::chrono::steady_clock::now() },
+      m_due(m_actions.size())
+{
+    auto now { std::time(nullptr) };
+    for ( std::size_t i { 0 }; i < m_actions.size(); ++i ) {
+        m_ports.add(m_actions[i].port);
+        arm(i, now);
+    }
+}
+
+/* Sets Action `index` to fire next after the local time `after`. */
+void Scheduler::arm(std::size_t index, std::time_t after) {
+    m_due[index] = m_actions[index].when.next(after);
+    auto wait { std::max<std::time_t>(m_due[index] - std::time(nullptr), 0) };
+    m_wheel.add(elapsed() + wait * 1000, index);
+}
+
+/* Starts ready commands, one per port, on up to `m_concurrency` ports,
+ * taking ports in turn after the one last started.
+ */
+void Scheduler::dispatch() {
+    if ( m_ready.empty() ) {
+        return;
+    }
+    auto it { m_ready.upper_bound(m_cursor) };
+    for ( auto remaining { m_ready.size() }; remaining > 0 && m_running < m_concurrency;
+          --remaining ) {
+        if ( it == m_ready.end() ) {
+            it = m_ready.begin();
+        }
+        auto &[port, queue] { *it };
+        // A port which is away keeps its commands until it returns.
+        if ( ! m_ports.connected(port) || m_ports.pending(port) > 0 ) {
+            ++it;
+            continue;
+        }
+
+        // The command runs for as long as anyone still wants it.
+        auto &job { queue.front() };
+        auto deadline { std::max_element(job.waiting.begin(), job.waiting.end(),
+            [](const Waiter &a, const Waiter &b) { return a.deadline < b.deadline; })->deadline };
+        m_flight[port] = std::move(job.waiting);
+
+        m_cursor = port;
+        ++m_running;
+        m_ports.submit(port, job.cmd, [this, port](const Result &result) {
+            --m_running;
+            auto waiting { std::move(m_flight[port]) };
+            m_flight.erase(port);
+            for ( const auto &waiter : waiting ) {
+                if ( waiter.done ) {
+                    waiter.done(result);
+                }
+            }
+        }, m_retries, deadline);
+        queue.pop_front();
+        it = queue.empty() ? m_ready.erase(it) : std::next(it);
+    }
+}
+
+/* Returns the milliseconds since the scheduler was created. */
+uint64_t Scheduler::elapsed() const {
+    auto since { std::chrono::steady_clock::now() - m_epoch };
+    return std::chrono::duration_cast<std::chrono::milliseconds>(since).count();
+}
+
+/* Queues `cmd` to run on `port` by `deadline` and call `done`, by the
+ * rules given for the Scheduler: the same query waiting takes `done` as
+ * well, any other query joins the end of the queue and anything else goes
+ * ahead of the queries.  When the queue is full, anything but a query
+ * pushes out the oldest query waiting, and what finds no room gets an
+ * overload error ("overload" from error_class) at once.  A command whose
+ * deadline has already passed gets deadline_error() at once.
+ */
+void Scheduler::enqueue(const std::string &port, const std::string &cmd,
+                        PortManager::Completion done, Deadline deadline) {
+    if ( std::chrono::steady_clock::now() >= deadline ) {
+        refuse(port, cmd, done, std::make_exception_ptr(deadline_error()));
+        return;
+    }
+
+    auto &queue { m_ready[port] };
+    bool query { is_query_command(cmd) };
+    auto queries { std::find_if(queue.begin(), queue.end(),
+                                [](const Job &job) { return job.query; }) };
+
+    if ( query ) {
+        auto same { std::find_if(queries, queue.end(),
+                                 [&cmd](const Job &job) { return job.cmd == cmd; }) };
+        if ( same != queue.end() ) {
+            same->waiting.push_back(Waiter { std::move(done), deadline });
+            return;
+        }
+    }
+
+    // Refused and shed commands are answered last, as their callers may
+    // queue more.
+    std::optional<Job> shed;
+    if ( queue.size() >= PORT_MAX_QUEUE ) {
+        if ( query || queries == queue.end() ) {
+            refuse(port, cmd, done, overload());
+            return;
+        }
+        shed = std::move(*queries);
+        queries = queue.erase(queries);
+    }
+    queue.insert(query ? queue.end() : queries,
+                 Job { cmd, { Waiter { std::move(done), deadline } }, query });
+    if ( shed ) {
+        for ( const auto &waiter : shed->waiting ) {
+            refuse(port, shed->cmd, waiter.done, overload());
+        }
+    }
+}
+
+/* Answers everyone whose deadline has passed, whether their command waits
+ * or runs, and drops waiting commands nobody wants any more.  A running
+ * command gives itself up in the PortManager once its last asker's
+ * deadline passes.
+ */
+void Scheduler::expire() {
+    auto now { std::chrono::steady_clock::now() };
+    auto passed { [now](const Waiter &waiter) { return waiter.deadline <= now; } };
+
+    // Callers may queue more, so answer them only once the queues are done.
+    std::vector<std::tuple<std::string, std::string, Waiter>> expired;
+    auto collect { [&](const std::string &port, const std::string &cmd,
+                       std::vector<Waiter> &waiting) {
+        auto gone { std::stable_partition(waiting.begin(), waiting.end(),
+                                          [&](const Waiter &w) { return ! passed(w); }) };
+        for ( auto it { gone }; it != waiting.end(); ++it ) {
+            expired.emplace_back(port, cmd, std::move(*it));
+        }
+        waiting.erase(gone, waiting.end());
+    } };
+
+    for ( auto it { m_ready.begin() }; it != m_ready.end(); ) {
+        auto &[port, queue] { *it };
+        for ( auto job { queue.begin() }; job != queue.end(); ) {
+            collect(port, job->cmd, job->waiting);
+            job = job->waiting.empty() ? queue.erase(job) : std::next(job);
+        }
+        it = queue.empty() ? m_ready.erase(it) : std::next(it);
+    }
+    for ( auto &[port, waiting] : m_flight ) {
+        if ( std::any_of(waiting.begin(), waiting.end(), passed) ) {
+            collect(port, "", waiting);
+        }
+    }
+
+    for ( const auto &[port, cmd, waiter] : expired ) {
+        refuse(port, cmd, waiter.done, std::make_exception_ptr(deadline_error()));
+    }
+}
+
+/* Queues the command of Action `index` and sets the Action to fire again. */
+void Scheduler::fire(std::size_t index) {
+    const auto &action { m_actions[index] };
+    enqueue(action.port, action.cmd, m_done, NO_DEADLINE);
+    arm(index, m_due[index]);
+}
+
+/* Returns the number of commands due but not yet started. */
+std::size_t Scheduler::pending() const {
+    std::size_t count { 0 };
+    for ( const auto &[_unused, queue] : m_ready ) {
+        count += queue.size();
+    }
+    return count;
+}
+
+/* Returns the number of commands for `port` due but not yet started. */
+std::size_t Scheduler::pending(const std::string &port) const {
+    auto it { m_ready.find(port) };
+    return it == m_ready.end() ? 0 : it->second.size();
+}
+
+/* Queues `cmd` to run on `port` along with the scheduled commands, and
+ * calls `done` with its result, which is an overload error if the port's
+ * queue has no room, or deadline_error() if `deadline` passes first (see
+ * enqueue).  `done` may be called before this returns.
+ */
+void Scheduler::submit(const std::string &port, const std::string &cmd,
+                       PortManager::Completion done, Deadline deadline) {
+    m_ports.add(port);
+    enqueue(port, cmd, std::move(done), deadline);
+}
+
+/* Queues every Action now due, drops commands past their deadlines and
+ * starts what commands it can.
+ */
+void Scheduler::tick() {
+    m_wheel.advance(elapsed(), [this](std::size_t index) { fire(index); });
+    expire();
+    dispatch();
+}
+
+/* Returns the milliseconds until the next Action may be due or a waiting
+ * command's deadline passes, or -1 if neither ever will.
+ */
+int Scheduler::timeout() const {
+    auto limit { static_cast<uint64_t>(std::numeric_limits<int>::max()) };
+    auto now { elapsed() };
+    auto next { m_wheel.next() };
+
+    auto deadline { NO_DEADLINE };
+    for ( const auto &[_unused, queue] : m_ready ) {
+        for ( const auto &job : queue ) {
+            for ( const auto &waiter : job.waiting ) {
+                deadline = std::min(deadline, waiter.deadline);
+            }
+        }
+    }
+    for ( const auto &[_unused, waiting] : m_flight ) {
+        for ( const auto &waiter : waiting ) {
+            deadline = std::min(deadline, waiter.deadline);
+        }
+    }
+    if ( deadline != NO_DEADLINE ) {
+        auto left { std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now()).count() + 1 };
+        next = std::min(next, now + std::clamp<int64_t>(left, 0, limit));
+    }
+
+    if ( next == TimerWheel::NEVER ) {
+        return -1;
+    }
+    if ( next <= now ) {
+        return 0;
+    }
+    return static_cast<int>(std::min(next - now, limit));
+}
@@ -0,0 +1,171 @@
+/*
+    scheduler.h - cron-style scheduled commands
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H true
+
+#include "fanout.h"
+#include "portman.h"
+#include "timerwheel.h"
+
+#include <bitset>
+#include <chrono>
+#include <ctime>
+#include <deque>
+#include <istream>
+#include <map>
+#include <string>
+#include <vector>
+
+
+/* Most commands waiting for one port.  Past this, a command which changes
+ * something pushes out the oldest query waiting, and anything else is
+ * refused with an overload error (see Scheduler::submit).
+ */
+constexpr std::size_t PORT_MAX_QUEUE { 64 };
+
+
+/* When a scheduled command runs, as the first five fields of a crontab line:
+ *
+ *   minute (0-59) hour (0-23) day of month (1-31) month (1-12) weekday (0-7)
+ *
+ * Each field is "*", a number, a range "a-b" or a comma separated list of
+ * these, any of them optionally stepped with "/n".  Weekday 0 and 7 are both
+ * Sunday.  As in cron, when both the day of month and the weekday are
+ * restricted, a day matching either one will do.
+ */
+class CronSpec {
+
+    private:
+
+        std::bitset<60> m_minutes;
+        std::bitset<24> m_hours;
+        std::bitset<32> m_days;
+        std::bitset<13> m_months;
+        std::bitset<7> m_weekdays;
+
+        /* The day of month or weekday field was not "*". */
+        bool m_any_day { false };
+        bool m_any_weekday { false };
+
+        bool matchesDay(const std::tm &when) const;
+
+    public:
+
+        explicit CronSpec(const std::string &fields);
+
+        std::time_t next(std::time_t after) const;
+
+};
+
+
+/* A command to run on a port whenever `when` comes around. */
+struct Action {
+    CronSpec when;
+    std::string port;
+    std::string cmd;
+};
+
+
+/* Runs Actions on schedule through a PortManager.
+ *
+ * Each Action waits in a timer wheel of millisecond ticks until it is due,
+ * then joins its port's queue, as do commands given to submit().  Commands
+ * go to the PortManager one per port at a time, and to at most
+ * `concurrency` ports at once, so a schedule with many commands due in the
+ * same minute never floods the serial lines.
+ *
+ * Each port's queue holds at most PORT_MAX_QUEUE commands.  Queries wait
+ * behind every command which changes something, and a query asked again
+ * while it waits shares the one answer, so a client polling too hard costs
+ * the line no more than one query per value and never delays the controls.
+ * Each asker of a command is answered when its deadline passes, if the
+ * command has not finished by then, and a command nobody waits for any
+ * more is dropped (see Deadline).
+ */
+class Scheduler {
+
+    private:
+
+        /* Someone who wants a command's result until `deadline`. */
+        struct Waiter {
+            PortManager::Completion done;
+            Deadline deadline;
+        };
+
+        struct Job {
+            std::string cmd;
+            // everyone who asked for `cmd` while it waited
+            std::vector<Waiter> waiting;
+            bool query;
+        };
+
+        PortManager &m_ports;
+        std::vector<Action> m_actions;
+        PortManager::Completion m_done;
+        int m_concurrency;
+        int m_retries;
+
+        TimerWheel m_wheel;
+        std::chrono::steady_clock::time_point m_epoch;
+
+        /* The time each Action is next due, indexed like m_actions. */
+        std::vector<std::time_t> m_due;
+
+        /* Commands due but not yet started, keyed by port. */
+        std::map<std::string, std::deque<Job>> m_ready;
+
+        /* Those waiting for the command each port is running. */
+        std::map<std::string, std::vector<Waiter>> m_flight;
+
+        /* The port most recently given a command, for round robin. */
+        std::string m_cursor;
+
+        int m_running { 0 };
+
+        void arm(std::size_t index, std::time_t after);
+        void dispatch();
+        uint64_t elapsed() const;
+        void enqueue(const std::string &port, const std::string &cmd,
+                     PortManager::Completion done, Deadline deadline);
+        void expire();
+        void fire(std::size_t index);
+
+    public:
+
+        Scheduler(PortManager &ports, std::vector<Action> actions,
+                  PortManager::Completion done, int concurrency = FANOUT_CONCURRENCY,
+                  int retries = 0);
+
+        std::size_t pending() const;
+        std::size_t pending(const std::string &port) const;
+        void submit(const std::string &port, const std::string &cmd,
+                    PortManager::Completion done, Deadline deadline = NO_DEADLINE);
+        void tick();
+        int timeout() const;
+
+};
+
+
+std::vector<Action> read_schedule(std::istream &in, const std::vector<std::string> &ports);
+
+
+#endif
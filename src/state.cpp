@@ -0,0 +1,189 @@
+/*
+    state.cpp - latest known projector state, kept in memory
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include "state.h"
+#include "report.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <system_error>
+
+
+/* Returns `when` in nanoseconds since the epoch. */
+static long long nanoseconds(std::chrono::system_clock::time_point when) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            when.time_since_epoch()).count();
+}
+
+
+/* Starts keeping state for `port`, if not already. */
+void StateCache::add(const std::string &port) {
+    if ( m_ports.emplace(port, Projector {}).second ) {
+        m_order.push_back(port);
+    }
+}
+
+/* Returns the state of `port`, or nullptr if it is not kept. */
+const StateCache::Projector *StateCache::find(const std::string &port) const {
+    auto it { m_ports.find(port) };
+    return it == m_ports.end() ? nullptr : &it->second;
+}
+
+/* Writes the state of `port` to `out` as a JSON object, e.g.
+ *
+ *   {"port":"/dev/ttyUSB0","online":true,"updated":...,
+ *    "values":{"pow":{"value":"on","updated":...}}}
+ *
+ * with times in nanoseconds since the epoch.
+ */
+void StateCache::json(std::ostream &out, const std::string &port) const {
+    auto it { m_ports.find(port) };
+    if ( it == m_ports.end() ) {
+        throw std::out_of_range("unknown port");
+    }
+    const auto &projector { it->second };
+
+    out << "{\"port\":";
+    json_string(out, port);
+    out << ",\"online\":" << (projector.online ? "true" : "false")
+        << ",\"updated\":" << nanoseconds(projector.updated) << ",\"values\":{";
+    const char *separator { "" };
+    for ( const auto &[key, entry] : projector.values ) {
+        out << separator << '"' << spelling(KEY_WORDS, key) << "\":{\"value\":";
+        json_string(out, entry.value);
+        out << ",\"updated\":" << nanoseconds(entry.updated) << '}';
+        separator = ",";
+    }
+    out << "}}";
+}
+
+/* Returns every port kept, in the order added. */
+const std::vector<std::string> &StateCache::ports() const {
+    return m_order;
+}
+
+/* Folds the outcome of one command into the state of its port.
+ *
+ * A reply sets the value of the key it names.  A projector refusal leaves
+ * values alone, while a serial port error marks the port offline.
+ *
+ * Returns true if any value or the port's online state changed.
+ */
+bool StateCache::record(const Result &result) {
+    add(result.port);
+    auto &projector { m_ports[result.port] };
+    auto now { std::chrono::system_clock::now() };
+    bool changed { false };
+
+    bool online { true };
+    if ( result.error ) {
+        try {
+            std::rethrow_exception(result.error);
+        } catch ( const std::system_error &e ) {
+            online = false;
+        } catch ( ... ) {
+        }
+    }
+    if ( result.attempts > 0 ) {
+        changed = projector.online != online;
+        projector.online = online;
+        projector.updated = now;
+    }
+
+    auto reply { result.decoded() };
+    if ( ! result.error && reply.key != Key::Unknown ) {
+        auto &entry { projector.values[reply.key] };
+        auto value { value_text(reply) };
+        changed = changed || entry.value != value;
+        entry.value = value;
+        entry.updated = now;
+    }
+    return changed;
+}
+
+
+PollPlan::PollPlan(std::chrono::milliseconds shortest, std::chrono::milliseconds longest)
+    : m_shortest { shortest },
+      m_longest { std::max(longest, shortest) }
+{
+}
+
+/* Starts polling `key` on `port`, at once, if not already. */
+void PollPlan::add(const std::string &port, Key key) {
+    m_slots[port].emplace(key, Slot { m_shortest, std::chrono::steady_clock::now() });
+}
+
+/* Brings every key of `port` back to the shortest interval. */
+void PollPlan::changed(const std::string &port) {
+    auto soon { std::chrono::steady_clock::now() + m_shortest };
+    for ( auto &[_unused, slot] : m_slots[port] ) {
+        slot.interval = m_shortest;
+        slot.due = std::min(slot.due, soon);
+    }
+}
+
+/* Returns the keys of `port` due to be polled, which are then pending until
+ * polled() is called for each.
+ */
+std::vector<Key> PollPlan::due(const std::string &port) {
+    auto now { std::chrono::steady_clock::now() };
+    std::vector<Key> keys;
+    for ( auto &[key, slot] : m_slots[port] ) {
+        if ( ! slot.pending && slot.due <= now ) {
+            slot.pending = true;
+            keys.push_back(key);
+        }
+    }
+    return keys;
+}
+
+/* Schedules the next poll of `key` on `port`, backing off one step.  Call
+ * changed() as well if the poll found a new value.
+ */
+void PollPlan::polled(const std::string &port, Key key) {
+    auto &slot { m_slots[port][key] };
+    slot.pending = false;
+    slot.interval = std::min(slot.interval * 2, m_longest);
+    slot.due = std::chrono::steady_clock::now() + slot.interval;
+}
+
+/* Returns the milliseconds until a key is due to be polled, or -1 if none
+ * is waiting.
+ */
+int PollPlan::timeout() const {
+    using clock = std::chrono::steady_clock;
+    auto next { clock::time_point::max() };
+    for ( const auto &[_unused, slots] : m_slots ) {
+        for ( const auto &[_unused, slot] : slots ) {
+            if ( ! slot.pending ) {
+                next = std::min(next, slot.due);
+            }
+        }
+    }
+    if ( next == clock::time_point::max() ) {
+        return -1;
+    }
+    auto now { clock::now() };
+    if ( next <= now ) {
+        return 0;
+    }
+    return std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count() + 1;
+}
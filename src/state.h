@@ -0,0 +1,111 @@
+/*
+    state.h - latest known projector state, kept in memory
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#ifndef STATE_H
+#define STATE_H true
+
+#include "decode.h"
+#include "exchange.h"
+
+#include <chrono>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+
+/* Latest known state of every projector a long-running bewield talks to,
+ * gathered from the results of the commands it runs.
+ *
+ * Readers are answered from memory, without touching the serial ports.
+ */
+class StateCache {
+
+    public:
+
+        /* The latest value seen for one key of one projector. */
+        struct Entry {
+            // e.g. "on" or "12", as value_text() spells it
+            std::string value;
+            std::chrono::system_clock::time_point updated;
+        };
+
+        struct Projector {
+            // the latest command got a reply
+            bool online { false };
+            std::chrono::system_clock::time_point updated;
+            std::map<Key, Entry> values;
+        };
+
+    private:
+
+        /* Ports in the order first added. */
+        std::vector<std::string> m_order;
+        std::map<std::string, Projector> m_ports;
+
+    public:
+
+        void add(const std::string &port);
+        const Projector *find(const std::string &port) const;
+        void json(std::ostream &out, const std::string &port) const;
+        const std::vector<std::string> &ports() const;
+        bool record(const Result &result);
+
+};
+
+
+/* When to next poll each key of each port.
+ *
+ * A key starts out polled every `shortest` interval.  Each poll which finds
+ * its value unchanged doubles the interval, up to `longest`, so quiet keys
+ * cost little serial time.  A change on a port brings every key of that port
+ * back to the shortest interval, since one change (usually power) brings
+ * others with it.
+ */
+class PollPlan {
+
+    private:
+
+        struct Slot {
+            std::chrono::milliseconds interval;
+            std::chrono::steady_clock::time_point due;
+            // polled and not yet answered
+            bool pending { false };
+        };
+
+        std::chrono::milliseconds m_shortest;
+        std::chrono::milliseconds m_longest;
+        std::map<std::string, std::map<Key, Slot>> m_slots;
+
+    public:
+
+        PollPlan(std::chrono::milliseconds shortest, std::chrono::milliseconds longest);
+
+        void add(const std::string &port, Key key);
+        void changed(const std::string &port);
+        std::vector<Key> due(const std::string &port);
+        void polled(const std::string &port, Key key);
+        int timeout() const;
+
+};
+
+
+#endif
@@ -0,0 +1,214 @@
+/*
+    timerwheel.cpp - hierarchical timer wheel
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include "timerwheel.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+
+/* Returns `bits` rotated right by `count`, below 64. */
+static uint64_t rotate(uint64_t bits, unsigned count) {
+    return count == 0 ? bits : (bits >> count) | (bits << (64 - count));
+}
+
+
+/* An empty wheel whose latest processed tick is `now`. */
+TimerWheel::TimerWheel(uint64_t now)
+    : m_now { now }
+{
+    m_heads.fill(NIL);
+}
+
+/* Returns a timer which expires at tick `expires`, or at the next tick if
+ * that has passed, and passes `data` to the expiry callback.
+ */
+TimerWheel::Handle TimerWheel::add(uint64_t expires, std::size_t data) {
+    uint32_t id;
+    if ( m_free != NIL ) {
+        id = m_free;
+        m_free = m_nodes[id].next;
+    } else {
+        if ( m_nodes.size() >= NIL ) {
+            throw std::length_error("too many timers");
+        }
+        id = static_cast<uint32_t>(m_nodes.size());
+        m_nodes.push_back(Node {});
+    }
+    m_nodes[id].expires = expires;
+    m_nodes[id].data = data;
+    link(id);
+    ++m_size;
+    return id;
+}
+
+/* Processes every tick up to and including `to`, calling `expired` for each
+ * timer due.  Timers may be added from `expired`.
+ *
+ * Runs of ticks with nothing to do are skipped, so a long idle stretch costs
+ * at most a few steps per level.
+ */
+void TimerWheel::advance(uint64_t to, const Expiry &expired) {
+    std::vector<std::size_t> due;
+    while ( m_now < to ) {
+        auto tick { next() };
+        if ( tick > to ) {
+            m_now = to;
+            break;
+        }
+
+        // Cascade from the top, so timers land in slots not yet cascaded.
+        m_now = tick - 1;
+        for ( int level { WHEEL_LEVELS - 1 }; level > 0; --level ) {
+            auto span { uint64_t { 1 } << (WHEEL_BITS * level) };
+            if ( tick % span == 0 ) {
+                cascade(level, tick);
+            }
+        }
+
+        for ( auto id { detach(tick % WHEEL_SLOTS) }; id != NIL; ) {
+            auto &node { m_nodes[id] };
+            due.push_back(node.data);
+            auto following { node.next };
+            node.slot = NIL;
+            node.next = m_free;
+            m_free = id;
+            --m_size;
+            id = following;
+        }
+        m_now = tick;
+
+        for ( auto data : due ) {
+            expired(data);
+        }
+        due.clear();
+    }
+}
+
+/* Stops `timer` from firing.  Cancelling a Handle which already fired or
+ * was cancelled is a no-op, unless the Handle has been reused since.
+ */
+void TimerWheel::cancel(Handle timer) {
+    if ( timer >= m_nodes.size() || m_nodes[timer].slot == NIL ) {
+        return;
+    }
+    unlink(timer);
+    m_nodes[timer].slot = NIL;
+    m_nodes[timer].next = m_free;
+    m_free = timer;
+    --m_size;
+}
+
+/* Moves every timer in the slot of `level` whose span begins at `tick`
+ * down to the levels below.
+ */
+void TimerWheel::cascade(int level, uint64_t tick) {
+    auto slot { (tick >> (WHEEL_BITS * level)) % WHEEL_SLOTS };
+    for ( auto id { detach(level * WHEEL_SLOTS + slot) }; id != NIL; ) {
+        auto following { m_nodes[id].next };
+        link(id);
+        id = following;
+    }
+}
+
+/* Empties `slot` and returns the first node which was in it. */
+uint32_t TimerWheel::detach(uint32_t slot) {
+    auto head { m_heads[slot] };
+    m_heads[slot] = NIL;
+    m_occupied[slot / WHEEL_SLOTS] &= ~(uint64_t { 1 } << (slot % WHEEL_SLOTS));
+    return head;
+}
+
+/* Puts node `id` in the slot for its expiry, counted from the next tick. */
+void TimerWheel::link(uint32_t id) {
+    auto &node { m_nodes[id] };
+    auto base { m_now + 1 };
+    auto expires { std::max(node.expires, base) };
+    auto delta { expires - base };
+
+    int level { 0 };
+    while ( level < WHEEL_LEVELS - 1
+            && delta >= (uint64_t { 1 } << (WHEEL_BITS * (level + 1))) ) {
+        ++level;
+    }
+    uint64_t slot;
+    if ( delta >> (WHEEL_BITS * WHEEL_LEVELS) ) {
+        // Beyond the wheel: wait a full turn of the last level, then retry.
+        slot = (base >> (WHEEL_BITS * level)) % WHEEL_SLOTS;
+    } else {
+        slot = (expires >> (WHEEL_BITS * level)) % WHEEL_SLOTS;
+    }
+
+    node.slot = level * WHEEL_SLOTS + slot;
+    node.prev = NIL;
+    node.next = m_heads[node.slot];
+    if ( node.next != NIL ) {
+        m_nodes[node.next].prev = id;
+    }
+    m_heads[node.slot] = id;
+    m_occupied[level] |= uint64_t { 1 } << slot;
+}
+
+/* Returns the earliest tick at which a timer may expire or be cascaded, or
+ * NEVER if there are no timers.
+ */
+uint64_t TimerWheel::next() const {
+    auto base { m_now + 1 };
+    auto earliest { NEVER };
+    for ( int level { 0 }; level < WHEEL_LEVELS; ++level ) {
+        if ( m_occupied[level] == 0 ) {
+            continue;
+        }
+        auto shift { WHEEL_BITS * level };
+        // The first span of this level to begin at or after base.
+        auto first { (base + (uint64_t { 1 } << shift) - 1) >> shift };
+        auto bits { rotate(m_occupied[level], first % WHEEL_SLOTS) };
+        auto tick { (first + __builtin_ctzll(bits)) << shift };
+        earliest = std::min(earliest, tick);
+    }
+    return earliest;
+}
+
+/* Returns the latest tick processed. */
+uint64_t TimerWheel::now() const {
+    return m_now;
+}
+
+/* Returns the number of pending timers. */
+std::size_t TimerWheel::size() const {
+    return m_size;
+}
+
+/* Takes node `id` out of its slot. */
+void TimerWheel::unlink(uint32_t id) {
+    auto &node { m_nodes[id] };
+    if ( node.prev != NIL ) {
+        m_nodes[node.prev].next = node.next;
+    } else {
+        m_heads[node.slot] = node.next;
+    }
+    if ( node.next != NIL ) {
+        m_nodes[node.next].prev = node.prev;
+    }
+    if ( m_heads[node.slot] == NIL ) {
+        m_occupied[node.slot / WHEEL_SLOTS] &= ~(uint64_t { 1 } << (node.slot % WHEEL_SLOTS));
+    }
+}
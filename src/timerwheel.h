@@ -0,0 +1,117 @@
+/*
+    timerwheel.h - hierarchical timer wheel
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H true
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <vector>
+
+
+/* Bits of the tick count resolved by each level of the wheel. */
+constexpr int WHEEL_BITS { 6 };
+
+/* Slots in each level of the wheel. */
+constexpr std::size_t WHEEL_SLOTS { 1u << WHEEL_BITS };
+
+/* Levels in the wheel.  Together they span 2^36 ticks, about 795 days of
+ * millisecond ticks; later timers wait in the last level until they are in
+ * range.
+ */
+constexpr int WHEEL_LEVELS { 6 };
+
+
+/* Timers keyed by an expiry tick, in a hierarchical timing wheel.
+ *
+ * Level 0 has one slot per tick for the next 64 ticks.  Each higher level
+ * has one slot per 64 slots of the level below, and a slot is cascaded down
+ * a level when its span begins.  Adding and cancelling a timer take constant
+ * time, as does expiring one, however many are pending; each timer is
+ * cascaded at most once per level.
+ *
+ * Ticks are whatever unit the caller counts in, from an arbitrary zero.
+ */
+class TimerWheel {
+
+    public:
+
+        /* Identifies a pending timer.  A Handle is reused once its timer
+         * fires or is cancelled.
+         */
+        using Handle = uint32_t;
+
+        /* Called with the data of each timer as it expires. */
+        using Expiry = std::function<void(std::size_t data)>;
+
+        static constexpr uint64_t NEVER { std::numeric_limits<uint64_t>::max() };
+
+    private:
+
+        static constexpr uint32_t NIL { std::numeric_limits<uint32_t>::max() };
+
+        struct Node {
+            uint64_t expires;
+            std::size_t data;
+            // neighbours in the slot's list, or in the free list
+            uint32_t prev;
+            uint32_t next;
+            // level * WHEEL_SLOTS + slot, or NIL while free
+            uint32_t slot;
+        };
+
+        std::vector<Node> m_nodes;
+        uint32_t m_free { NIL };
+
+        /* First node in each slot, level by level. */
+        std::array<uint32_t, WHEEL_LEVELS * WHEEL_SLOTS> m_heads;
+
+        /* Bit n set while slot n of a level holds a node. */
+        std::array<uint64_t, WHEEL_LEVELS> m_occupied {};
+
+        /* The latest tick processed. */
+        uint64_t m_now { 0 };
+
+        std::size_t m_size { 0 };
+
+        void cascade(int level, uint64_t tick);
+        uint32_t detach(uint32_t slot);
+        void link(uint32_t id);
+        void unlink(uint32_t id);
+
+    public:
+
+        explicit TimerWheel(uint64_t now = 0);
+
+        Handle add(uint64_t expires, std::size_t data);
+        void advance(uint64_t to, const Expiry &expired);
+        void cancel(Handle timer);
+        uint64_t next() const;
+        uint64_t now() const;
+        std::size_t size() const;
+
+};
+
+
+#endif
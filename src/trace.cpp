@@ -0,0 +1,315 @@
+/*
+    trace.cpp - low overhead trace of serial port traffic
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include "trace.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+
+
+Trace *Trace::s_active { nullptr };
+
+
+/* Returns the nanoseconds on `clock` since its epoch. */
+template <typename Clock>
+static uint64_t nanoseconds() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            Clock::now().time_since_epoch()).count();
+}
+
+/* Writes all `size` bytes at `data` to `fd` at `offset`, returning false on
+ * failure.  Positioned writes leave the file offset alone, so a signal
+ * handler may call this while the program is itself in the middle of one.
+ */
+static bool write_all(int fd, const void *data, std::size_t size, off_t offset) {
+    auto next { static_cast<const char *>(data) };
+    while ( size > 0 ) {
+        auto ret { pwrite(fd, next, size, offset) };
+        if ( ret < 0 && errno == EINTR ) {
+            continue;
+        }
+        if ( ret <= 0 ) {
+            return false;
+        }
+        next += ret;
+        size -= ret;
+        offset += ret;
+    }
+    return true;
+}
+
+
+/* Starts a trace holding up to `capacity` records, or a capture of every
+ * record if `keep_all`, to be written to `path`.
+ *
+ * The file is opened now, so dump() need not allocate or open anything and
+ * may run in a signal handler.
+ *
+ * Throws `std::system_error` if `path` cannot be created.
+ */
+Trace::Trace(const std::string &path, bool keep_all, std::size_t capacity)
+    : m_keep_all { keep_all },
+      m_ring(std::max<std::size_t>(capacity, 1)),
+      m_start { nanoseconds<std::chrono::steady_clock>() },
+      m_start_wall { nanoseconds<std::chrono::system_clock>() }
+{
+    m_fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if ( m_fd < 0 ) {
+        throw std::system_error(std::error_code(errno, std::system_category()),
+                                std::string("trace file open failed"));
+    }
+    if ( s_active == nullptr ) {
+        s_active = this;
+    }
+}
+
+/* Writes out the trace and closes its file. */
+Trace::~Trace() {
+    if ( s_active == this ) {
+        s_active = nullptr;
+    }
+    dump();
+    close(m_fd);
+}
+
+/* Returns the Trace which Lineal records into, or nullptr if none. */
+Trace *Trace::active() {
+    return s_active;
+}
+
+/* Writes out the active trace on `signal`.  Any signal but SIGUSR1 then
+ * takes its default action, so a trace survives an interrupted run.
+ *
+ * Install with std::signal().
+ */
+void Trace::handle(int signal) {
+    if ( s_active != nullptr ) {
+        s_active->dump();
+    }
+    if ( signal != SIGUSR1 ) {
+        std::signal(signal, SIG_DFL);
+        std::raise(signal);
+    }
+}
+
+/* Writes the records now in memory to the trace file, replacing its
+ * contents, or for a capture adding to them.  Recording continues, so a
+ * later dump() holds later records.
+ *
+ * Only calls async-signal-safe functions.  A dump() interrupting record()
+ * leaves out the record being made.
+ */
+void Trace::dump() noexcept {
+    auto count { m_count.load(std::memory_order_acquire) };
+    std::atomic_signal_fence(std::memory_order_acquire);
+    auto capacity { m_ring.size() };
+
+    TraceHeader header {};
+    header.magic = TRACE_MAGIC;
+    header.version = TRACE_VERSION;
+    header.record_size = sizeof(TraceRecord);
+    header.ports = m_ports.load(std::memory_order_acquire);
+    header.start = m_start;
+    header.start_wall = m_start_wall;
+
+    // Records from `first` in the ring go to the file from record `placed`.
+    uint64_t held;
+    uint64_t placed;
+    if ( m_keep_all ) {
+        header.name_slots = TRACE_PORTS;
+        held = count - m_written;
+        placed = m_written;
+        header.records = count;
+    } else {
+        // Once the ring has wrapped, the oldest slot may be mid rewrite.
+        header.name_slots = header.ports;
+        held = count < capacity ? count : capacity - 1;
+        placed = 0;
+        header.records = held;
+        header.lost = count - held;
+    }
+    auto first { (count - held) % capacity };
+
+    off_t names { sizeof(header) };
+    off_t records { static_cast<off_t>(names + header.name_slots * sizeof(TraceName)
+                                       + placed * sizeof(TraceRecord)) };
+    auto tail { std::min<uint64_t>(held, capacity - first) };
+    if ( ! write_all(m_fd, &m_ring[first], tail * sizeof(TraceRecord), records)
+         || ! write_all(m_fd, &m_ring[0], (held - tail) * sizeof(TraceRecord),
+                        records + tail * sizeof(TraceRecord))
+         || ! write_all(m_fd, m_names.data(), header.ports * sizeof(TraceName), names)
+         || ! write_all(m_fd, &header, sizeof(header), 0) ) {
+        return;
+    }
+
+    if ( ! m_keep_all ) {
+        // Readers go by the header, so a failed trim only leaves stale bytes.
+        auto size { records + held * sizeof(TraceRecord) };
+        if ( ftruncate(m_fd, size) != 0 ) {
+            return;
+        }
+    }
+}
+
+/* Returns true if this is a capture, keeping every record. */
+bool Trace::keepsAll() const {
+    return m_keep_all;
+}
+
+/* Returns the index naming `path` in this trace, adding it if new, or
+ * TRACE_UNNAMED once TRACE_PORTS ports are named.
+ */
+uint16_t Trace::port(const std::string &path) {
+    auto ports { m_ports.load(std::memory_order_relaxed) };
+    for ( uint32_t i { 0 }; i < ports; ++i ) {
+        if ( path == m_names[i].path ) {
+            return i;
+        }
+    }
+    if ( ports == TRACE_PORTS ) {
+        return TRACE_UNNAMED;
+    }
+    std::strncpy(m_names[ports].path, path.c_str(), sizeof(m_names[ports].path) - 1);
+    m_ports.store(ports + 1, std::memory_order_release);
+    return ports;
+}
+
+/* Records `length` bytes at `bytes` moving in `direction` on `port`. */
+void Trace::record(uint16_t port, TraceDirection direction,
+                   const char *bytes, std::size_t length) noexcept {
+    auto time { nanoseconds<std::chrono::steady_clock>() };
+    auto count { m_count.load(std::memory_order_relaxed) };
+    while ( length > 0 ) {
+        auto &record { m_ring[count % m_ring.size()] };
+        auto chunk { std::min(length, TRACE_CHUNK) };
+        record.time = time;
+        record.port = port;
+        record.direction = direction;
+        record.length = chunk;
+        std::memcpy(record.bytes, bytes, chunk);
+        bytes += chunk;
+        length -= chunk;
+        // Publish the record only once it is whole, even to a signal handler.
+        std::atomic_signal_fence(std::memory_order_release);
+        m_count.store(++count, std::memory_order_release);
+
+        if ( m_keep_all && count - m_written == m_ring.size() ) {
+            // The staging ring is full; move it to the file.
+            dump();
+            m_written = count;
+        }
+    }
+}
+
+
+/* Maps the trace file at `path` for reading.
+ *
+ * Throws `std::system_error` if the file cannot be mapped and
+ * `std::runtime_error` if it is not a compatible trace.
+ */
+TraceReader::TraceReader(const std::string &path) {
+    auto fd { open(path.c_str(), O_RDONLY | O_CLOEXEC) };
+    if ( fd < 0 ) {
+        throw std::system_error(std::error_code(errno, std::system_category()),
+                                std::string("trace file open failed"));
+    }
+
+    struct stat info;
+    if ( fstat(fd, &info) != 0 ) {
+        auto err { errno };
+        close(fd);
+        throw std::system_error(std::error_code(err, std::system_category()),
+                                std::string("trace file open failed"));
+    }
+    if ( static_cast<std::size_t>(info.st_size) < sizeof(TraceHeader) ) {
+        close(fd);
+        throw std::runtime_error("Not a trace file.");
+    }
+
+    auto map { mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0) };
+    auto err { errno };
+    close(fd);
+    if ( map == MAP_FAILED ) {
+        throw std::system_error(std::error_code(err, std::system_category()),
+                                std::string("trace file map failed"));
+    }
+
+    auto header { static_cast<const TraceHeader *>(map) };
+    auto size { static_cast<std::size_t>(info.st_size) };
+    if ( header->magic != TRACE_MAGIC
+         || header->version != TRACE_VERSION
+         || header->record_size != sizeof(TraceRecord)
+         || header->ports > header->name_slots
+         || header->name_slots > TRACE_PORTS
+         || sizeof(TraceHeader) + header->name_slots * sizeof(TraceName)
+            + header->records * sizeof(TraceRecord) > size ) {
+        munmap(map, size);
+        throw std::runtime_error("Not a compatible trace file.");
+    }
+
+    // Readers go through the records in order, so read well ahead.
+    madvise(map, size, MADV_SEQUENTIAL);
+
+    m_map = map;
+    m_size = size;
+    m_header = header;
+    m_names = reinterpret_cast<const TraceName *>(m_header + 1);
+    m_records = reinterpret_cast<const TraceRecord *>(m_names + m_header->name_slots);
+}
+
+TraceReader::~TraceReader() {
+    if ( m_map != nullptr ) {
+        munmap(m_map, m_size);
+    }
+}
+
+const TraceHeader &TraceReader::header() const {
+    return *m_header;
+}
+
+/* Returns the path of port `index`, or "?" for an unnamed port. */
+std::string TraceReader::port(uint16_t index) const {
+    if ( index >= m_header->ports ) {
+        return "?";
+    }
+    const auto &name { m_names[index].path };
+    return std::string(name, strnlen(name, sizeof(name)));
+}
+
+/* Returns the records, oldest first. */
+const TraceRecord *TraceReader::records() const {
+    return m_records;
+}
+
+/* Returns the quantity of records. */
+std::size_t TraceReader::size() const {
+    return m_header->records;
+}
@@ -0,0 +1,187 @@
+/*
+    trace.h - low overhead trace of serial port traffic
+    Copyright 2021 Scottsdale Community College
+    Author: Sean Robinson <sean.robinson@scottsdalecc.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#ifndef TRACE_H
+#define TRACE_H true
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+/* A trace file is laid out as:
+ *
+ *   TraceHeader                    64 bytes
+ *   TraceName[name_slots]          port paths, indexed by TraceRecord.port
+ *   TraceRecord[records]           oldest first
+ *
+ * Every structure is fixed size, little endian and naturally aligned.  Each
+ * read(2) or write(2) on a port becomes one record, or several if it moved
+ * more than TRACE_CHUNK bytes; the records of one call share its time.
+ *
+ * A trace keeps only its newest records and has one name slot per port.  A
+ * capture keeps every record, streamed to the file as it runs, so it
+ * reserves TRACE_PORTS name slots ahead of them.
+ */
+
+/* "BWTR" in a little endian file. */
+constexpr uint32_t TRACE_MAGIC { 0x52545742 };
+constexpr uint32_t TRACE_VERSION { 2 };
+
+/* Bytes of port traffic held by one record. */
+constexpr std::size_t TRACE_CHUNK { 20 };
+
+/* Records held in memory by default, 2 MiB worth.  Once full, the oldest
+ * records give way to new ones.
+ */
+constexpr std::size_t TRACE_RECORDS { 65536 };
+
+/* Distinct ports a trace can name. */
+constexpr std::size_t TRACE_PORTS { 64 };
+
+/* TraceRecord.port for traffic on ports beyond TRACE_PORTS. */
+constexpr uint16_t TRACE_UNNAMED { 0xffff };
+
+
+enum class TraceDirection : uint8_t {
+    Write,      // sent to the port
+    Read,       // received from the port
+};
+
+struct TraceHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t ports;
+    uint64_t records;
+    // records overwritten in memory before the trace was written out
+    uint64_t lost;
+    // steady clock and wall clock times, in nanoseconds, when tracing began
+    uint64_t start;
+    uint64_t start_wall;
+    // TraceName entries ahead of the records, at least `ports`
+    uint32_t name_slots;
+    char reserved[ 12 ];
+};
+
+struct TraceName {
+    char path[ 128 ];
+};
+
+struct TraceRecord {
+    // steady clock time, in nanoseconds
+    uint64_t time;
+    uint16_t port;
+    TraceDirection direction;
+    uint8_t length;
+    char bytes[ TRACE_CHUNK ];
+};
+
+static_assert(sizeof(TraceHeader) == 64);
+static_assert(sizeof(TraceRecord) == 32);
+
+
+/* Records port traffic into a preallocated ring in memory, written out to a
+ * file by dump().
+ *
+ * Recording is a clock read and a copy, cheap enough to leave on.  While a
+ * Trace exists it is the active() one, which every Lineal records into.
+ *
+ * A Trace made to `keep_all` records is a capture: the ring is a staging
+ * buffer, written to the file whenever it fills, so nothing is lost.
+ */
+class Trace {
+
+    private:
+
+        static Trace *s_active;
+
+        int m_fd { -1 };
+
+        bool m_keep_all;
+
+        std::vector<TraceRecord> m_ring;
+
+        /* Records of a capture already in the file. */
+        uint64_t m_written { 0 };
+
+        /* Records ever made; the newest is at (m_count - 1) % ring size. */
+        std::atomic<uint64_t> m_count { 0 };
+
+        std::array<TraceName, TRACE_PORTS> m_names {};
+        std::atomic<uint32_t> m_ports { 0 };
+
+        uint64_t m_start { 0 };
+        uint64_t m_start_wall { 0 };
+
+    public:
+
+        explicit Trace(const std::string &path, bool keep_all = false,
+                       std::size_t capacity = TRACE_RECORDS);
+        ~Trace();
+
+        Trace(const Trace &) = delete;
+        Trace &operator=(const Trace &) = delete;
+
+        static Trace *active();
+        static void handle(int signal);
+
+        void dump() noexcept;
+        bool keepsAll() const;
+        uint16_t port(const std::string &path);
+        void record(uint16_t port, TraceDirection direction,
+                    const char *bytes, std::size_t length) noexcept;
+
+};
+
+
+/* A trace file mapped for reading. */
+class TraceReader {
+
+    private:
+
+        void *m_map { nullptr };
+        std::size_t m_size { 0 };
+
+        const TraceHeader *m_header { nullptr };
+        const TraceName *m_names { nullptr };
+        const TraceRecord *m_records { nullptr };
+
+    public:
+
+        explicit TraceReader(const std::string &path);
+        ~TraceReader();
+
+        TraceReader(const TraceReader &) = delete;
+        TraceReader &operator=(const TraceReader &) = delete;
+
+        const TraceHeader &header() const;
+        std::string port(uint16_t index) const;
+        const TraceRecord *records() const;
+        std::size_t size() const;
+
+};
+
+
+#endif